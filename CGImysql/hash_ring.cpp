@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "hash_ring.h"
+
+//FNV-1a后再做一次混合，虚拟节点名只差末尾几个字符，需要把差异扩散到高位
+uint64_t hash_ring::hash(const char *s, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+void hash_ring::build(const vector<string> &ids, int vnodes)
+{
+    m_points.clear();
+    m_shards = (int)ids.size();
+    char key[300];
+    for (int i = 0; i < m_shards; ++i)
+    {
+        for (int v = 0; v < vnodes; ++v)
+        {
+            int len = snprintf(key, sizeof(key), "%s#%d", ids[i].c_str(), v);
+            if (len >= (int)sizeof(key))
+                len = sizeof(key) - 1;
+            m_points.push_back(make_pair(hash(key, len), i));
+        }
+    }
+    sort(m_points.begin(), m_points.end());
+}
+
+int hash_ring::locate(const char *name) const
+{
+    if (m_points.empty())
+        return -1;
+    uint64_t h = hash(name, strlen(name));
+    //顺时针方向第一个虚拟节点
+    vector<pair<uint64_t, int> >::const_iterator it =
+        lower_bound(m_points.begin(), m_points.end(), make_pair(h, -1));
+    if (it == m_points.end())
+        it = m_points.begin();
+    return it->second;
+}
+
+bool hash_ring::parse_endpoints(const string &spec, vector<pair<string, int> > &endpoints)
+{
+    size_t begin = 0;
+    while (begin < spec.size())
+    {
+        size_t end = spec.find(',', begin);
+        if (end == string::npos)
+            end = spec.size();
+        string item = spec.substr(begin, end - begin);
+        begin = end + 1;
+        if (item.empty())
+            continue;
+        size_t colon = item.rfind(':');
+        long port = 3306;
+        if (colon != string::npos)
+        {
+            char *tail = NULL;
+            port = strtol(item.c_str() + colon + 1, &tail, 10);
+            if (tail == item.c_str() + colon + 1 || *tail)
+                return false;
+            item = item.substr(0, colon);
+        }
+        if (item.empty() || port <= 0 || port > 65535)
+            return false;
+        endpoints.push_back(make_pair(item, (int)port));
+    }
+    return true;
+}
+
+string hash_ring::endpoint_id(const string &host, int port)
+{
+    char id[300];
+    snprintf(id, sizeof(id), "%s:%d", host.c_str(), port);
+    return id;
+}
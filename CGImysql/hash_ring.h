@@ -0,0 +1,40 @@
+/*************************************************************
+*一致性哈希环，不依赖数据库
+*迁移工具reshard与服务器共用，保证两边的路由一致
+**************************************************************/
+
+#ifndef _HASH_RING_
+#define _HASH_RING_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include <stddef.h>
+
+using namespace std;
+
+class hash_ring
+{
+public:
+    hash_ring() : m_shards(0) {}
+
+    //ids为各分片的稳定标识（主库的host:port），顺序即分片下标
+    void build(const vector<string> &ids, int vnodes = 160);
+    //用户名所在的分片下标，环为空时返回-1
+    int locate(const char *name) const;
+    int size() const { return m_shards; }
+
+    static uint64_t hash(const char *s, size_t len);
+
+    //解析"host:port,host:port"，省略端口时使用3306，端口必须是1~65535的整数
+    static bool parse_endpoints(const string &spec, vector<pair<string, int> > &endpoints);
+    //分片标识"host:port"，端口按整数重新格式化，"db:03306"与"db:3306"是同一个分片
+    static string endpoint_id(const string &host, int port);
+
+private:
+    vector<pair<uint64_t, int> > m_points;      //按哈希值排序的虚拟节点
+    int m_shards;
+};
+
+#endif
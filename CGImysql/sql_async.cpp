@@ -0,0 +1,572 @@
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
+#include "sql_async.h"
+#include "../log/log.h"
+
+using namespace std;
+
+sql_async::sql_async() : m_enabled(false), m_close_log(0), m_port(0), m_epollfd(-1), m_eventfd(-1),
+                         m_live(0), m_pending(0), m_max_pending(10000), m_stop(false)
+{
+}
+
+sql_async *sql_async::GetInstance()
+{
+    static sql_async async;
+    return &async;
+}
+
+int sql_async::inflight()
+{
+    m_lock.lock();
+    int n = m_pending;
+    m_lock.unlock();
+    return n;
+}
+
+bool sql_async::insert_user(const char *name, const char *passwd, callback cb, void *arg)
+{
+    if (strlen(name) >= MAX_FIELD_LEN || strlen(passwd) >= MAX_FIELD_LEN)
+        return false;
+    op *o = new op;
+    memset(o, 0, sizeof(op));
+    o->type = OP_INSERT;
+    strcpy(o->name, name);
+    strcpy(o->passwd, passwd);
+    o->cb = cb;
+    o->arg = arg;
+    if (!submit(o))
+    {
+        delete o;
+        return false;
+    }
+    return true;
+}
+
+bool sql_async::query_passwd(const char *name, callback cb, void *arg)
+{
+    if (strlen(name) >= MAX_FIELD_LEN)
+        return false;
+    op *o = new op;
+    memset(o, 0, sizeof(op));
+    o->type = OP_QUERY;
+    strcpy(o->name, name);
+    o->cb = cb;
+    o->arg = arg;
+    if (!submit(o))
+    {
+        delete o;
+        return false;
+    }
+    return true;
+}
+
+bool sql_async::submit(op *o)
+{
+    if (!m_enabled)
+        return false;
+    m_lock.lock();
+    if (m_stop || m_live == 0 || m_pending >= m_max_pending)
+    {
+        m_lock.unlock();
+        return false;
+    }
+    m_queue.push_back(o);
+    ++m_pending;
+    m_lock.unlock();
+
+    uint64_t one = 1;
+    ssize_t ret = write(m_eventfd, &one, sizeof(one));          //唤醒事件循环
+    (void)ret;
+    return true;
+}
+
+#ifdef MYSQL_WAIT_READ
+
+static const char *SQL_INSERT_USER = "INSERT INTO user(username, passwd) VALUES(?, ?)";
+static const char *SQL_QUERY_PASSWD = "SELECT passwd FROM user WHERE username = ?";
+
+static long long now_ms()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+void *sql_async::worker(void *arg)
+{
+    sql_async *async = (sql_async *)arg;
+    async->run();
+    return async;
+}
+
+void *sql_async::reconnect_worker(void *arg)
+{
+    sql_async *async = (sql_async *)arg;
+    async->reconnect();
+    return async;
+}
+
+bool sql_async::open_conn(conn *c)
+{
+    c->mysql = NULL;
+    c->insert = NULL;
+    c->select = NULL;
+    c->fd = -1;
+    c->registered = false;
+    c->deadline_ms = 0;
+    c->cur = NULL;
+
+    //建立连接和预编译走阻塞接口，之后的语句执行全部走非阻塞接口
+    MYSQL *mysql = mysql_init(NULL);
+    if (!mysql)
+        return false;
+    mysql_options(mysql, MYSQL_OPT_NONBLOCK, 0);
+    if (!mysql_real_connect(mysql, m_url.c_str(), m_user.c_str(), m_passwd.c_str(), m_dbname.c_str(), m_port, NULL, 0))
+    {
+        LOG_ERROR("async MySQL connect error:%s", mysql_error(mysql));
+        mysql_close(mysql);
+        return false;
+    }
+    c->mysql = mysql;
+    c->insert = mysql_stmt_init(mysql);
+    c->select = mysql_stmt_init(mysql);
+    if (!c->insert || !c->select ||
+        mysql_stmt_prepare(c->insert, SQL_INSERT_USER, strlen(SQL_INSERT_USER)) ||
+        mysql_stmt_prepare(c->select, SQL_QUERY_PASSWD, strlen(SQL_QUERY_PASSWD)))
+    {
+        LOG_ERROR("async MySQL prepare error:%s", mysql_error(mysql));
+        close_conn(c);
+        return false;
+    }
+    c->fd = mysql_get_socket(mysql);
+    return true;
+}
+
+void sql_async::close_conn(conn *c)
+{
+    if (c->insert)
+        mysql_stmt_close(c->insert);
+    if (c->select)
+        mysql_stmt_close(c->select);
+    if (c->mysql)
+        mysql_close(c->mysql);
+    c->insert = NULL;
+    c->select = NULL;
+    c->mysql = NULL;
+    c->fd = -1;
+}
+
+bool sql_async::init(string url, string User, string PassWord, string DBName, int Port, int conn_num, int close_log)
+{
+    m_close_log = close_log;
+    m_url = url;
+    m_user = User;
+    m_passwd = PassWord;
+    m_dbname = DBName;
+    m_port = Port;
+    m_epollfd = epoll_create(5);
+    m_eventfd = eventfd(0, EFD_NONBLOCK);
+    if (m_epollfd < 0 || m_eventfd < 0)
+        return false;
+
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;                  //NULL代表eventfd
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_eventfd, &event);
+
+    for (int i = 0; i < conn_num; ++i)
+    {
+        conn *c = new conn;
+        if (!open_conn(c))
+        {
+            delete c;
+            continue;
+        }
+        m_conns.push_back(c);
+        m_idle.push_back(c);
+    }
+    if (m_conns.empty())
+        return false;
+    m_live = m_conns.size();
+
+    m_enabled = true;
+    if (pthread_create(&m_thread, NULL, worker, this) != 0)
+    {
+        m_enabled = false;
+        return false;
+    }
+    if (pthread_create(&m_reconnect_thread, NULL, reconnect_worker, this) != 0)
+    {
+        m_lock.lock();
+        m_stop = true;
+        m_lock.unlock();
+        uint64_t one = 1;
+        ssize_t ret = write(m_eventfd, &one, sizeof(one));
+        (void)ret;
+        pthread_join(m_thread, NULL);
+        m_enabled = false;
+        return false;
+    }
+    LOG_INFO("async MySQL enabled with %d connections", (int)m_conns.size());
+    return true;
+}
+
+sql_async::~sql_async()
+{
+    if (m_enabled)
+    {
+        m_lock.lock();
+        m_stop = true;
+        m_reconnect_cond.signal();
+        m_lock.unlock();
+        uint64_t one = 1;
+        ssize_t ret = write(m_eventfd, &one, sizeof(one));
+        (void)ret;
+        pthread_join(m_thread, NULL);
+        pthread_join(m_reconnect_thread, NULL);
+    }
+    for (size_t i = 0; i < m_conns.size(); ++i)
+    {
+        close_conn(m_conns[i]);
+        delete m_conns[i]->cur;
+        delete m_conns[i];
+    }
+    for (list<op *>::iterator it = m_queue.begin(); it != m_queue.end(); ++it)
+        delete *it;
+    if (m_epollfd >= 0)
+        close(m_epollfd);
+    if (m_eventfd >= 0)
+        close(m_eventfd);
+}
+
+void sql_async::run()
+{
+    epoll_event events[64];
+    while (true)
+    {
+        //把排队的操作分配给空闲连接
+        m_lock.lock();
+        if (m_stop)
+        {
+            m_lock.unlock();
+            break;
+        }
+        vector<conn *> ready;
+        while (!m_queue.empty() && !m_idle.empty())
+        {
+            conn *c = m_idle.front();
+            m_idle.pop_front();
+            c->cur = m_queue.front();
+            m_queue.pop_front();
+            ready.push_back(c);
+        }
+        m_lock.unlock();
+        for (size_t i = 0; i < ready.size(); ++i)
+            start(ready[i], ready[i]->cur);
+
+        //超时时间取所有在途操作中最早的截止时刻
+        long long now = now_ms();
+        int timeout = -1;
+        for (size_t i = 0; i < m_conns.size(); ++i)
+        {
+            conn *c = m_conns[i];
+            if (c->cur && c->deadline_ms > 0)
+            {
+                long long left = c->deadline_ms - now;
+                if (left < 0)
+                    left = 0;
+                if (timeout < 0 || left < timeout)
+                    timeout = (int)left;
+            }
+        }
+
+        int number = epoll_wait(m_epollfd, events, 64, timeout);
+        if (number < 0 && errno != EINTR)
+        {
+            LOG_ERROR("%s", "async MySQL epoll failure");
+            break;
+        }
+        for (int i = 0; i < number; ++i)
+        {
+            conn *c = (conn *)events[i].data.ptr;
+            if (!c)
+            {
+                uint64_t cnt;
+                ssize_t ret = read(m_eventfd, &cnt, sizeof(cnt));
+                (void)ret;
+                continue;
+            }
+            if (!c->cur)
+                continue;
+            int status = 0;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                status |= MYSQL_WAIT_READ;
+            if (events[i].events & EPOLLOUT)
+                status |= MYSQL_WAIT_WRITE;
+            step(c, status);
+        }
+
+        now = now_ms();
+        for (size_t i = 0; i < m_conns.size(); ++i)
+        {
+            conn *c = m_conns[i];
+            if (c->cur && c->deadline_ms > 0 && c->deadline_ms <= now)
+                step(c, MYSQL_WAIT_TIMEOUT);
+        }
+    }
+}
+
+void sql_async::start(conn *c, op *o)
+{
+    memset(o->param, 0, sizeof(o->param));
+    memset(o->result, 0, sizeof(o->result));
+    o->name_len = strlen(o->name);
+    o->param[0].buffer_type = MYSQL_TYPE_STRING;
+    o->param[0].buffer = o->name;
+    o->param[0].buffer_length = o->name_len;
+    o->param[0].length = &o->name_len;
+
+    MYSQL_STMT *stmt = NULL;
+    if (o->type == OP_INSERT)
+    {
+        stmt = c->insert;
+        o->passwd_len = strlen(o->passwd);
+        o->param[1].buffer_type = MYSQL_TYPE_STRING;
+        o->param[1].buffer = o->passwd;
+        o->param[1].buffer_length = o->passwd_len;
+        o->param[1].length = &o->passwd_len;
+    }
+    else
+    {
+        stmt = c->select;
+        o->passwd_len = 0;
+        o->result[0].buffer_type = MYSQL_TYPE_STRING;
+        o->result[0].buffer = o->passwd;
+        o->result[0].buffer_length = MAX_FIELD_LEN;
+        o->result[0].length = &o->passwd_len;
+    }
+    if (mysql_stmt_bind_param(stmt, o->param))
+    {
+        finish(c, sql_stmt::SQL_ERROR);
+        return;
+    }
+
+    int err = 0;
+    o->stage = STAGE_EXECUTE;
+    int status = mysql_stmt_execute_start(&err, stmt);
+    advance(c, status, err);
+}
+
+void sql_async::step(conn *c, int ready)
+{
+    op *o = c->cur;
+    MYSQL_STMT *stmt = (o->type == OP_INSERT) ? c->insert : c->select;
+    int err = 0;
+    int status = 0;
+    if (o->stage == STAGE_EXECUTE)
+        status = mysql_stmt_execute_cont(&err, stmt, ready);
+    else
+        status = mysql_stmt_store_result_cont(&err, stmt, ready);
+    advance(c, status, err);
+}
+
+void sql_async::advance(conn *c, int status, int err)
+{
+    //仍需等待网络
+    if (status)
+    {
+        wait_for(c, status);
+        return;
+    }
+
+    op *o = c->cur;
+    MYSQL_STMT *stmt = (o->type == OP_INSERT) ? c->insert : c->select;
+    if (err)
+    {
+        unsigned int no = mysql_stmt_errno(stmt);
+        if (no == ER_DUP_ENTRY)
+        {
+            finish(c, sql_stmt::SQL_DUP);
+            return;
+        }
+        LOG_ERROR("async MySQL error:%s", mysql_stmt_error(stmt));
+        if (no == CR_SERVER_GONE_ERROR || no == CR_SERVER_LOST)
+        {
+            fail_conn(c);
+            return;
+        }
+        finish(c, sql_stmt::SQL_ERROR);
+        return;
+    }
+
+    if (o->stage == STAGE_EXECUTE)
+    {
+        if (o->type == OP_INSERT)
+        {
+            finish(c, sql_stmt::SQL_OK);
+            return;
+        }
+        //查询需要继续取回结果集
+        o->stage = STAGE_STORE;
+        if (mysql_stmt_bind_result(stmt, o->result))
+        {
+            finish(c, sql_stmt::SQL_ERROR);
+            return;
+        }
+        err = 0;
+        status = mysql_stmt_store_result_start(&err, stmt);
+        advance(c, status, err);
+        return;
+    }
+
+    //结果集已缓存在客户端，fetch不会再访问网络
+    sql_stmt::RESULT result = sql_stmt::SQL_NOT_FOUND;
+    int fetched = mysql_stmt_fetch(stmt);
+    if (fetched == 0 && o->passwd_len < MAX_FIELD_LEN)
+    {
+        o->passwd[o->passwd_len] = '\0';
+        result = sql_stmt::SQL_OK;
+    }
+    else if (fetched != MYSQL_NO_DATA)
+        result = sql_stmt::SQL_ERROR;
+    mysql_stmt_free_result(stmt);
+    finish(c, result);
+}
+
+void sql_async::wait_for(conn *c, int status)
+{
+    epoll_event event;
+    event.events = 0;
+    event.data.ptr = c;
+    if (status & MYSQL_WAIT_READ)
+        event.events |= EPOLLIN;
+    if (status & MYSQL_WAIT_WRITE)
+        event.events |= EPOLLOUT;
+    if (status & MYSQL_WAIT_EXCEPT)
+        event.events |= EPOLLPRI;
+    epoll_ctl(m_epollfd, c->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, c->fd, &event);
+    c->registered = true;
+
+    if (status & MYSQL_WAIT_TIMEOUT)
+        c->deadline_ms = now_ms() + (long long)mysql_get_timeout_value(c->mysql) * 1000;
+    else
+        c->deadline_ms = 0;
+}
+
+void sql_async::finish(conn *c, sql_stmt::RESULT result)
+{
+    op *o = c->cur;
+    c->cur = NULL;
+    c->deadline_ms = 0;
+    if (c->registered)
+    {
+        //空闲时不关心任何事件
+        epoll_event event;
+        event.events = 0;
+        event.data.ptr = c;
+        epoll_ctl(m_epollfd, EPOLL_CTL_MOD, c->fd, &event);
+    }
+    m_lock.lock();
+    --m_pending;
+    m_idle.push_back(c);
+    m_lock.unlock();
+
+    o->cb(o->arg, result, result == sql_stmt::SQL_OK ? o->passwd : NULL);
+    delete o;
+}
+
+void sql_async::fail_conn(conn *c)
+{
+    op *o = c->cur;
+    c->cur = NULL;
+    c->deadline_ms = 0;
+    if (c->registered)
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, c->fd, 0);
+    c->registered = false;
+
+    //最后一条连接也断开时，排队的操作不会再被执行，全部以错误结束
+    list<op *> orphans;
+    m_lock.lock();
+    --m_pending;
+    int live = --m_live;
+    if (live == 0)
+    {
+        orphans.swap(m_queue);
+        m_pending -= orphans.size();
+    }
+    m_broken.push_back(c);
+    m_reconnect_cond.signal();
+    m_lock.unlock();
+    LOG_ERROR("async MySQL connection lost, %d left", live);
+
+    o->cb(o->arg, sql_stmt::SQL_ERROR, NULL);
+    delete o;
+    for (list<op *>::iterator it = orphans.begin(); it != orphans.end(); ++it)
+    {
+        (*it)->cb((*it)->arg, sql_stmt::SQL_ERROR, NULL);
+        delete *it;
+    }
+}
+
+void sql_async::reconnect()
+{
+    mysql_thread_init();
+    m_lock.lock();
+    while (!m_stop)
+    {
+        if (m_broken.empty())
+        {
+            m_reconnect_cond.wait(m_lock.get());
+            continue;
+        }
+        conn *c = m_broken.front();
+        m_broken.pop_front();
+        m_lock.unlock();
+
+        //连接不在事件循环中，可以在本线程上阻塞重建
+        close_conn(c);
+        bool ok = open_conn(c);
+
+        m_lock.lock();
+        if (ok)
+        {
+            m_idle.push_back(c);
+            int live = ++m_live;
+            LOG_INFO("async MySQL reconnected, %d live", live);
+            uint64_t one = 1;
+            ssize_t ret = write(m_eventfd, &one, sizeof(one));      //唤醒事件循环分配排队的操作
+            (void)ret;
+            continue;
+        }
+        m_broken.push_back(c);
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += RECONNECT_SEC;
+        if (!m_stop)
+            m_reconnect_cond.timewait(m_lock.get(), t);
+    }
+    m_lock.unlock();
+    mysql_thread_end();
+}
+
+#else
+
+//客户端库没有非阻塞接口，enabled恒为false，其余成员不会被调用
+bool sql_async::init(string, string, string, string, int, int, int close_log)
+{
+    m_close_log = close_log;
+    LOG_WARN("%s", "async MySQL requires MariaDB Connector/C, fall back to blocking executor");
+    return false;
+}
+
+sql_async::~sql_async()
+{
+}
+
+#endif
@@ -0,0 +1,137 @@
+/*************************************************************
+*基于MariaDB Connector/C非阻塞接口(mysql_*_start/_cont)的异步数据库层
+*一个事件循环线程持有若干条非阻塞连接，把连接的socket注册到自己的epoll中
+*语句执行到需要等待网络时立即返回，socket就绪后继续，完成后在该线程上回调请求方
+*这样少量线程即可同时保持大量在途的数据库操作，而不是每个操作阻塞一个工作线程
+*连接断开时当前操作以错误结束，由后台线程重连，没有可用连接时拒绝提交并让排队的操作以错误结束，调用方退回阻塞方式
+*客户端库不提供非阻塞接口（如Oracle的libmysqlclient）时enabled恒为false，调用方退回阻塞方式
+**************************************************************/
+
+#ifndef _SQL_ASYNC_
+#define _SQL_ASYNC_
+
+#include <list>
+#include <vector>
+#include <string>
+#include <pthread.h>
+#include <mysql/mysql.h>
+#include "../lock/locker.h"
+#include "sql_stmt.h"
+
+using namespace std;
+
+class sql_async
+{
+public:
+    //操作完成的回调，在异步数据库线程上执行；passwd仅对查询有效
+    typedef void (*callback)(void *arg, sql_stmt::RESULT result, const char *passwd);
+
+    static sql_async *GetInstance();
+
+    //建立conn_num条非阻塞连接并启动事件循环线程，客户端库不支持时返回false
+    bool init(string url, string User, string PassWord, string DBName, int Port, int conn_num, int close_log);
+#ifdef MYSQL_WAIT_READ
+    bool enabled() const { return m_enabled; }
+#else
+    bool enabled() const { return false; }
+#endif
+
+    //提交注册/查询操作，队列满、未启用或没有可用连接时返回false
+    bool insert_user(const char *name, const char *passwd, callback cb, void *arg);
+    bool query_passwd(const char *name, callback cb, void *arg);
+
+    //在途与排队的操作数
+    int inflight();
+
+private:
+    sql_async();
+    ~sql_async();
+
+    enum OP_TYPE
+    {
+        OP_INSERT = 0,
+        OP_QUERY
+    };
+
+    //操作的执行阶段
+    enum OP_STAGE
+    {
+        STAGE_EXECUTE = 0,  //mysql_stmt_execute
+        STAGE_STORE         //mysql_stmt_store_result（仅查询）
+    };
+
+    static const int MAX_FIELD_LEN = 256;
+    static const int RECONNECT_SEC = 2;     //重连失败后的重试间隔
+
+    struct op
+    {
+        OP_TYPE type;
+        OP_STAGE stage;
+        char name[MAX_FIELD_LEN];
+        char passwd[MAX_FIELD_LEN];
+        unsigned long name_len;
+        unsigned long passwd_len;   //注册时为参数长度，查询时为结果长度
+        MYSQL_BIND param[2];
+        MYSQL_BIND result[1];
+        callback cb;
+        void *arg;
+    };
+
+    //一条非阻塞连接及其上正在执行的操作
+    struct conn
+    {
+        MYSQL *mysql;
+        MYSQL_STMT *insert;
+        MYSQL_STMT *select;
+        int fd;                 //连接的socket
+        bool registered;        //socket是否已加入epoll
+        long long deadline_ms;  //客户端库要求的超时时刻，0表示无
+        op *cur;                //正在执行的操作
+    };
+
+    bool submit(op *o);
+    //建立连接并预编译语句，失败时c中不留下任何资源
+    bool open_conn(conn *c);
+    void close_conn(conn *c);
+    static void *worker(void *arg);
+    void run();
+    //重连线程：依次重建断开的连接，成功后放回空闲列表
+    static void *reconnect_worker(void *arg);
+    void reconnect();
+    //开始执行队首操作
+    void start(conn *c, op *o);
+    //socket就绪或超时，调用_cont继续执行
+    void step(conn *c, int ready);
+    //根据_start/_cont返回的等待状态和错误推进操作
+    void advance(conn *c, int status, int err);
+    //等待socket可读/可写
+    void wait_for(conn *c, int status);
+    void finish(conn *c, sql_stmt::RESULT result);
+    //连接已断开：当前操作以错误结束，连接交给重连线程
+    void fail_conn(conn *c);
+
+private:
+    bool m_enabled;
+    int m_close_log;
+    string m_url;
+    string m_user;
+    string m_passwd;
+    string m_dbname;
+    int m_port;
+    int m_epollfd;
+    int m_eventfd;              //提交操作时唤醒事件循环
+    pthread_t m_thread;
+    pthread_t m_reconnect_thread;
+    vector<conn *> m_conns;
+    list<conn *> m_idle;        //空闲连接
+    list<conn *> m_broken;      //等待重连的连接
+    list<op *> m_queue;         //待执行的操作
+    locker m_lock;              //保护m_queue、m_idle、m_broken、m_live与m_pending
+    cond m_reconnect_cond;      //有连接断开或正在关闭时唤醒重连线程
+    int m_live;                 //可用（空闲或执行中）的连接数
+    int m_pending;              //已提交未完成的操作数
+    int m_max_pending;          //准入上限
+    bool m_stop;
+};
+
+#endif
@@ -0,0 +1,157 @@
+//异步数据库层的集成测试，需要本地MariaDB和user表(username唯一)
+//连接参数取自环境变量MYSQL_HOST、MYSQL_PORT、MYSQL_USER、MYSQL_PASSWD、MYSQL_DB，默认与main.cpp一致
+//断线测试会KILL该库上本测试用户的其他连接，不要对线上库运行
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "sql_async.h"
+#include "../test/check.h"
+
+using namespace std;
+
+struct waiter
+{
+    sem done;
+    sql_stmt::RESULT result;
+    string passwd;
+};
+
+static void on_done(void *arg, sql_stmt::RESULT result, const char *passwd)
+{
+    waiter *w = (waiter *)arg;
+    w->result = result;
+    w->passwd = passwd ? passwd : "";
+    w->done.post();
+}
+
+static const char *env(const char *name, const char *def)
+{
+    const char *v = getenv(name);
+    return v && *v ? v : def;
+}
+
+//提交后必须在超时内回调，返回false表示提交被拒绝
+static bool wait_insert(sql_async *async, const char *name, const char *passwd, waiter &w)
+{
+    if (!async->insert_user(name, passwd, on_done, &w))
+        return false;
+    CHECK(w.done.timewait(10000));
+    return true;
+}
+
+static bool wait_query(sql_async *async, const char *name, waiter &w)
+{
+    if (!async->query_passwd(name, on_done, &w))
+        return false;
+    CHECK(w.done.timewait(10000));
+    return true;
+}
+
+//杀掉本测试用户的其他连接，即异步层的全部连接
+static int kill_async_conns(MYSQL *admin)
+{
+    if (mysql_query(admin, "SELECT ID FROM information_schema.PROCESSLIST WHERE ID <> CONNECTION_ID() "
+                           "AND USER = SUBSTRING_INDEX(USER(), '@', 1)"))
+        return 0;
+    MYSQL_RES *res = mysql_store_result(admin);
+    vector<string> ids;
+    while (MYSQL_ROW row = mysql_fetch_row(res))
+        ids.push_back(row[0]);
+    mysql_free_result(res);
+    for (size_t i = 0; i < ids.size(); ++i)
+        mysql_query(admin, ("KILL CONNECTION " + ids[i]).c_str());
+    return ids.size();
+}
+
+int main()
+{
+    const char *host = env("MYSQL_HOST", "localhost");
+    int port = atoi(env("MYSQL_PORT", "3306"));
+    const char *user = env("MYSQL_USER", "root");
+    const char *passwd = env("MYSQL_PASSWD", "root");
+    const char *db = env("MYSQL_DB", "qgydb");
+
+    sql_async *async = sql_async::GetInstance();
+    if (!async->init(host, user, passwd, db, port, 2, 1))
+    {
+        printf("sql_async_test: skipped, no MariaDB with non-blocking API at %s:%d\n", host, port);
+        return 0;
+    }
+    MYSQL *admin = mysql_init(NULL);
+    if (!mysql_real_connect(admin, host, user, passwd, db, port, NULL, 0))
+    {
+        printf("sql_async_test: admin connect failed: %s\n", mysql_error(admin));
+        return 1;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "async_test_%d", (int)getpid());
+    string cleanup = string("DELETE FROM user WHERE username LIKE '") + name + "%'";
+    mysql_query(admin, cleanup.c_str());
+
+    //注册、重复注册、查询、查询不存在的用户
+    {
+        waiter w;
+        CHECK(wait_insert(async, name, "pw1", w));
+        CHECK(w.result == sql_stmt::SQL_OK);
+    }
+    {
+        waiter w;
+        CHECK(wait_insert(async, name, "pw2", w));
+        CHECK(w.result == sql_stmt::SQL_DUP);
+    }
+    {
+        waiter w;
+        CHECK(wait_query(async, name, w));
+        CHECK(w.result == sql_stmt::SQL_OK);
+        CHECK(w.passwd == "pw1");
+    }
+    {
+        waiter w;
+        string missing = string(name) + "_missing";
+        CHECK(wait_query(async, missing.c_str(), w));
+        CHECK(w.result == sql_stmt::SQL_NOT_FOUND);
+    }
+
+    //全部连接被杀：每个提交要么被拒绝，要么在超时内以结果或错误回调，之后重连恢复
+    CHECK(kill_async_conns(admin) >= 2);
+    bool recovered = false;
+    for (int i = 0; i < 100 && !recovered; ++i)
+    {
+        waiter w;
+        if (wait_query(async, name, w) && w.result == sql_stmt::SQL_OK)
+            recovered = true;
+        else
+            usleep(200 * 1000);
+    }
+    CHECK(recovered);
+
+    //断线后排队的操作不会悬挂
+    CHECK(kill_async_conns(admin) >= 2);
+    vector<waiter *> waiters;
+    int accepted = 0;
+    for (int i = 0; i < 50; ++i)
+    {
+        waiter *w = new waiter;
+        if (async->query_passwd(name, on_done, w))
+        {
+            ++accepted;
+            waiters.push_back(w);
+        }
+        else
+            delete w;
+    }
+    for (size_t i = 0; i < waiters.size(); ++i)
+    {
+        CHECK(waiters[i]->done.timewait(10000));
+        delete waiters[i];
+    }
+    printf("sql_async_test: %d of 50 queries accepted after kill\n", accepted);
+
+    mysql_query(admin, cleanup.c_str());
+    mysql_close(admin);
+    return check_report("sql_async_test");
+}
@@ -0,0 +1,224 @@
+#include <set>
+#include <vector>
+#include <time.h>
+#include <sys/time.h>
+#include "sql_batch.h"
+#include "../log/log.h"
+
+using namespace std;
+
+register_batcher::register_batcher() : m_enabled(false), m_stop(false), m_max_batch(1), m_window_ms(0),
+                                       m_max_queue(10000), m_close_log(0), m_connPool(NULL), m_batches(0), m_rows(0)
+{
+}
+
+register_batcher *register_batcher::GetInstance()
+{
+    static register_batcher batcher;
+    return &batcher;
+}
+
+bool register_batcher::init(connection_pool *connPool, int max_batch, int window_ms, int close_log)
+{
+    m_connPool = connPool;
+    m_max_batch = max_batch;
+    m_window_ms = window_ms > 0 ? window_ms : 0;
+    m_close_log = close_log;
+    if (m_max_batch <= 1)
+        return false;
+    if (pthread_create(&m_thread, NULL, worker, this) != 0)
+        return false;
+    m_enabled = true;
+    return true;
+}
+
+register_batcher::~register_batcher()
+{
+    if (!m_enabled)
+        return;
+    m_lock.lock();
+    m_stop = true;
+    m_cond.broadcast();
+    m_lock.unlock();
+    pthread_join(m_thread, NULL);
+}
+
+bool register_batcher::submit(const char *name, const char *passwd, callback cb, void *arg)
+{
+    if (!m_enabled)
+        return false;
+    item it;
+    it.name = name;
+    it.passwd = passwd;
+    it.cb = cb;
+    it.arg = arg;
+    it.result = sql_stmt::SQL_ERROR;
+
+    m_lock.lock();
+    if (m_stop || (int)m_queue.size() >= m_max_queue)
+    {
+        m_lock.unlock();
+        return false;
+    }
+    m_queue.push_back(it);
+    //收满一批立即唤醒，否则由批处理线程按窗口超时
+    if (m_queue.size() == 1 || (int)m_queue.size() >= m_max_batch)
+        m_cond.signal();
+    m_lock.unlock();
+    return true;
+}
+
+void *register_batcher::worker(void *arg)
+{
+    register_batcher *batcher = (register_batcher *)arg;
+    batcher->run();
+    return batcher;
+}
+
+void register_batcher::run()
+{
+    while (true)
+    {
+        list<item> batch;
+        m_lock.lock();
+        while (!m_stop && m_queue.empty())
+            m_cond.wait(m_lock.get());
+        if (m_stop && m_queue.empty())
+        {
+            m_lock.unlock();
+            return;
+        }
+
+        //第一条到达后最多再等一个窗口，期间收满一批则提前执行
+        struct timeval now = {0, 0};
+        gettimeofday(&now, NULL);
+        struct timespec deadline;
+        long long usec = (long long)now.tv_usec + (long long)m_window_ms * 1000;
+        deadline.tv_sec = now.tv_sec + usec / 1000000;
+        deadline.tv_nsec = (usec % 1000000) * 1000;
+        while (!m_stop && (int)m_queue.size() < m_max_batch)
+        {
+            if (!m_cond.timewait(m_lock.get(), deadline))
+                break;
+        }
+
+        for (int i = 0; i < m_max_batch && !m_queue.empty(); ++i)
+        {
+            batch.push_back(m_queue.front());
+            m_queue.pop_front();
+        }
+        m_lock.unlock();
+
+        flush(batch);
+    }
+}
+
+//把字符串转义后加引号追加到sql
+static void append_quoted(MYSQL *mysql, string &sql, const string &s)
+{
+    vector<char> buf(s.size() * 2 + 1);
+    mysql_real_escape_string(mysql, &buf[0], s.c_str(), s.size());
+    sql += '\'';
+    sql += &buf[0];
+    sql += '\'';
+}
+
+//一批只执行两条语句：
+//SELECT ... FOR UPDATE锁住这批用户名（不存在的用户名加间隙锁），查出已存在的即为重名
+//再用一条多行INSERT IGNORE插入其余的，锁保证它们在提交前不会被其他连接插入，影响行数应与条数一致
+bool register_batcher::insert_batch(MYSQL *mysql, list<item> &batch)
+{
+    string select = "SELECT username FROM user WHERE username IN (";
+    int pending = 0;
+    for (list<item>::iterator it = batch.begin(); it != batch.end(); ++it)
+    {
+        if (it->result == sql_stmt::SQL_DUP)
+            continue;
+        if (pending++)
+            select += ',';
+        append_quoted(mysql, select, it->name);
+    }
+    if (pending == 0)
+        return true;
+    select += ") FOR UPDATE";
+    if (mysql_query(mysql, select.c_str()))
+        return false;
+    MYSQL_RES *result = mysql_store_result(mysql);
+    if (!result)
+        return false;
+    set<string> existing;
+    while (MYSQL_ROW row = mysql_fetch_row(result))
+        existing.insert(row[0]);
+    mysql_free_result(result);
+
+    string insert = "INSERT IGNORE INTO user(username, passwd) VALUES";
+    int rows = 0;
+    for (list<item>::iterator it = batch.begin(); it != batch.end(); ++it)
+    {
+        if (it->result == sql_stmt::SQL_DUP)
+            continue;
+        if (existing.count(it->name))
+        {
+            it->result = sql_stmt::SQL_DUP;
+            continue;
+        }
+        insert += rows++ ? ",(" : "(";
+        append_quoted(mysql, insert, it->name);
+        insert += ',';
+        append_quoted(mysql, insert, it->passwd);
+        insert += ')';
+        it->result = sql_stmt::SQL_OK;
+    }
+    if (rows == 0)
+        return true;
+    if (mysql_query(mysql, insert.c_str()))
+        return false;
+    //不支持行锁的存储引擎上可能被并发插入，无法区分哪条被忽略，整批按失败处理
+    if ((long long)mysql_affected_rows(mysql) != rows)
+    {
+        LOG_ERROR("register batch: %d rows sent, %lld inserted", rows, (long long)mysql_affected_rows(mysql));
+        return false;
+    }
+    return true;
+}
+
+void register_batcher::flush(list<item> &batch)
+{
+    //同一批中重复的用户名只有第一条有效
+    set<string> names;
+    for (list<item>::iterator it = batch.begin(); it != batch.end(); ++it)
+    {
+        if (!names.insert(it->name).second)
+            it->result = sql_stmt::SQL_DUP;
+    }
+
+    {
+        MYSQL *mysql = NULL;
+        connectionRAII mysqlcon(&mysql, m_connPool);
+        if (!mysql)
+        {
+            LOG_ERROR("%s", "get mysql connection failed");
+        }
+        else if (mysql_query(mysql, "START TRANSACTION"))
+        {
+            LOG_ERROR("START TRANSACTION error:%s", mysql_error(mysql));
+        }
+        else if (!insert_batch(mysql, batch) || mysql_query(mysql, "COMMIT"))
+        {
+            //事务中途断线重连会丢失前面的语句，不能自动重试，整批回滚
+            LOG_ERROR("register batch error:%s", mysql_error(mysql));
+            mysql_query(mysql, "ROLLBACK");
+            for (list<item>::iterator it = batch.begin(); it != batch.end(); ++it)
+            {
+                if (it->result == sql_stmt::SQL_OK)
+                    it->result = sql_stmt::SQL_ERROR;
+            }
+        }
+        //连接在回调之前归还，回调中可能还会访问数据库
+    }
+
+    ++m_batches;
+    m_rows += batch.size();
+    for (list<item>::iterator it = batch.begin(); it != batch.end(); ++it)
+        it->cb(it->arg, it->result, NULL);
+}
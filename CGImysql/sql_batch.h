@@ -0,0 +1,73 @@
+/*************************************************************
+*注册请求的组提交：在一个很短的时间窗口内收集并发的注册，或收满N条后
+*在一个事务中用一条多行INSERT插入并只提交一次，每条注册各自得到成功/重名/失败的结果
+*单独的批处理线程执行，调用方通过回调得到结果，不再用全局锁串行化每一次INSERT
+**************************************************************/
+
+#ifndef _SQL_BATCH_
+#define _SQL_BATCH_
+
+#include <list>
+#include <string>
+#include <pthread.h>
+#include "../lock/locker.h"
+#include "sql_stmt.h"
+#include "sql_connection_pool.h"
+
+using namespace std;
+
+class register_batcher
+{
+public:
+    //与异步数据库层相同的回调形式，在批处理线程上执行
+    typedef void (*callback)(void *arg, sql_stmt::RESULT result, const char *passwd);
+
+    static register_batcher *GetInstance();
+
+    //max_batch不大于1时不启用
+    bool init(connection_pool *connPool, int max_batch, int window_ms, int close_log);
+    bool enabled() const { return m_enabled; }
+
+    //提交一条注册，未启用或队列满时返回false
+    bool submit(const char *name, const char *passwd, callback cb, void *arg);
+
+    long long batches() const { return m_batches; }     //已执行的批次数
+    long long rows() const { return m_rows; }           //已执行的注册数
+
+private:
+    register_batcher();
+    ~register_batcher();
+
+    struct item
+    {
+        string name;
+        string passwd;
+        callback cb;
+        void *arg;
+        sql_stmt::RESULT result;
+    };
+
+    static void *worker(void *arg);
+    void run();
+    //在一个事务中执行一批注册
+    void flush(list<item> &batch);
+    //事务中的查重和插入，失败返回false，由调用方回滚
+    bool insert_batch(MYSQL *mysql, list<item> &batch);
+
+private:
+    bool m_enabled;
+    bool m_stop;
+    int m_max_batch;            //每批最多的注册数
+    int m_window_ms;            //收集窗口
+    int m_max_queue;            //排队上限
+    int m_close_log;
+    connection_pool *m_connPool;
+    pthread_t m_thread;
+    list<item> m_queue;
+    locker m_lock;              //保护m_queue和m_stop
+    cond m_cond;
+    long long m_batches;
+    long long m_rows;
+};
+
+#endif
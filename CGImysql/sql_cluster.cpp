@@ -0,0 +1,282 @@
+#include <mysql/mysql.h>
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sql_cluster.h"
+#include "../log/log.h"
+
+static long long now_ms()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+sql_cluster::sql_cluster() : m_primary(NULL), m_next(0), m_primary_reads(0), m_max_lag_ms(1000), m_stop(true), m_close_log(0)
+{
+    m_recent = new std::atomic<long long>[RECENT_SIZE];
+    for (int i = 0; i < RECENT_SIZE; ++i)
+        m_recent[i].store(0, std::memory_order_relaxed);
+}
+
+sql_cluster::~sql_cluster()
+{
+    destroy();
+    delete[] m_recent;
+}
+
+sql_cluster *sql_cluster::GetInstance()
+{
+    static sql_cluster cluster;
+    return &cluster;
+}
+
+void sql_cluster::init(connection_pool *primary, const vector<connection_pool *> &replicas, int max_lag_ms, int close_log)
+{
+    m_primary = primary;
+    m_max_lag_ms = max_lag_ms;
+    m_close_log = close_log;
+    for (size_t i = 0; i < replicas.size(); ++i)
+    {
+        replica_state *r = new replica_state;
+        r->pool = replicas[i];
+        r->healthy.store(false);
+        r->lag_ms.store(0);
+        r->legacy_sql = false;
+        r->last_error = 0;
+        r->next_check_ms = 0;
+        r->retry_ms = CHECK_INTERVAL_MS;
+        m_replicas.push_back(r);
+    }
+    if (m_replicas.empty())
+        return;
+
+    check();                    //先检查一次，启动后的读请求立即可以使用副本
+    m_stop = false;
+    if (pthread_create(&m_checker, NULL, check_thread, this) != 0)
+        m_stop = true;
+}
+
+void sql_cluster::destroy()
+{
+    m_lock.lock();
+    bool running = !m_stop;
+    m_stop = true;
+    m_cond.broadcast();
+    m_lock.unlock();
+    if (running)
+        pthread_join(m_checker, NULL);
+
+    for (size_t i = 0; i < m_replicas.size(); ++i)
+    {
+        delete m_replicas[i]->pool;
+        delete m_replicas[i];
+    }
+    m_replicas.clear();
+}
+
+//FNV-1a
+uint64_t sql_cluster::hash(const char *s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (; *s; ++s)
+    {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+connection_pool *sql_cluster::reader(const char *name)
+{
+    if (m_replicas.empty())
+        return m_primary;
+    if (name && now_ms() < m_recent[hash(name) % RECENT_SIZE].load(std::memory_order_relaxed))
+    {
+        ++m_primary_reads;
+        return m_primary;
+    }
+
+    //从轮转位置开始找已借出连接最少的健康副本
+    int n = (int)m_replicas.size();
+    unsigned int start = m_next.fetch_add(1, std::memory_order_relaxed);
+    connection_pool *best = NULL;
+    int best_busy = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        replica_state *r = m_replicas[(start + i) % n];
+        if (!r->healthy.load(std::memory_order_relaxed))
+            continue;
+        int busy = r->pool->GetBusyConn();
+        if (!best || busy < best_busy)
+        {
+            best = r->pool;
+            best_busy = busy;
+        }
+    }
+    if (!best)                  //没有可用副本，故障转移到主库
+    {
+        ++m_primary_reads;
+        return m_primary;
+    }
+    return best;
+}
+
+void sql_cluster::note_write(const char *name)
+{
+    if (m_replicas.empty() || !name)
+        return;
+    //被摘除的副本恢复时延迟不超过上限，因此读主库的时长取延迟上限即可
+    m_recent[hash(name) % RECENT_SIZE].store(now_ms() + m_max_lag_ms, std::memory_order_relaxed);
+}
+
+void sql_cluster::report_failure(connection_pool *pool)
+{
+    for (size_t i = 0; i < m_replicas.size(); ++i)
+    {
+        if (m_replicas[i]->pool == pool && m_replicas[i]->healthy.exchange(false))
+            LOG_WARN("replica %s:%d marked down", pool->m_url.c_str(), pool->m_Port);
+    }
+}
+
+//MySQL 8.0.22起为SHOW REPLICA STATUS和Seconds_Behind_Source，MariaDB 10.5起支持前者但列名不变，
+//更早的版本只有SHOW SLAVE STATUS和Seconds_Behind_Master；先试新语法，不支持时记下并改用旧语法
+int sql_cluster::query_lag(replica_state *r, unsigned int &error)
+{
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, r->pool);
+    error = CR_UNKNOWN_ERROR;
+    if (!mysql)
+        return -1;
+    if (!r->legacy_sql && mysql_query(mysql, "SHOW REPLICA STATUS"))
+    {
+        if (mysql_errno(mysql) != ER_PARSE_ERROR)
+        {
+            error = mysql_errno(mysql);
+            return -1;
+        }
+        r->legacy_sql = true;
+    }
+    if (r->legacy_sql && mysql_query(mysql, "SHOW SLAVE STATUS"))
+    {
+        error = mysql_errno(mysql);
+        return -1;
+    }
+    MYSQL_RES *result = mysql_store_result(mysql);
+    if (!result)
+    {
+        error = mysql_errno(mysql);
+        return -1;
+    }
+
+    //结果为空说明该实例没有配置复制，读到的数据与主库无关，不能当作没有延迟
+    int lag = -1;
+    error = LAG_NOT_REPLICA;
+    MYSQL_ROW row = mysql_fetch_row(result);
+    if (row)
+    {
+        error = LAG_STOPPED;
+        int num_fields = mysql_num_fields(result);
+        MYSQL_FIELD *fields = mysql_fetch_fields(result);
+        for (int i = 0; i < num_fields; ++i)
+        {
+            if (strcmp(fields[i].name, "Seconds_Behind_Source") == 0 || strcmp(fields[i].name, "Seconds_Behind_Master") == 0)
+            {
+                //复制线程停止时为NULL
+                if (row[i])
+                {
+                    lag = atoi(row[i]) * 1000;
+                    error = 0;
+                }
+                break;
+            }
+        }
+    }
+    mysql_free_result(result);
+    return lag;
+}
+
+void sql_cluster::log_error(replica_state *r, unsigned int error)
+{
+    if (error == r->last_error)
+        return;
+    r->last_error = error;
+    connection_pool *pool = r->pool;
+    if (error == LAG_NOT_REPLICA)
+    {
+        LOG_ERROR("replica %s:%d is not replicating from a source, not used for reads", pool->m_url.c_str(), pool->m_Port);
+    }
+    else if (error == LAG_STOPPED)
+    {
+        LOG_WARN("replica %s:%d: replication is stopped", pool->m_url.c_str(), pool->m_Port);
+    }
+    else if (error == ER_SPECIFIC_ACCESS_DENIED_ERROR)
+    {
+        LOG_ERROR("replica %s:%d: cannot read replication status, grant REPLICATION CLIENT (SLAVE MONITOR on MariaDB) to %s",
+                  pool->m_url.c_str(), pool->m_Port, pool->m_User.c_str());
+    }
+    else if (error)
+    {
+        LOG_WARN("replica %s:%d: replication status check failed, error %u", pool->m_url.c_str(), pool->m_Port, error);
+    }
+}
+
+void sql_cluster::check()
+{
+    long long now = now_ms();
+    for (size_t i = 0; i < m_replicas.size(); ++i)
+    {
+        replica_state *r = m_replicas[i];
+        //摘除的副本按退避间隔重试，避免每秒都在连不上的实例上等待连接超时
+        if (!r->healthy.load(std::memory_order_relaxed) && now < r->next_check_ms)
+            continue;
+        unsigned int error = 0;
+        int lag = query_lag(r, error);
+        log_error(r, error);
+        bool healthy = lag >= 0 && lag <= m_max_lag_ms;
+        if (lag >= 0)
+            r->lag_ms.store(lag, std::memory_order_relaxed);
+        if (healthy)
+            r->retry_ms = CHECK_INTERVAL_MS;
+        else
+        {
+            r->next_check_ms = now_ms() + r->retry_ms;
+            r->retry_ms = r->retry_ms * 2 > MAX_RETRY_MS ? MAX_RETRY_MS : r->retry_ms * 2;
+        }
+        if (r->healthy.exchange(healthy) != healthy)
+        {
+            if (healthy)
+            {
+                LOG_INFO("replica %s:%d is up, lag %dms", r->pool->m_url.c_str(), r->pool->m_Port, lag);
+            }
+            else
+            {
+                LOG_WARN("replica %s:%d is down, lag %dms", r->pool->m_url.c_str(), r->pool->m_Port, lag);
+            }
+        }
+    }
+}
+
+void *sql_cluster::check_thread(void *arg)
+{
+    sql_cluster *cluster = (sql_cluster *)arg;
+    mysql_thread_init();
+    cluster->m_lock.lock();
+    while (!cluster->m_stop)
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += CHECK_INTERVAL_MS / 1000;
+        cluster->m_cond.timewait(cluster->m_lock.get(), t);
+        if (cluster->m_stop)
+            break;
+        cluster->m_lock.unlock();
+        cluster->check();
+        cluster->m_lock.lock();
+    }
+    cluster->m_lock.unlock();
+    mysql_thread_end();
+    return NULL;
+}
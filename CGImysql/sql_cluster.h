@@ -0,0 +1,96 @@
+/*************************************************************
+*读写分离：注册的INSERT走主库，登录回查和启动时加载用户表走只读副本
+*读请求选择已借出连接最少的健康副本；后台线程定期检查副本的复制延迟，
+*延迟超过上限、复制中断、连不上或不是副本的实例暂时摘除，按退避间隔重试，全部不可用时读主库
+*刚注册的用户在延迟上限内的读请求仍走主库，保证读到自己的写入
+**************************************************************/
+
+#ifndef _SQL_CLUSTER_
+#define _SQL_CLUSTER_
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include <pthread.h>
+#include "../lock/locker.h"
+#include "sql_connection_pool.h"
+
+using namespace std;
+
+class sql_cluster
+{
+public:
+    //单例模式，默认分片；分库时其他分片直接构造
+    static sql_cluster *GetInstance();
+
+    sql_cluster();
+    ~sql_cluster();
+
+    //primary为主库连接池，replicas为已初始化的副本连接池，max_lag_ms为可接受的复制延迟
+    void init(connection_pool *primary, const vector<connection_pool *> &replicas, int max_lag_ms, int close_log);
+    //停止检查线程，并销毁副本连接池
+    void destroy();
+
+    //写操作使用的连接池
+    connection_pool *writer() { return m_primary; }
+    //读操作使用的连接池；name不为NULL且该用户刚写入过时返回主库
+    connection_pool *reader(const char *name);
+    //写入成功后调用，之后一段时间内该用户的读请求走主库
+    void note_write(const char *name);
+    //从副本读取失败时调用，立即摘除该副本直到下一次检查通过
+    void report_failure(connection_pool *pool);
+
+    int replica_count() const { return (int)m_replicas.size(); }
+    connection_pool *replica(int i) { return m_replicas[i]->pool; }
+    bool replica_healthy(int i) const { return m_replicas[i]->healthy.load(std::memory_order_relaxed); }
+    int replica_lag_ms(int i) const { return m_replicas[i]->lag_ms.load(std::memory_order_relaxed); }
+    long long primary_reads() const { return m_primary_reads.load(std::memory_order_relaxed); }
+
+private:
+    sql_cluster(const sql_cluster &);
+    sql_cluster &operator=(const sql_cluster &);
+
+    struct replica_state
+    {
+        connection_pool *pool;
+        std::atomic<bool> healthy;
+        std::atomic<int> lag_ms;
+        //以下只由检查线程访问
+        bool legacy_sql;                        //服务端不支持SHOW REPLICA STATUS，改用SHOW SLAVE STATUS
+        unsigned int last_error;                //上一次检查的错误，相同的错误只记录一次日志
+        long long next_check_ms;                //摘除的副本下一次重试的时间
+        int retry_ms;                           //摘除的副本当前的重试间隔
+    };
+
+    static const int RECENT_SIZE = 4096;        //最近写入表的大小，冲突只会让更多读请求走主库
+    static const int CHECK_INTERVAL_MS = 1000;
+    static const int MAX_RETRY_MS = 30000;      //摘除的副本重试间隔的上限，从CHECK_INTERVAL_MS开始逐次加倍
+
+    //query_lag的错误码，与mysql的错误码不重叠
+    static const unsigned int LAG_NOT_REPLICA = 1;
+    static const unsigned int LAG_STOPPED = 2;
+
+    static uint64_t hash(const char *s);
+    static void *check_thread(void *arg);
+    void check();
+    //查询副本的复制延迟，返回-1表示不可用，原因记入error
+    int query_lag(replica_state *r, unsigned int &error);
+    //错误与上一次不同时记录日志
+    void log_error(replica_state *r, unsigned int error);
+
+    connection_pool *m_primary;
+    vector<replica_state *> m_replicas;
+    std::atomic<unsigned int> m_next;           //负载相同时轮转
+    std::atomic<long long> *m_recent;           //按用户名哈希分桶，保存读主库的截止时间(毫秒)
+    std::atomic<long long> m_primary_reads;     //因读己之写或故障转移读主库的次数
+    int m_max_lag_ms;
+    pthread_t m_checker;
+    bool m_stop;
+    locker m_lock;
+    cond m_cond;
+    int m_close_log;
+};
+
+#endif
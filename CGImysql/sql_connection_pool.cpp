@@ -4,16 +4,39 @@
 #include <string.h>
 #include <stdlib.h>
 #include <list>
+#include <vector>
 #include <pthread.h>
 #include <iostream>
+#include <sys/time.h>
 #include "sql_connection_pool.h"
+#include "sql_stmt.h"
+#include "../probes/probes.h"
 
 using namespace std;
 
+static const int PING_IDLE_SEC = 30;		//空闲超过该时间的连接在借出前或后台探活
+static const int SHRINK_IDLE_SEC = 60;		//超出常驻数的连接空闲该时间后关闭
+static const int MAINTAIN_SEC = 5;			//维护线程的检查周期
+static const unsigned int CONNECT_TIMEOUT_SEC = 3;
+static const int GROW_WAIT_MS = 10;			//没有空闲连接时先等待的时间，超过后才新建连接
+
+static long long now_us()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (long long)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
 connection_pool::connection_pool()
 {
 	m_CurConn = 0;
 	m_FreeConn = 0;
+	m_MaxConn = 0;
+	m_MinConn = 0;
+	m_TotalConn = 0;
+	m_timeout_ms = 3000;
+	m_stop = true;
+	memset(&m_stats, 0, sizeof(m_stats));
 }
 
 connection_pool *connection_pool::GetInstance()
@@ -22,8 +45,66 @@ connection_pool *connection_pool::GetInstance()
 	return &connPool;
 }
 
+static pthread_once_t library_once = PTHREAD_ONCE_INIT;
+
+static void library_init_once()
+{
+	mysql_library_init(0, NULL, NULL);
+}
+
+void connection_pool::library_init()
+{
+	pthread_once(&library_once, library_init_once);
+}
+
+MYSQL *connection_pool::connect()
+{
+	MYSQL *con = NULL;
+	con = mysql_init(con);				//mysql_init(MYSQL* mysql)：初始化或分配与mysql_real_connect()相适应的MYSQL对象
+	if (con == NULL)
+	{
+		LOG_ERROR("MySQL Error");
+		return NULL;
+	}
+	unsigned int timeout = CONNECT_TIMEOUT_SEC;
+	mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+	if (mysql_real_connect(con, m_url.c_str(), m_User.c_str(), m_PassWord.c_str(), m_DatabaseName.c_str(), m_Port, NULL, 0) == NULL)
+	{
+		LOG_ERROR("MySQL connect error:%s", mysql_error(con));
+		mysql_close(con);
+		return NULL;
+	}
+	if (!sql_stmt::prepare(con))		//提前预编译登录/注册语句，失败则在首次使用时重试
+	{
+		LOG_WARN("prepare statements error:%s", mysql_error(con));
+	}
+	return con;
+}
+
+void connection_pool::close_conn(MYSQL *con)
+{
+	sql_stmt::release(con);				//释放该连接上的预编译语句
+	mysql_close(con);
+}
+
+struct warmup_arg
+{
+	connection_pool *pool;
+	MYSQL *con;
+};
+
+void *connection_pool::warmup_thread(void *arg)
+{
+	warmup_arg *warg = (warmup_arg *)arg;
+	mysql_thread_init();
+	warg->con = warg->pool->connect();
+	mysql_thread_end();
+	return NULL;
+}
+
 //构造初始化
-void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, int MaxConn, int close_log)
+void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, int MaxConn, int close_log,
+						   int MinConn, int timeout_ms)
 {
 	m_url = url;							//初始化数据库信息
 	m_Port = Port;
@@ -31,54 +112,157 @@ void connection_pool::init(string url, string User, string PassWord, string DBNa
 	m_PassWord = PassWord;
 	m_DatabaseName = DBName;
 	m_close_log = close_log;
+	m_MaxConn = MaxConn;
+	m_MinConn = (MinConn < 0 || MinConn > MaxConn) ? MaxConn : MinConn;
+	m_timeout_ms = timeout_ms;
+	library_init();
 
-	for (int i = 0; i < MaxConn; i++)		//创建MaxConn条数据库连接
+	//并行建立常驻连接，启动耗时约为一次连接的时间而不是MinConn次
+	vector<warmup_arg> args(m_MinConn);
+	vector<pthread_t> tids(m_MinConn);
+	vector<bool> started(m_MinConn, false);
+	for (int i = 0; i < m_MinConn; i++)
 	{
-		MYSQL *con = NULL;
-		con = mysql_init(con);				//mysql_init(MYSQL* mysql)：初始化或分配与mysql_real_connect()相适应的MYSQL对象
-
-		if (con == NULL)
-		{
-			LOG_ERROR("MySQL Error");
-			exit(1);
-		}
-		con = mysql_real_connect(con, url.c_str(), User.c_str(), PassWord.c_str(), DBName.c_str(), Port, NULL, 0);
-
-		if (con == NULL)					//建立连接失败
+		args[i].pool = this;
+		args[i].con = NULL;
+		started[i] = (pthread_create(&tids[i], NULL, warmup_thread, &args[i]) == 0);
+		if (!started[i])
+			args[i].con = connect();
+	}
+	for (int i = 0; i < m_MinConn; i++)
+	{
+		if (started[i])
+			pthread_join(tids[i], NULL);
+		if (args[i].con == NULL)			//建立失败的连接由维护线程和后续的扩容补齐
 		{
-			LOG_ERROR("MySQL Error");
-			exit(1);
+			++m_stats.connect_failures;
+			continue;
 		}
-		connList.push_back(con);			//更新连接池和空闲连接数量
+		pooled p = {args[i].con, time(NULL)};
+		connList.push_back(p);				//更新连接池和空闲连接数量
 		++m_FreeConn;
+		++m_TotalConn;
+		reserve.post();
+	}
+	if (m_TotalConn == 0)
+	{
+		LOG_ERROR("%s", "MySQL pool has no connection, will retry on demand");
 	}
 
-	reserve = sem(m_FreeConn);				//将信号量初始化为最大连接次数
+	m_stop = false;
+	if (pthread_create(&m_maintainer, NULL, maintain_thread, this) != 0)
+		m_stop = true;
+}
 
-	m_MaxConn = m_FreeConn;
+bool connection_pool::try_grow()
+{
+	bool ok = false;
+	lock.lock();
+	if (m_TotalConn < m_MaxConn)
+	{
+		++m_TotalConn;
+		ok = true;
+	}
+	lock.unlock();
+	return ok;
 }
 
+void connection_pool::record_wait(long long wait_us)
+{
+	++m_stats.waits;
+	m_stats.wait_total_us += wait_us;
+	if (wait_us > m_stats.wait_max_us)
+		m_stats.wait_max_us = wait_us;
+}
 
 //当有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
+//没有空闲连接时先等待GROW_WAIT_MS，连接很快归还的短暂高峰不扩容；等待超过该时间仍未取得才新建连接，
+//已达上限则最多等待m_timeout_ms
 MYSQL *connection_pool::GetConnection()
 {
-	MYSQL *con = NULL;
-
-	if (0 == connList.size())
+	if (0 == m_MaxConn)			//连接池未初始化，连接都被占用时应等待而不是返回NULL
 		return NULL;
 
-	reserve.wait();				//取出连接，信号量原子减1，为0则等待
-	
-	lock.lock();				//lock互斥锁保证同一时间只有一个线程对容器connList进行操作
+	long long start = now_us();
+	bool waited = false;
+	while (true)
+	{
+		bool got = reserve.trywait();
+		if (!got)
+		{
+			waited = true;
+			long long grow_left_ms = GROW_WAIT_MS - (now_us() - start) / 1000;
+			got = grow_left_ms > 0 && reserve.timewait((int)grow_left_ms);
+		}
+		if (!got)
+		{
+			//等待已超过GROW_WAIT_MS，未达上限则新建一条
+			if (try_grow())
+			{
+				MYSQL *con = connect();
+				long long wait_us = now_us() - start;
+				lock.lock();
+				++m_stats.acquires;
+				if (con)
+				{
+					++m_CurConn;
+					record_wait(wait_us);
+					lock.unlock();
+					PROBE3(db_acquire, this, con, wait_us);
+					return con;
+				}
+				--m_TotalConn;
+				++m_stats.connect_failures;
+				lock.unlock();
+			}
+			long long left_ms = m_timeout_ms - (now_us() - start) / 1000;
+			if (left_ms <= 0 || !reserve.timewait((int)left_ms))
+			{
+				lock.lock();
+				++m_stats.timeouts;
+				lock.unlock();
+				if (PROBE_ENABLED(db_acquire))
+					PROBE3(db_acquire, this, (MYSQL *)NULL, now_us() - start);
+				LOG_WARN("%s", "get mysql connection timeout");
+				return NULL;
+			}
+		}
 
-	con = connList.front();		//得到第一个连接
-	connList.pop_front();		//从连接池中弹出该连接
+		lock.lock();				//lock互斥锁保证同一时间只有一个线程对容器connList进行操作
+		pooled p = connList.front();	//得到最久未使用的连接
+		connList.pop_front();		//从连接池中弹出该连接
+		--m_FreeConn;
+		++m_CurConn;
+		lock.unlock();
 
-	--m_FreeConn;
-	++m_CurConn;
+		//空闲较久的连接先探活，断开则透明重连，重连失败则丢弃后重新获取
+		if (time(NULL) - p.last_used >= PING_IDLE_SEC && mysql_ping(p.con) != 0)
+		{
+			close_conn(p.con);
+			p.con = connect();
+			lock.lock();
+			if (p.con)
+				++m_stats.reconnects;
+			else
+			{
+				++m_stats.connect_failures;
+				--m_CurConn;
+				--m_TotalConn;
+			}
+			lock.unlock();
+			if (!p.con)
+				continue;
+		}
 
-	lock.unlock();
-	return con;
+		long long wait_us = now_us() - start;
+		lock.lock();
+		++m_stats.acquires;
+		if (waited)
+			record_wait(wait_us);
+		lock.unlock();
+		PROBE3(db_acquire, this, p.con, wait_us);
+		return p.con;
+	}
 }
 
 //释放当前使用的连接
@@ -86,10 +270,14 @@ bool connection_pool::ReleaseConnection(MYSQL *con)
 {
 	if (NULL == con)
 		return false;
+	PROBE2(db_release, this, con);
+
+	//连接已断开时把最近使用时间记为0，下次借出前探活失败即重建，不依赖客户端库的自动重连
+	pooled p = {con, sql_stmt::is_gone(mysql_errno(con)) ? 0 : time(NULL)};
 
 	lock.lock();
 
-	connList.push_back(con);
+	connList.push_back(p);
 	++m_FreeConn;
 	--m_CurConn;
 
@@ -99,21 +287,127 @@ bool connection_pool::ReleaseConnection(MYSQL *con)
 	return true;
 }
 
+void *connection_pool::maintain_thread(void *arg)
+{
+	connection_pool *pool = (connection_pool *)arg;
+	mysql_thread_init();
+	pool->maintain();
+	mysql_thread_end();
+	return NULL;
+}
+
+void connection_pool::maintain()
+{
+	while (true)
+	{
+		struct timeval now = {0, 0};
+		gettimeofday(&now, NULL);
+		struct timespec t = {now.tv_sec + MAINTAIN_SEC, now.tv_usec * 1000};
+		lock.lock();
+		if (!m_stop)
+			m_stop_cond.timewait(lock.get(), t);
+		if (m_stop)
+		{
+			lock.unlock();
+			return;
+		}
+		int n = m_FreeConn;
+		lock.unlock();
+
+		//按最久未使用的顺序检查当前空闲的连接，像普通借用者一样先占用信号量
+		for (int i = 0; i < n && reserve.trywait(); ++i)
+		{
+			lock.lock();
+			pooled p = connList.front();
+			connList.pop_front();
+			--m_FreeConn;
+			bool shrink = m_TotalConn > m_MinConn && time(NULL) - p.last_used >= SHRINK_IDLE_SEC;
+			if (shrink)
+				--m_TotalConn;
+			lock.unlock();
+
+			if (shrink)
+			{
+				close_conn(p.con);
+				continue;
+			}
+			if (time(NULL) - p.last_used >= PING_IDLE_SEC)
+			{
+				if (mysql_ping(p.con) != 0)
+				{
+					close_conn(p.con);
+					p.con = connect();
+					lock.lock();
+					if (p.con)
+						++m_stats.reconnects;
+					else
+					{
+						++m_stats.connect_failures;
+						--m_TotalConn;
+					}
+					lock.unlock();
+					if (!p.con)
+						continue;
+				}
+				p.last_used = time(NULL);
+			}
+			lock.lock();
+			connList.push_back(p);
+			++m_FreeConn;
+			lock.unlock();
+			reserve.post();
+		}
+
+		//连接数低于常驻数（启动失败或重连失败）时补齐
+		while (true)
+		{
+			lock.lock();
+			bool enough = m_TotalConn >= m_MinConn;
+			if (!enough)
+				++m_TotalConn;
+			lock.unlock();
+			if (enough)
+				break;
+			MYSQL *con = connect();
+			lock.lock();
+			if (!con)
+			{
+				--m_TotalConn;
+				++m_stats.connect_failures;
+				lock.unlock();
+				break;
+			}
+			pooled p = {con, time(NULL)};
+			connList.push_back(p);
+			++m_FreeConn;
+			lock.unlock();
+			reserve.post();
+		}
+	}
+}
+
 //销毁数据库连接池
 void connection_pool::DestroyPool()
 {
+	lock.lock();
+	bool running = !m_stop;
+	m_stop = true;
+	m_stop_cond.broadcast();
+	lock.unlock();
+	if (running)
+		pthread_join(m_maintainer, NULL);
 
 	lock.lock();
 	if (connList.size() > 0)
 	{
-		list<MYSQL *>::iterator it;			//通过迭代器遍历，关闭数据库连接
+		list<pooled>::iterator it;			//通过迭代器遍历，关闭数据库连接
 		for (it = connList.begin(); it != connList.end(); ++it)
 		{
-			MYSQL *con = *it;
-			mysql_close(con);				//关闭连接
+			close_conn(it->con);			//关闭连接
 		}
 		m_CurConn = 0;
 		m_FreeConn = 0;
+		m_TotalConn = 0;
 		connList.clear();					//清空连接池
 	}
 
@@ -126,6 +420,23 @@ int connection_pool::GetFreeConn()
 	return this->m_FreeConn;
 }
 
+//当前已借出的连接数，用于选择负载最低的连接池
+int connection_pool::GetBusyConn()
+{
+	return this->m_CurConn;
+}
+
+pool_usage connection_pool::GetStats()
+{
+	lock.lock();
+	pool_usage stats = m_stats;
+	stats.total = m_TotalConn;
+	stats.free = m_FreeConn;
+	stats.in_use = m_CurConn;
+	lock.unlock();
+	return stats;
+}
+
 connection_pool::~connection_pool()
 {
 	DestroyPool();
@@ -140,4 +451,4 @@ connectionRAII::connectionRAII(MYSQL **SQL, connection_pool *connPool){
 
 connectionRAII::~connectionRAII(){
 	poolRAII->ReleaseConnection(conRAII);			//资源释放
-}
\ No newline at end of file
+}
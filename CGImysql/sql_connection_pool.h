@@ -6,40 +6,88 @@
 #include <mysql/mysql.h>
 #include <error.h>
 #include <string.h>
+#include <time.h>
 #include <iostream>
 #include <string>
+#include <pthread.h>
 #include "../lock/locker.h"
 #include "../log/log.h"
 
 using namespace std;
 
+//连接池统计，GetStats返回的快照
+struct pool_usage
+{
+	int total;						//当前连接总数
+	int free;						//空闲连接数
+	int in_use;						//已借出的连接数
+	long long acquires;				//获取连接的次数
+	long long waits;				//需要等待的次数
+	long long wait_total_us;		//累计等待时间
+	long long wait_max_us;			//最大等待时间
+	long long timeouts;				//等待超时的次数
+	long long connect_failures;		//建立/重建连接失败的次数
+	long long reconnects;			//断线重连成功的次数
+};
+
 class connection_pool
 {
 public:
-	MYSQL *GetConnection();				 //获取数据库连接
+	MYSQL *GetConnection();				 //获取数据库连接，等待超时返回NULL
 	bool ReleaseConnection(MYSQL *conn); //释放连接
 	int GetFreeConn();					 //获取空闲连接
+	int GetBusyConn();					 //获取已借出的连接数
 	void DestroyPool();					 //销毁所有连接
+	pool_usage GetStats();				 //连接池统计
 
-	//单例模式
+	//单例模式，主库连接池；只读副本等其他实例直接构造
 	static connection_pool *GetInstance();
+	//初始化客户端库，只执行一次；mysql_init在多个线程中首次调用时各自初始化是不安全的，须在建立任何连接前调用
+	static void library_init();
 
-	void init(string url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log); 
-
-private:
 	connection_pool();
 	~connection_pool();
 
+	//MaxConn为连接数上限，MinConn为常驻连接数（小于0时与MaxConn相同），timeout_ms为获取连接的最长等待时间
+	void init(string url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log,
+			  int MinConn = -1, int timeout_ms = 3000);
+
+private:
+	connection_pool(const connection_pool &);
+	connection_pool &operator=(const connection_pool &);
+
+	//空闲连接及其最近一次使用的时间
+	struct pooled
+	{
+		MYSQL *con;
+		time_t last_used;
+	};
+
+	MYSQL *connect();					//建立一条新连接并预编译语句，失败返回NULL
+	void close_conn(MYSQL *con);		//关闭连接并释放其预编译语句
+	bool try_grow();					//连接数未达上限时占用一个名额
+	static void *maintain_thread(void *arg);
+	void maintain();					//后台线程：探活空闲连接，回收多余的空闲连接
+	static void *warmup_thread(void *arg);
+	void record_wait(long long wait_us);	//记录一次需要等待的获取，调用方持有lock
+
 	int m_MaxConn;  //最大连接数
+	int m_MinConn;  //常驻连接数
 	int m_CurConn;  //当前已使用的连接数
 	int m_FreeConn; //当前空闲的连接数
+	int m_TotalConn;	//当前连接总数（含正在建立的）
+	int m_timeout_ms;	//获取连接的超时时间
 	locker lock;			//锁
-	list<MYSQL *> connList; //连接池
+	list<pooled> connList; //连接池，队首是最久未使用的连接
 	sem reserve;			//信号量
+	pthread_t m_maintainer;	//维护线程
+	bool m_stop;			//停止维护线程
+	cond m_stop_cond;		//唤醒维护线程
+	pool_usage m_stats;		//统计，受lock保护
 
 public:
 	string m_url;			 //主机地址
-	string m_Port;		 //数据库端口号
+	int m_Port;			 //数据库端口号
 	string m_User;		 //登陆数据库用户名
 	string m_PassWord;	 //登陆数据库密码
 	string m_DatabaseName; //使用数据库名
@@ -0,0 +1,48 @@
+#include "sql_shard.h"
+#include "sql_cluster.h"
+
+sql_shard_map::sql_shard_map()
+{
+    m_ring.build(vector<string>());
+}
+
+sql_shard_map::~sql_shard_map()
+{
+    destroy();
+}
+
+sql_shard_map *sql_shard_map::GetInstance()
+{
+    static sql_shard_map shards;
+    return &shards;
+}
+
+void sql_shard_map::init(const vector<sql_cluster *> &clusters, const vector<string> &ids)
+{
+    m_clusters = clusters;
+    m_ids = ids;
+    m_ring.build(ids);
+}
+
+void sql_shard_map::destroy()
+{
+    sql_cluster *def = sql_cluster::GetInstance();
+    for (size_t i = 0; i < m_clusters.size(); ++i)
+    {
+        m_clusters[i]->destroy();
+        if (m_clusters[i] == def)
+            continue;
+        delete m_clusters[i]->writer();
+        delete m_clusters[i];
+    }
+    m_clusters.clear();
+    m_ids.clear();
+    m_ring.build(m_ids);
+}
+
+sql_cluster *sql_shard_map::route(const char *name)
+{
+    if (m_clusters.size() <= 1)
+        return m_clusters.empty() ? sql_cluster::GetInstance() : m_clusters[0];
+    return m_clusters[m_ring.locate(name)];
+}
@@ -0,0 +1,43 @@
+/*************************************************************
+*按用户名分片：一致性哈希环把用户名映射到N个数据库实例之一
+*每个分片是一个sql_cluster（主库连接池及其只读副本），各自持有user表的一部分
+*环上的虚拟节点由分片主库的地址生成，增加分片时只有约1/(N+1)的用户需要迁移
+**************************************************************/
+
+#ifndef _SQL_SHARD_
+#define _SQL_SHARD_
+
+#include <string>
+#include <vector>
+#include "hash_ring.h"
+
+using namespace std;
+
+class sql_cluster;
+
+class sql_shard_map
+{
+public:
+    static sql_shard_map *GetInstance();
+
+    //clusters[i]对应ids[i]；不调用init时所有用户都路由到sql_cluster::GetInstance()
+    void init(const vector<sql_cluster *> &clusters, const vector<string> &ids);
+    //销毁除默认实例外的分片，包括它们的主库连接池
+    void destroy();
+
+    //用户名所在的分片
+    sql_cluster *route(const char *name);
+    int count() const { return (int)m_clusters.size(); }
+    sql_cluster *shard(int i) { return m_clusters[i]; }
+    const string &id(int i) const { return m_ids[i]; }
+
+private:
+    sql_shard_map();
+    ~sql_shard_map();
+
+    hash_ring m_ring;
+    vector<sql_cluster *> m_clusters;
+    vector<string> m_ids;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <string.h>
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
+#include "sql_stmt.h"
+
+using namespace std;
+
+static const char *SQL_INSERT_USER = "INSERT INTO user(username, passwd) VALUES(?, ?)";
+static const char *SQL_QUERY_PASSWD = "SELECT passwd FROM user WHERE username = ?";
+static const char *SQL_UPDATE_PASSWD = "UPDATE user SET passwd = ? WHERE username = ? AND passwd = ?";
+static const char *SQL_PASSWD_WIDTH = "SELECT CHARACTER_MAXIMUM_LENGTH FROM information_schema.COLUMNS "
+                                      "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = 'user' AND COLUMN_NAME = 'passwd'";
+//只由username一列组成的唯一索引(含主键)
+static const char *SQL_USERNAME_UNIQUE = "SELECT INDEX_NAME FROM information_schema.STATISTICS "
+                                         "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = 'user' AND NON_UNIQUE = 0 "
+                                         "GROUP BY INDEX_NAME HAVING COUNT(*) = 1 AND MAX(COLUMN_NAME) = 'username'";
+static const int PASSWD_BUF_LEN = 256;
+
+map<MYSQL *, sql_stmt::stmt_set *> sql_stmt::m_stmts;
+locker sql_stmt::m_lock;
+bool sql_stmt::m_unique_name = false;
+locker sql_stmt::m_name_locks[NAME_LOCKS];
+
+bool sql_stmt::is_gone(unsigned int err)
+{
+    return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+}
+
+void sql_stmt::close(stmt_set *set)
+{
+    if (set->insert)
+        mysql_stmt_close(set->insert);
+    if (set->select)
+        mysql_stmt_close(set->select);
+    if (set->update)
+        mysql_stmt_close(set->update);
+    set->insert = NULL;
+    set->select = NULL;
+    set->update = NULL;
+}
+
+bool sql_stmt::prepare(MYSQL *con, stmt_set *set)
+{
+    close(set);
+    set->insert = mysql_stmt_init(con);
+    set->select = mysql_stmt_init(con);
+    set->update = mysql_stmt_init(con);
+    if (!set->insert || !set->select || !set->update ||
+        mysql_stmt_prepare(set->insert, SQL_INSERT_USER, strlen(SQL_INSERT_USER)) ||
+        mysql_stmt_prepare(set->select, SQL_QUERY_PASSWD, strlen(SQL_QUERY_PASSWD)) ||
+        mysql_stmt_prepare(set->update, SQL_UPDATE_PASSWD, strlen(SQL_UPDATE_PASSWD)))
+    {
+        close(set);
+        return false;
+    }
+    return true;
+}
+
+sql_stmt::stmt_set *sql_stmt::get(MYSQL *con)
+{
+    stmt_set *set = NULL;
+    m_lock.lock();
+    map<MYSQL *, stmt_set *>::iterator it = m_stmts.find(con);
+    if (it == m_stmts.end())
+    {
+        set = new stmt_set;
+        set->insert = NULL;
+        set->select = NULL;
+        set->update = NULL;
+        m_stmts[con] = set;
+    }
+    else
+        set = it->second;
+    m_lock.unlock();
+
+    //首次使用，或者上次预编译失败
+    if (!set->insert && !prepare(con, set))
+        return NULL;
+    return set;
+}
+
+bool sql_stmt::prepare(MYSQL *con)
+{
+    return get(con) != NULL;
+}
+
+void sql_stmt::release(MYSQL *con)
+{
+    m_lock.lock();
+    map<MYSQL *, stmt_set *>::iterator it = m_stmts.find(con);
+    if (it != m_stmts.end())
+    {
+        close(it->second);
+        delete it->second;
+        m_stmts.erase(it);
+    }
+    m_lock.unlock();
+}
+
+//连接断开时直接返回错误，连接归还后由连接池探活重建，不在这里重连
+sql_stmt::RESULT sql_stmt::insert_user(MYSQL *con, const char *name, const char *passwd)
+{
+    stmt_set *set = get(con);
+    if (!set)
+        return SQL_ERROR;
+    //有唯一索引时并发注册同一用户名只有一条成功，其余由数据库返回重名
+    if (m_unique_name)
+        return execute_insert(set, name, passwd);
+
+    //没有唯一索引时，持该用户名所在分段的锁查重后再插入，同一进程内同名的注册不会都插入成功
+    unsigned int h = 2166136261u;
+    for (const char *p = name; *p; ++p)
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    locker &lock = m_name_locks[h % NAME_LOCKS];
+    lock.lock();
+    string stored;
+    RESULT res = query_passwd(con, name, stored);
+    if (res == SQL_OK)
+        res = SQL_DUP;
+    else if (res == SQL_NOT_FOUND)
+        res = execute_insert(set, name, passwd);
+    lock.unlock();
+    return res;
+}
+
+sql_stmt::RESULT sql_stmt::execute_insert(stmt_set *set, const char *name, const char *passwd)
+{
+    unsigned long name_len = strlen(name);
+    unsigned long passwd_len = strlen(passwd);
+    MYSQL_BIND param[2];
+    memset(param, 0, sizeof(param));
+    param[0].buffer_type = MYSQL_TYPE_STRING;
+    param[0].buffer = (void *)name;
+    param[0].buffer_length = name_len;
+    param[0].length = &name_len;
+    param[1].buffer_type = MYSQL_TYPE_STRING;
+    param[1].buffer = (void *)passwd;
+    param[1].buffer_length = passwd_len;
+    param[1].length = &passwd_len;
+
+    if (mysql_stmt_bind_param(set->insert, param) == 0 && mysql_stmt_execute(set->insert) == 0)
+        return SQL_OK;
+    if (mysql_stmt_errno(set->insert) == ER_DUP_ENTRY)
+        return SQL_DUP;
+    return SQL_ERROR;
+}
+
+sql_stmt::RESULT sql_stmt::query_passwd(MYSQL *con, const char *name, string &passwd)
+{
+    stmt_set *set = get(con);
+    if (!set)
+        return SQL_ERROR;
+
+    unsigned long name_len = strlen(name);
+    MYSQL_BIND param[1];
+    memset(param, 0, sizeof(param));
+    param[0].buffer_type = MYSQL_TYPE_STRING;
+    param[0].buffer = (void *)name;
+    param[0].buffer_length = name_len;
+    param[0].length = &name_len;
+
+    char buf[PASSWD_BUF_LEN];
+    unsigned long buf_len = 0;
+    MYSQL_BIND result[1];
+    memset(result, 0, sizeof(result));
+    result[0].buffer_type = MYSQL_TYPE_STRING;
+    result[0].buffer = buf;
+    result[0].buffer_length = sizeof(buf);
+    result[0].length = &buf_len;
+
+    if (mysql_stmt_bind_param(set->select, param) || mysql_stmt_execute(set->select))
+        return SQL_ERROR;
+    if (mysql_stmt_bind_result(set->select, result) || mysql_stmt_store_result(set->select))
+    {
+        mysql_stmt_free_result(set->select);
+        return SQL_ERROR;
+    }
+
+    RESULT ret = SQL_NOT_FOUND;
+    int fetched = mysql_stmt_fetch(set->select);
+    if (fetched == 0 || fetched == MYSQL_DATA_TRUNCATED)
+    {
+        if (buf_len >= sizeof(buf))             //超出缓冲区的密码视为错误
+            ret = SQL_ERROR;
+        else
+        {
+            passwd.assign(buf, buf_len);
+            ret = SQL_OK;
+        }
+    }
+    else if (fetched != MYSQL_NO_DATA)
+        ret = SQL_ERROR;
+    mysql_stmt_free_result(set->select);
+    return ret;
+}
+
+sql_stmt::RESULT sql_stmt::update_passwd(MYSQL *con, const char *name, const char *old_passwd, const char *passwd)
+{
+    stmt_set *set = get(con);
+    if (!set)
+        return SQL_ERROR;
+
+    const char *values[3] = {passwd, name, old_passwd};
+    unsigned long lens[3];
+    MYSQL_BIND param[3];
+    memset(param, 0, sizeof(param));
+    for (int i = 0; i < 3; ++i)
+    {
+        lens[i] = strlen(values[i]);
+        param[i].buffer_type = MYSQL_TYPE_STRING;
+        param[i].buffer = (void *)values[i];
+        param[i].buffer_length = lens[i];
+        param[i].length = &lens[i];
+    }
+
+    if (mysql_stmt_bind_param(set->update, param) == 0 && mysql_stmt_execute(set->update) == 0)
+        return mysql_stmt_affected_rows(set->update) > 0 ? SQL_OK : SQL_NOT_FOUND;
+    return SQL_ERROR;
+}
+
+int sql_stmt::passwd_width(MYSQL *con)
+{
+    if (mysql_query(con, SQL_PASSWD_WIDTH))
+        return -1;
+    MYSQL_RES *result = mysql_store_result(con);
+    if (!result)
+        return -1;
+    MYSQL_ROW row = mysql_fetch_row(result);
+    int width = row && row[0] ? atoi(row[0]) : -1;
+    mysql_free_result(result);
+    return width;
+}
+
+int sql_stmt::username_unique(MYSQL *con)
+{
+    if (mysql_query(con, SQL_USERNAME_UNIQUE))
+        return -1;
+    MYSQL_RES *result = mysql_store_result(con);
+    if (!result)
+        return -1;
+    int unique = mysql_fetch_row(result) ? 1 : 0;
+    mysql_free_result(result);
+    return unique;
+}
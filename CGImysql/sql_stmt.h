@@ -0,0 +1,67 @@
+#ifndef _SQL_STMT_
+#define _SQL_STMT_
+
+#include <map>
+#include <string>
+#include <mysql/mysql.h>
+#include "../lock/locker.h"
+
+using namespace std;
+
+//登录/注册用到的预编译语句
+//每条数据库连接各自预编译一次，按连接缓存；断开的连接由连接池关闭重建，新连接重新预编译
+//同一时刻一条连接只被一个线程持有，所以取出的语句无需额外加锁
+class sql_stmt
+{
+public:
+    enum RESULT
+    {
+        SQL_OK = 0,         //执行成功/查到记录
+        SQL_DUP,            //注册时用户名已存在
+        SQL_NOT_FOUND,      //查询时用户不存在
+        SQL_ERROR           //数据库错误
+    };
+
+    //INSERT INTO user(username, passwd) VALUES(?, ?)
+    static RESULT insert_user(MYSQL *con, const char *name, const char *passwd);
+    //SELECT passwd FROM user WHERE username = ?，找到时写入passwd
+    static RESULT query_passwd(MYSQL *con, const char *name, string &passwd);
+    //UPDATE user SET passwd = ? WHERE username = ? AND passwd = ?，密码已被其他请求改写时返回SQL_NOT_FOUND
+    static RESULT update_passwd(MYSQL *con, const char *name, const char *old_passwd, const char *passwd);
+    //当前库user表passwd列的最大字符数，查询失败返回-1
+    static int passwd_width(MYSQL *con);
+    //当前库user表的username上有唯一索引时返回1，没有返回0，查询失败返回-1
+    static int username_unique(MYSQL *con);
+    //启动时按各分片的检查结果设置；没有唯一索引时insert_user在本进程内按用户名串行化，先查重再插入
+    static void set_unique_name(bool unique) { m_unique_name = unique; }
+    static bool unique_name() { return m_unique_name; }
+    //为新建立的连接预编译语句，失败返回false
+    static bool prepare(MYSQL *con);
+    //连接关闭前释放其上的语句
+    static void release(MYSQL *con);
+    //连接已断开的错误，这样的连接归还后须重建
+    static bool is_gone(unsigned int err);
+
+private:
+    struct stmt_set
+    {
+        MYSQL_STMT *insert;
+        MYSQL_STMT *select;
+        MYSQL_STMT *update;
+    };
+
+    //取出连接对应的语句，必要时重新预编译
+    static stmt_set *get(MYSQL *con);
+    static bool prepare(MYSQL *con, stmt_set *set);
+    static void close(stmt_set *set);
+    static RESULT execute_insert(stmt_set *set, const char *name, const char *passwd);
+
+    static const int NAME_LOCKS = 64;
+
+    static map<MYSQL *, stmt_set *> m_stmts;
+    static locker m_lock;       //保护m_stmts
+    static bool m_unique_name;
+    static locker m_name_locks[NAME_LOCKS];     //按用户名哈希分段，没有唯一索引时串行化同名注册
+};
+
+#endif
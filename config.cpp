@@ -7,6 +7,39 @@ Config::Config(){
     //日志写入方式，默认同步
     LOGWrite = 0;
 
+    //日志级别,0 debug,1 info,2 warn,3 error,默认0全部记录,运行中SIGUSR1降低一级、SIGUSR2提高一级
+    log_level = 0;
+
+    //日志归档保留个数,默认30,切分出的旧日志压缩成.gz后只保留最新的若干个,0表示不限
+    log_max_files = 30;
+
+    //日志归档保留总大小(MB),默认0不限,超出时从最旧的归档开始删除
+    log_max_size = 0;
+
+    //环形日志文件大小(MB),默认16,-l 3时只保留最近写入的这么多日志
+    log_ring_size = 16;
+
+    //访问日志格式,默认0关闭,1 common,2 combined,3 JSON,写入./AccessLog
+    access_format = 0;
+
+    //访问日志采样间隔,默认1记录全部请求,N表示每N个请求记录一个,出错和慢请求总是记录
+    access_sample = 1;
+
+    //慢请求阈值(毫秒),默认500,超过的请求总是记录,0表示不按耗时
+    access_slow = 500;
+
+    //指标端口,默认0不启用,启用后在该端口上以Prometheus文本格式输出
+    metrics_port = 0;
+
+    //指标路径,默认/metrics
+    metrics_path = "/metrics";
+
+    //指标端口绑定的地址,默认127.0.0.1只允许本机抓取,0.0.0.0表示所有地址
+    metrics_addr = "127.0.0.1";
+
+    //分段计时的慢请求阈值(毫秒),默认-1不启用,超过的请求在日志中写一行各阶段耗时并导出到./RequestTrace.json,0表示记录全部请求
+    trace_slow = -1;
+
     //触发组合模式,默认listenfd LT + connfd LT
     TRIGMode = 0;
 
@@ -19,12 +52,60 @@ Config::Config(){
     //优雅关闭链接，默认不使用
     OPT_LINGER = 0;
 
+    //主库地址,默认localhost:3306,逗号分隔多个地址时按用户名分库,每个地址是一个分片
+    sql_primary = "localhost:3306";
+
+    //只读副本地址,逗号分隔,分库时用分号分隔各分片的副本,默认不使用副本
+    sql_replicas = "";
+
+    //副本可接受的复制延迟(毫秒),默认1000
+    sql_max_lag = 1000;
+
     //数据库连接池数量,默认8
     sql_num = 8;
 
+    //数据库连接池常驻连接数,默认4,负载升高时按需扩容到sql_num
+    sql_min = 4;
+
     //线程池内的线程数量,默认8
     thread_num = 8;
 
+    //线程池内的线程数量上限,默认32,任务积压或线程阻塞时在[thread_num, max_thread_num]之间伸缩
+    max_thread_num = 32;
+
+    //数据库执行器的线程数量,默认8,与数据库连接池数量一致
+    db_thread_num = 8;
+
+    //数据库执行器的排队上限,默认1000,超出时返回503
+    db_max_requests = 1000;
+
+    //密码哈希执行器的线程数,默认2,0表示不启用哈希(密码按明文保存)
+    hash_thread_num = 2;
+
+    //密码哈希执行器的排队上限,默认200,超出时返回503;每次哈希耗时数毫秒,排队过长时不如直接拒绝
+    hash_max_requests = 200;
+
+    //异步数据库层,默认关闭,需要MariaDB Connector/C
+    async_sql = 0;
+
+    //注册组提交每批最大条数,默认64,1即关闭
+    batch_size = 64;
+
+    //注册组提交的收集窗口,默认0即不等待,上一批执行期间到达的注册组成下一批
+    batch_window = 0;
+
+    //用户表快照的保存间隔(秒),默认300,0表示只在退出时保存
+    snapshot_interval = 300;
+
+    //会话有效期(秒),默认1800,0表示不启用会话(此时不接受上传)
+    session_ttl = 1800;
+
+    //上传目录的总大小上限(MB),默认1024,0表示不限制
+    upload_max_mb = 1024;
+
+    //上传目录的文件个数上限,默认10000,0表示不限制
+    upload_max_files = 10000;
+
     //关闭日志,默认不关闭
     close_log = 0;
 
@@ -34,7 +115,7 @@ Config::Config(){
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:V:f:g:r:x:n:W:M:P:B:y:m:o:H:R:L:s:S:t:T:d:q:k:Q:A:b:w:U:E:z:Z:c:a:";
     while ((opt = getopt(argc, argv, str)) != -1)
     {
         switch (opt)
@@ -49,6 +130,61 @@ void Config::parse_arg(int argc, char*argv[]){
             LOGWrite = atoi(optarg);
             break;
         }
+        case 'V':
+        {
+            log_level = atoi(optarg);
+            break;
+        }
+        case 'f':
+        {
+            log_max_files = atoi(optarg);
+            break;
+        }
+        case 'g':
+        {
+            log_max_size = atoi(optarg);
+            break;
+        }
+        case 'r':
+        {
+            log_ring_size = atoi(optarg);
+            break;
+        }
+        case 'x':
+        {
+            access_format = atoi(optarg);
+            break;
+        }
+        case 'n':
+        {
+            access_sample = atoi(optarg);
+            break;
+        }
+        case 'W':
+        {
+            access_slow = atoi(optarg);
+            break;
+        }
+        case 'M':
+        {
+            metrics_port = atoi(optarg);
+            break;
+        }
+        case 'P':
+        {
+            metrics_path = optarg;
+            break;
+        }
+        case 'B':
+        {
+            metrics_addr = optarg;
+            break;
+        }
+        case 'y':
+        {
+            trace_slow = atoi(optarg);
+            break;
+        }
         case 'm':
         {
             TRIGMode = atoi(optarg);
@@ -59,16 +195,96 @@ void Config::parse_arg(int argc, char*argv[]){
             OPT_LINGER = atoi(optarg);
             break;
         }
+        case 'H':
+        {
+            sql_primary = optarg;
+            break;
+        }
+        case 'R':
+        {
+            sql_replicas = optarg;
+            break;
+        }
+        case 'L':
+        {
+            sql_max_lag = atoi(optarg);
+            break;
+        }
         case 's':
         {
             sql_num = atoi(optarg);
             break;
         }
+        case 'S':
+        {
+            sql_min = atoi(optarg);
+            break;
+        }
         case 't':
         {
             thread_num = atoi(optarg);
             break;
         }
+        case 'T':
+        {
+            max_thread_num = atoi(optarg);
+            break;
+        }
+        case 'd':
+        {
+            db_thread_num = atoi(optarg);
+            break;
+        }
+        case 'q':
+        {
+            db_max_requests = atoi(optarg);
+            break;
+        }
+        case 'k':
+        {
+            hash_thread_num = atoi(optarg);
+            break;
+        }
+        case 'Q':
+        {
+            hash_max_requests = atoi(optarg);
+            break;
+        }
+        case 'A':
+        {
+            async_sql = atoi(optarg);
+            break;
+        }
+        case 'b':
+        {
+            batch_size = atoi(optarg);
+            break;
+        }
+        case 'w':
+        {
+            batch_window = atoi(optarg);
+            break;
+        }
+        case 'U':
+        {
+            snapshot_interval = atoi(optarg);
+            break;
+        }
+        case 'E':
+        {
+            session_ttl = atoi(optarg);
+            break;
+        }
+        case 'z':
+        {
+            upload_max_mb = atoi(optarg);
+            break;
+        }
+        case 'Z':
+        {
+            upload_max_files = atoi(optarg);
+            break;
+        }
         case 'c':
         {
             close_log = atoi(optarg);
@@ -16,9 +16,42 @@ public:
     //端口号
     int PORT;
 
-    //日志写入方式
+    //日志写入方式：0同步，1异步，2二进制（用logdecode还原），3内存映射环形文件（用ringdump读取）
     int LOGWrite;
 
+    //日志级别
+    int log_level;
+
+    //日志归档保留个数
+    int log_max_files;
+
+    //日志归档保留总大小(MB)
+    int log_max_size;
+
+    //环形日志文件大小(MB)
+    int log_ring_size;
+
+    //访问日志格式：0关闭，1 common，2 combined，3 JSON
+    int access_format;
+
+    //访问日志采样间隔
+    int access_sample;
+
+    //访问日志的慢请求阈值(毫秒)
+    int access_slow;
+
+    //指标端口
+    int metrics_port;
+
+    //指标路径
+    string metrics_path;
+
+    //指标端口绑定的地址
+    string metrics_addr;
+
+    //分段计时的慢请求阈值(毫秒)
+    int trace_slow;
+
     //触发组合模式
     int TRIGMode;
 
@@ -31,12 +64,60 @@ public:
     //优雅关闭链接
     int OPT_LINGER;
 
+    //主库地址host:port,逗号分隔多个分片
+    string sql_primary;
+
+    //只读副本地址host:port,逗号分隔,分号分隔各分片
+    string sql_replicas;
+
+    //副本可接受的复制延迟(毫秒)
+    int sql_max_lag;
+
     //数据库连接池数量
     int sql_num;
 
+    //数据库连接池常驻连接数
+    int sql_min;
+
     //线程池内的线程数量
     int thread_num;
 
+    //线程池内的线程数量上限
+    int max_thread_num;
+
+    //数据库执行器的线程数量（登录/注册并发上限）
+    int db_thread_num;
+
+    //数据库执行器的排队上限
+    int db_max_requests;
+
+    //密码哈希执行器的线程数（哈希计算的并发上限）
+    int hash_thread_num;
+
+    //密码哈希执行器的排队上限
+    int hash_max_requests;
+
+    //是否使用非阻塞的异步数据库层
+    int async_sql;
+
+    //注册组提交每批的最大条数,不大于1时关闭
+    int batch_size;
+
+    //注册组提交的收集窗口(毫秒)
+    int batch_window;
+
+    //用户表快照的保存间隔(秒)
+    int snapshot_interval;
+
+    //会话有效期(秒)
+    int session_ttl;
+
+    //上传目录的总大小上限(MB)
+    int upload_max_mb;
+
+    //上传目录的文件个数上限
+    int upload_max_files;
+
     //是否关闭日志
     int close_log;
 
@@ -0,0 +1,624 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include "form_parser.h"
+#include "upload_quota.h"
+
+static bool write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+form_parser::form_parser() : m_type(URLENCODED), m_state(S_END), m_error(NULL), m_arena(NULL), m_arena_used(0),
+                             m_name_off(0), m_name_len(0), m_value_off(0), m_match(0), m_after_len(0),
+                             m_in_file(false), m_fd(-1), m_file_buf(NULL), m_file_used(0), m_quota(NULL), m_reserved(0)
+{
+}
+
+form_parser::~form_parser()
+{
+    reset();
+}
+
+void form_parser::begin(TYPE type, const char *boundary, const char *upload_dir, upload_quota *quota)
+{
+    reset();
+    m_type = type;
+    m_dir = upload_dir ? upload_dir : "";
+    m_quota = quota;
+    if (type == MULTIPART)
+    {
+        m_delim = "\r\n--";
+        m_delim += boundary;
+        m_match = 2;                //把消息体开头视为已有\r\n，第一个分隔符与后面的按同一规则匹配
+        m_state = S_PREAMBLE;
+    }
+    else
+        m_state = S_KEY;
+}
+
+void form_parser::reset()
+{
+    close_file(false);
+    free(m_arena);
+    m_arena = NULL;
+    m_arena_used = 0;
+    free(m_file_buf);
+    m_file_buf = NULL;
+    m_file_used = 0;
+    m_fields.clear();
+    m_files.clear();
+    m_head.clear();
+    m_in_file = false;
+    m_error = NULL;
+    m_state = S_END;
+}
+
+form_parser::STATUS form_parser::fail(const char *reason)
+{
+    if (m_state != S_ERROR)
+        m_error = reason;
+    m_state = S_ERROR;
+    close_file(false);
+    return PARSE_ERROR;
+}
+
+form_parser::STATUS form_parser::status() const
+{
+    if (m_state == S_ERROR)
+        return PARSE_ERROR;
+    return m_state == S_END ? PARSE_DONE : PARSE_MORE;
+}
+
+bool form_parser::push_field(const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    if (m_fields.size() + m_files.size() >= MAX_FIELDS)
+    {
+        fail("too many fields");
+        return false;
+    }
+    field f;
+    f.name.data = name;
+    f.name.len = name_len;
+    f.value.data = value;
+    f.value.len = value_len;
+    m_fields.push_back(f);
+    return true;
+}
+
+bool form_parser::append(const char *data, size_t len)
+{
+    if (!m_arena)
+        m_arena = (char *)malloc(ARENA_SIZE);
+    if (!m_arena || m_arena_used + len > ARENA_SIZE)
+    {
+        fail("form fields too large");
+        return false;
+    }
+    memcpy(m_arena + m_arena_used, data, len);
+    m_arena_used += len;
+    return true;
+}
+
+form_parser::STATUS form_parser::parse(const char *body, size_t len)
+{
+    if (m_type == MULTIPART)
+    {
+        if (feed(body, len) == PARSE_ERROR)
+            return PARSE_ERROR;
+        return finish();
+    }
+
+    //字段的名和值都是body中的视图，解码推迟到get()
+    const char *p = body, *end = body + len;
+    while (p < end)
+    {
+        const char *amp = (const char *)memchr(p, '&', end - p);
+        if (!amp)
+            amp = end;
+        if (amp > p)
+        {
+            const char *eq = (const char *)memchr(p, '=', amp - p);
+            bool ok = eq ? push_field(p, eq - p, eq + 1, amp - eq - 1) : push_field(p, amp - p, amp, 0);
+            if (!ok)
+                return PARSE_ERROR;
+        }
+        p = amp + 1;
+    }
+    m_state = S_END;
+    return PARSE_DONE;
+}
+
+//结束当前的urlencoded字段，空字段（如"&&"）直接跳过
+bool form_parser::end_pair()
+{
+    bool ok = true;
+    if (m_state == S_VALUE)
+        ok = push_field(m_arena + m_name_off, m_name_len, m_arena + m_value_off, m_arena_used - m_value_off);
+    else if (m_arena_used > m_name_off)
+        ok = push_field(m_arena + m_name_off, m_arena_used - m_name_off, "", 0);
+    m_name_off = m_arena_used;
+    m_state = S_KEY;
+    return ok;
+}
+
+void form_parser::feed_urlencoded(const char *data, size_t len)
+{
+    size_t i = 0;
+    while (i < len && m_state != S_ERROR)
+    {
+        size_t j = i;
+        while (j < len && data[j] != '&' && !(data[j] == '=' && m_state == S_KEY))
+            ++j;
+        if (!append(data + i, j - i) || j == len)
+            return;
+        if (data[j] == '&')
+        {
+            if (!end_pair())
+                return;
+        }
+        else
+        {
+            m_name_len = m_arena_used - m_name_off;
+            m_value_off = m_arena_used;
+            m_state = S_VALUE;
+        }
+        i = j + 1;
+    }
+}
+
+form_parser::STATUS form_parser::feed(const char *data, size_t len)
+{
+    if (m_state == S_ERROR || m_state == S_END)
+        return status();
+    if (m_type == URLENCODED)
+    {
+        feed_urlencoded(data, len);
+        return status();
+    }
+
+    size_t i = 0;
+    while (i < len && m_state != S_ERROR && m_state != S_END)
+    {
+        if (m_state == S_PREAMBLE || m_state == S_DATA)
+        {
+            i += scan(data + i, len - i);
+        }
+        else if (m_state == S_AFTER)
+        {
+            m_after[m_after_len++] = data[i++];
+            if (m_after_len < 2)
+                continue;
+            if (m_after[0] == '-' && m_after[1] == '-')
+                m_state = S_END;            //结尾分隔符之后的内容忽略
+            else if (m_after[0] == '\r' && m_after[1] == '\n')
+            {
+                m_head.clear();
+                m_state = S_HEADERS;
+            }
+            else
+                fail("bad boundary");
+        }
+        else
+        {
+            const char *nl = (const char *)memchr(data + i, '\n', len - i);
+            size_t n = nl ? nl - (data + i) + 1 : len - i;
+            if (m_head.size() + n > HEADER_SIZE)
+            {
+                fail("part header too large");
+                break;
+            }
+            m_head.append(data + i, n);
+            i += n;
+            size_t h = m_head.size();
+            if (m_head == "\r\n" || (h >= 4 && m_head.compare(h - 4, 4, "\r\n\r\n") == 0))
+                start_part();
+        }
+    }
+    return status();
+}
+
+form_parser::STATUS form_parser::finish()
+{
+    if (m_state == S_ERROR)
+        return PARSE_ERROR;
+    if (m_type == URLENCODED)
+    {
+        if (m_state != S_END && !end_pair())
+            return PARSE_ERROR;
+        m_state = S_END;
+        return PARSE_DONE;
+    }
+    if (m_state != S_END)
+        return fail("truncated multipart body");
+    return PARSE_DONE;
+}
+
+//在data中查找分隔符，之前的内容发给当前部分，返回消耗的字节数
+//分隔符可能跨块，已匹配的前缀先暂存在m_match中，确认不是分隔符后再补发
+size_t form_parser::scan(const char *data, size_t len)
+{
+    const char *delim = m_delim.data();
+    size_t i = 0;
+    while (i < len)
+    {
+        if (m_match == 0)
+        {
+            const char *cr = (const char *)memchr(data + i, '\r', len - i);
+            size_t run = cr ? cr - (data + i) : len - i;
+            if (run && !emit(data + i, run))
+                return len;
+            i += run;
+            if (!cr)
+                break;
+        }
+        if (data[i] == delim[m_match])
+        {
+            ++i;
+            if (++m_match == m_delim.size())
+            {
+                m_match = 0;
+                if (!end_part())
+                    return len;
+                m_after_len = 0;
+                m_state = S_AFTER;
+                return i;
+            }
+        }
+        else
+        {
+            //boundary中不含\r，暂存的前缀里不会再有分隔符的开头，整体补发后当前字节从头匹配
+            if (!emit(delim, m_match))
+                return len;
+            m_match = 0;
+        }
+    }
+    return i;
+}
+
+bool form_parser::emit(const char *data, size_t len)
+{
+    if (m_state == S_PREAMBLE)
+        return true;
+    if (!m_in_file)
+        return append(data, len);
+
+    m_cur.size += len;
+    if (m_file_used + len > FILE_BUF_SIZE && !flush_file())
+        return false;
+    if (len < FILE_BUF_SIZE)
+    {
+        memcpy(m_file_buf + m_file_used, data, len);
+        m_file_used += len;
+        return true;
+    }
+    //大块直接写，不经过缓冲
+    return write_file(data, len);
+}
+
+bool form_parser::flush_file()
+{
+    if (!write_file(m_file_buf, m_file_used))
+        return false;
+    m_file_used = 0;
+    return true;
+}
+
+//写入前先占用目录配额
+bool form_parser::write_file(const char *data, size_t len)
+{
+    if (m_quota && len > 0)
+    {
+        if (!m_quota->acquire_bytes(len))
+        {
+            fail("upload directory quota exceeded");
+            return false;
+        }
+        m_reserved += len;
+    }
+    if (!write_all(m_fd, data, len))
+    {
+        fail("write upload file failed");
+        return false;
+    }
+    return true;
+}
+
+//取出下一个"; key=value"参数，value可带引号；没有更多参数时返回false
+static bool next_param(const char *&p, const char *end, string &key, string &value)
+{
+    while (p < end && (*p == ';' || *p == ' ' || *p == '\t'))
+        ++p;
+    if (p >= end)
+        return false;
+    const char *k = p;
+    while (p < end && *p != '=' && *p != ';')
+        ++p;
+    const char *ke = p;
+    while (ke > k && (ke[-1] == ' ' || ke[-1] == '\t'))
+        --ke;
+    key.assign(k, ke - k);
+    value.clear();
+    if (p < end && *p == '=')
+    {
+        for (++p; p < end && (*p == ' ' || *p == '\t'); ++p)
+            ;
+        if (p < end && *p == '"')
+        {
+            for (++p; p < end && *p != '"'; ++p)
+            {
+                if (*p == '\\' && p + 1 < end)
+                    ++p;
+                value.push_back(*p);
+            }
+        }
+        else
+        {
+            const char *v = p;
+            while (p < end && *p != ';')
+                ++p;
+            const char *ve = p;
+            while (ve > v && (ve[-1] == ' ' || ve[-1] == '\t' || ve[-1] == '\r'))
+                --ve;
+            value.assign(v, ve - v);
+        }
+    }
+    while (p < end && *p != ';')
+        ++p;
+    return true;
+}
+
+bool form_parser::parse_boundary(const char *params, char *out, size_t cap)
+{
+    const char *p = params, *end = params + strlen(params);
+    string key, value;
+    while (next_param(p, end, key, value))
+    {
+        if (strcasecmp(key.c_str(), "boundary") != 0)
+            continue;
+        if (value.empty() || value.size() > BOUNDARY_LEN || value.size() >= cap ||
+            value.find_first_of("\r\n") != string::npos)
+            return false;
+        memcpy(out, value.data(), value.size());
+        out[value.size()] = '\0';
+        return true;
+    }
+    return false;
+}
+
+//保存文件名只保留客户端文件名的最后一段，且只含字母、数字和.-_
+static string safe_name(const string &name)
+{
+    size_t slash = name.find_last_of("/\\");
+    string base = slash == string::npos ? name : name.substr(slash + 1);
+    string out;
+    for (size_t i = 0; i < base.size() && out.size() < 64; ++i)
+    {
+        char c = base[i];
+        out.push_back(isalnum((unsigned char)c) || c == '.' || c == '-' || c == '_' ? c : '_');
+    }
+    if (out.empty() || out[0] == '.')
+        out.insert(0, "file");
+    return out;
+}
+
+bool form_parser::start_part()
+{
+    string name, filename;
+    bool has_filename = false;
+    size_t pos = 0;
+    while (pos < m_head.size())
+    {
+        size_t eol = m_head.find("\r\n", pos);
+        if (eol == string::npos)
+            eol = m_head.size();
+        if (eol - pos > 20 && strncasecmp(m_head.c_str() + pos, "Content-Disposition:", 20) == 0)
+        {
+            const char *p = m_head.c_str() + pos + 20, *end = m_head.c_str() + eol;
+            string key, value;
+            while (next_param(p, end, key, value))
+            {
+                if (strcasecmp(key.c_str(), "name") == 0)
+                    name = value;
+                else if (strcasecmp(key.c_str(), "filename") == 0)
+                {
+                    filename = value;
+                    has_filename = true;
+                }
+            }
+        }
+        pos = eol + 2;
+    }
+    if (name.empty())
+    {
+        fail("part without name");
+        return false;
+    }
+    if (m_fields.size() + m_files.size() >= MAX_FIELDS)
+    {
+        fail("too many fields");
+        return false;
+    }
+
+    m_state = S_DATA;
+    m_in_file = has_filename;
+    if (!m_in_file)
+    {
+        m_name_off = m_arena_used;
+        m_name_len = name.size();
+        if (!append(name.data(), name.size()))
+            return false;
+        m_value_off = m_arena_used;
+        return true;
+    }
+
+    if (m_dir.empty())
+    {
+        fail("file upload not allowed");
+        return false;
+    }
+    if (m_quota && !m_quota->acquire_file())
+    {
+        fail("upload directory is full");
+        return false;
+    }
+    m_reserved = 0;
+    if (!m_file_buf)
+        m_file_buf = (char *)malloc(FILE_BUF_SIZE);
+    mkdir(m_dir.c_str(), 0755);
+    m_tmp = m_dir + "/.part-XXXXXX";
+    m_fd = m_file_buf ? mkstemp(&m_tmp[0]) : -1;
+    if (m_fd < 0)
+    {
+        if (m_quota)
+            m_quota->release(0);
+        fail("create upload file failed");
+        return false;
+    }
+    m_cur.field = name;
+    m_cur.name = filename;
+    m_cur.size = 0;
+    m_file_used = 0;
+    return true;
+}
+
+bool form_parser::end_part()
+{
+    if (m_state == S_PREAMBLE)
+        return true;
+    if (!m_in_file)
+        return push_field(m_arena + m_name_off, m_name_len, m_arena + m_value_off, m_arena_used - m_value_off);
+    if (!flush_file())
+        return false;
+    if (!close_file(true))
+    {
+        fail("save upload file failed");
+        return false;
+    }
+    m_in_file = false;
+    return true;
+}
+
+//关闭当前的临时文件：keep为true时以临时文件名的随机后缀加客户端文件名保存，否则删除
+//保存用link而不是rename，已有同名文件时换名重试，不会覆盖
+bool form_parser::close_file(bool keep)
+{
+    if (m_fd < 0)
+        return false;
+    close(m_fd);
+    m_fd = -1;
+    bool saved = false;
+    if (keep)
+    {
+        string base = m_dir + "/" + m_tmp.substr(m_tmp.size() - 6) + "-" + safe_name(m_cur.name);
+        string path = base;
+        for (int i = 1; i < 100; ++i)
+        {
+            if (link(m_tmp.c_str(), path.c_str()) == 0)
+            {
+                saved = true;
+                break;
+            }
+            if (errno != EEXIST)
+                break;
+            char suffix[8];
+            snprintf(suffix, sizeof(suffix), ".%d", i);
+            path = base + suffix;
+        }
+        if (saved)
+        {
+            m_cur.path = path;
+            m_files.push_back(m_cur);
+        }
+    }
+    unlink(m_tmp.c_str());
+    if (m_quota && saved)
+        m_quota->commit(m_reserved);
+    else if (m_quota)
+        m_quota->release(m_reserved);
+    m_reserved = 0;
+    return saved;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+long form_parser::url_decode(const char *src, size_t len, char *out, size_t cap)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; ++i, ++n)
+    {
+        if (n >= cap)
+            return -1;
+        char c = src[i];
+        if (c == '+')
+            c = ' ';
+        else if (c == '%')
+        {
+            if (i + 2 >= len)
+                return -1;
+            int hi = hex_value(src[i + 1]), lo = hex_value(src[i + 2]);
+            if (hi < 0 || lo < 0 || (hi | lo) == 0)
+                return -1;
+            c = (char)(hi << 4 | lo);
+            i += 2;
+        }
+        out[n] = c;
+    }
+    return n;
+}
+
+bool form_parser::get(const char *name, char *out, size_t cap) const
+{
+    if (cap == 0)
+        return false;
+    size_t nlen = strlen(name);
+    for (size_t i = 0; i < m_fields.size(); ++i)
+    {
+        const field &f = m_fields[i];
+        if (m_type == URLENCODED)
+        {
+            char key[64];
+            long k = url_decode(f.name.data, f.name.len, key, sizeof(key));
+            if (k != (long)nlen || memcmp(key, name, nlen) != 0)
+                continue;
+            long v = url_decode(f.value.data, f.value.len, out, cap - 1);
+            if (v < 0)
+                return false;
+            out[v] = '\0';
+            return true;
+        }
+        if (f.name.len != nlen || memcmp(f.name.data, name, nlen) != 0)
+            continue;
+        if (f.value.len >= cap || memchr(f.value.data, '\0', f.value.len))
+            return false;
+        memcpy(out, f.value.data, f.value.len);
+        out[f.value.len] = '\0';
+        return true;
+    }
+    return false;
+}
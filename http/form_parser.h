@@ -0,0 +1,141 @@
+/*************************************************************
+*表单解析：支持application/x-www-form-urlencoded与multipart/form-data
+*消息体可以分块喂入，状态保存在解析器中，每块处理完后调用方即可复用读缓冲区
+*字段以视图(指针+长度)给出：整块解析urlencoded时直接指向消息体，不拷贝；分块解析时拷贝到有界的m_arena
+*multipart的文件部分经固定大小的写缓冲存入上传目录下的临时文件，结束后改名，内存占用与文件大小无关
+*给出upload_quota时，每个文件和每次写入先占用目录配额，超出时按格式错误结束
+**************************************************************/
+
+#ifndef FORM_PARSER_H
+#define FORM_PARSER_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class upload_quota;
+
+class form_parser
+{
+public:
+    static const size_t MAX_FIELDS = 32;        //字段与文件的个数上限
+    static const size_t ARENA_SIZE = 4096;      //分块解析时字段名和值的总长度上限
+    static const size_t HEADER_SIZE = 1024;     //multipart每个部分头部的长度上限
+    static const size_t FILE_BUF_SIZE = 16384;  //文件部分的写缓冲
+    static const size_t BOUNDARY_LEN = 70;      //RFC 2046规定的boundary最大长度
+
+    enum TYPE
+    {
+        URLENCODED = 0,
+        MULTIPART
+    };
+    enum STATUS
+    {
+        PARSE_MORE = 0,     //消息体未结束
+        PARSE_DONE,         //消息体解析完毕
+        PARSE_ERROR         //格式错误或超出限制，原因见error()
+    };
+
+    struct view
+    {
+        const char *data;
+        size_t len;
+    };
+    struct field
+    {
+        view name;
+        view value;         //urlencoded为未解码的原文，用get()取解码后的值
+    };
+    struct file
+    {
+        string field;       //表单字段名
+        string name;        //客户端给出的文件名
+        string path;        //保存路径
+        long size;
+    };
+
+    form_parser();
+    ~form_parser();
+
+    //开始解析新的消息体，boundary仅multipart使用；upload_dir为NULL时拒绝文件部分，quota为NULL时不限制
+    void begin(TYPE type, const char *boundary, const char *upload_dir, upload_quota *quota = NULL);
+    //整块消息体已在内存中，urlencoded的视图直接指向body，body需在取完字段前保持有效
+    STATUS parse(const char *body, size_t len);
+    //分块喂入消息体，返回后data即可复用
+    STATUS feed(const char *data, size_t len);
+    //消息体已全部喂入
+    STATUS finish();
+    //释放缓冲区，删除未完成的临时文件，已保存的文件不受影响
+    void reset();
+
+    //取第一个名为name的字段，urlencoded做%XX与+解码，结果以\0结尾写入out
+    //字段不存在、超出cap或编码错误时返回false
+    bool get(const char *name, char *out, size_t cap) const;
+    const vector<field> &fields() const { return m_fields; }
+    const vector<file> &files() const { return m_files; }
+    const char *error() const { return m_error; }
+
+    //URL解码，返回解码后的长度，编码错误、含%00或超出cap时返回-1
+    static long url_decode(const char *src, size_t len, char *out, size_t cap);
+    //从Content-Type的参数部分（如"; boundary=xxx"）取出boundary
+    static bool parse_boundary(const char *params, char *out, size_t cap);
+
+private:
+    enum STATE
+    {
+        S_KEY = 0,          //urlencoded：字段名
+        S_VALUE,            //urlencoded：字段值
+        S_PREAMBLE,         //multipart：第一个分隔符之前
+        S_AFTER,            //multipart：分隔符之后的\r\n或结尾的--
+        S_HEADERS,          //multipart：部分的头部
+        S_DATA,             //multipart：部分的内容
+        S_END,
+        S_ERROR
+    };
+
+    STATUS fail(const char *reason);
+    STATUS status() const;
+    void feed_urlencoded(const char *data, size_t len);
+    bool end_pair();
+    size_t scan(const char *data, size_t len);
+    bool emit(const char *data, size_t len);
+    bool start_part();
+    bool end_part();
+    bool push_field(const char *name, size_t name_len, const char *value, size_t value_len);
+    bool append(const char *data, size_t len);
+    bool flush_file();
+    bool write_file(const char *data, size_t len);
+    bool close_file(bool keep);
+
+    TYPE m_type;
+    STATE m_state;
+    const char *m_error;
+    vector<field> m_fields;
+    vector<file> m_files;
+
+    char *m_arena;              //分块解析时字段的存储，首次使用时分配
+    size_t m_arena_used;
+    size_t m_name_off;          //当前字段名在m_arena中的位置
+    size_t m_name_len;
+    size_t m_value_off;         //当前字段值在m_arena中的位置
+
+    string m_delim;             //分隔符"\r\n--boundary"
+    size_t m_match;             //已匹配、暂未发出的分隔符前缀长度
+    char m_after[2];
+    size_t m_after_len;
+    string m_head;              //当前部分的头部
+
+    string m_dir;               //上传目录，为空时拒绝文件部分
+    bool m_in_file;             //当前部分是否为文件
+    int m_fd;
+    string m_tmp;               //临时文件路径
+    char *m_file_buf;           //文件写缓冲，首次使用时分配
+    size_t m_file_used;
+    file m_cur;
+    upload_quota *m_quota;      //上传目录的配额，NULL时不限制
+    long m_reserved;            //当前文件已占用的配额字节数
+};
+
+#endif
@@ -0,0 +1,245 @@
+//表单解析的单元测试：URL解码、boundary参数、整块与分块的urlencoded、任意切分的multipart、上传配额
+//上传文件写在临时目录中，结束时删除
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include "form_parser.h"
+#include "upload_quota.h"
+#include "../test/check.h"
+
+using namespace std;
+
+static string read_file(const string &path)
+{
+    string out;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return out;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        out.append(buf, n);
+    close(fd);
+    return out;
+}
+
+//目录中的文件个数，.part-开头的临时文件单独计数
+static int count_files(const string &dir, int *parts)
+{
+    int n = 0;
+    *parts = 0;
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return 0;
+    while (struct dirent *e = readdir(d))
+    {
+        if (e->d_name[0] == '.' && strncmp(e->d_name, ".part-", 6) != 0)
+            continue;
+        if (strncmp(e->d_name, ".part-", 6) == 0)
+            ++*parts;
+        else
+            ++n;
+    }
+    closedir(d);
+    return n;
+}
+
+static void remove_files(const string &dir)
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return;
+    while (struct dirent *e = readdir(d))
+    {
+        if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0)
+            unlink((dir + "/" + e->d_name).c_str());
+    }
+    closedir(d);
+}
+
+static void test_url_decode()
+{
+    char out[16];
+    CHECK(form_parser::url_decode("a+b%41", 6, out, sizeof(out)) == 4 && memcmp(out, "a bA", 4) == 0);
+    CHECK(form_parser::url_decode("%7e", 3, out, sizeof(out)) == 1 && out[0] == '~');
+    CHECK(form_parser::url_decode("%zz", 3, out, sizeof(out)) == -1);
+    CHECK(form_parser::url_decode("%00", 3, out, sizeof(out)) == -1);
+    CHECK(form_parser::url_decode("a%4", 3, out, sizeof(out)) == -1);
+    CHECK(form_parser::url_decode("abcdef", 6, out, 5) == -1);
+    CHECK(form_parser::url_decode("", 0, out, sizeof(out)) == 0);
+}
+
+static void test_boundary()
+{
+    char b[80];
+    CHECK(form_parser::parse_boundary("; boundary=abc123", b, sizeof(b)) && strcmp(b, "abc123") == 0);
+    CHECK(form_parser::parse_boundary("; charset=utf-8; Boundary=\"x y\"", b, sizeof(b)) && strcmp(b, "x y") == 0);
+    CHECK(!form_parser::parse_boundary("; charset=utf-8", b, sizeof(b)));
+    CHECK(!form_parser::parse_boundary("; boundary=", b, sizeof(b)));
+    string longb = "; boundary=" + string(form_parser::BOUNDARY_LEN + 1, 'a');
+    CHECK(!form_parser::parse_boundary(longb.c_str(), b, sizeof(b)));
+    CHECK(!form_parser::parse_boundary("; boundary=abcdef", b, 4));
+}
+
+static void check_login_fields(const form_parser &p)
+{
+    char out[64];
+    CHECK(p.get("user", out, sizeof(out)) && strcmp(out, "al ice") == 0);
+    CHECK(p.get("password", out, sizeof(out)) && strcmp(out, "p+w=1") == 0);
+    CHECK(p.get("flag", out, sizeof(out)) && out[0] == '\0');
+    CHECK(!p.get("missing", out, sizeof(out)));
+    CHECK(!p.get("user", out, 4));
+    CHECK(p.fields().size() == 3);
+}
+
+static void test_urlencoded()
+{
+    const char body[] = "user=al+ice&password=p%2Bw%3D1&&flag";
+    size_t len = sizeof(body) - 1;
+
+    form_parser whole;
+    whole.begin(form_parser::URLENCODED, NULL, NULL);
+    CHECK(whole.parse(body, len) == form_parser::PARSE_DONE);
+    check_login_fields(whole);
+    //整块解析的视图直接指向消息体
+    CHECK(whole.fields()[0].value.data == body + 5);
+
+    //逐字节喂入，结果与整块解析相同
+    form_parser chunked;
+    chunked.begin(form_parser::URLENCODED, NULL, NULL);
+    for (size_t i = 0; i < len; ++i)
+        CHECK(chunked.feed(body + i, 1) == form_parser::PARSE_MORE);
+    CHECK(chunked.finish() == form_parser::PARSE_DONE);
+    check_login_fields(chunked);
+
+    //字段个数上限
+    string many;
+    for (size_t i = 0; i <= form_parser::MAX_FIELDS; ++i)
+        many += "k=v&";
+    form_parser p;
+    p.begin(form_parser::URLENCODED, NULL, NULL);
+    CHECK(p.parse(many.data(), many.size()) == form_parser::PARSE_ERROR);
+    CHECK(p.error() && strcmp(p.error(), "too many fields") == 0);
+
+    //分块解析时字段总长度上限
+    string big = "k=" + string(form_parser::ARENA_SIZE, 'x');
+    p.begin(form_parser::URLENCODED, NULL, NULL);
+    CHECK(p.feed(big.data(), big.size()) == form_parser::PARSE_ERROR);
+    CHECK(p.finish() == form_parser::PARSE_ERROR);
+}
+
+static string multipart_body(const string &boundary, const string &content)
+{
+    return "preamble\r\n--" + boundary + "\r\n"
+           "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+           "hello\r\n--" + boundary + "\r\n"
+           "Content-Disposition: form-data; name=\"upload\"; filename=\"../a b.txt\"\r\n"
+           "Content-Type: text/plain\r\n\r\n" +
+           content + "\r\n--" + boundary + "--\r\nepilogue";
+}
+
+static void test_multipart(const string &dir)
+{
+    const string boundary = "XyZ";
+    //内容中有分隔符的前缀，必须原样保存
+    const string content = "line1\r\n--Xy\r\n-\r\r\nend";
+    const string body = multipart_body(boundary, content);
+
+    //在每个位置切成两块喂入
+    for (size_t cut = 0; cut <= body.size(); ++cut)
+    {
+        form_parser p;
+        p.begin(form_parser::MULTIPART, boundary.c_str(), dir.c_str());
+        form_parser::STATUS s = p.feed(body.data(), cut);
+        if (s != form_parser::PARSE_ERROR)
+            s = p.feed(body.data() + cut, body.size() - cut);
+        CHECK(s == form_parser::PARSE_DONE);
+        CHECK(p.finish() == form_parser::PARSE_DONE);
+        char out[32];
+        CHECK(p.get("title", out, sizeof(out)) && strcmp(out, "hello") == 0);
+        CHECK(p.files().size() == 1);
+        if (p.files().size() == 1)
+        {
+            const form_parser::file &f = p.files()[0];
+            CHECK(f.field == "upload" && f.name == "../a b.txt");
+            CHECK(f.size == (long)content.size());
+            CHECK(read_file(f.path) == content);
+            //保存名只取文件名的最后一段，不会逃出上传目录
+            CHECK(f.path.compare(0, dir.size() + 1, dir + "/") == 0 && f.path.find("a_b.txt") != string::npos);
+        }
+    }
+    int parts;
+    CHECK(count_files(dir, &parts) == (int)body.size() + 1);
+    CHECK(parts == 0);
+    remove_files(dir);
+
+    //不允许上传时拒绝文件部分
+    form_parser p;
+    p.begin(form_parser::MULTIPART, boundary.c_str(), NULL);
+    CHECK(p.parse(body.data(), body.size()) == form_parser::PARSE_ERROR);
+    CHECK(p.error() && strcmp(p.error(), "file upload not allowed") == 0);
+
+    //消息体被截断时不保存文件，也不留下临时文件
+    p.begin(form_parser::MULTIPART, boundary.c_str(), dir.c_str());
+    CHECK(p.feed(body.data(), body.size() - 20) == form_parser::PARSE_MORE);
+    CHECK(p.finish() == form_parser::PARSE_ERROR);
+    p.reset();
+    CHECK(count_files(dir, &parts) == 0 && parts == 0);
+}
+
+static void test_quota(const string &dir)
+{
+    upload_quota *quota = upload_quota::GetInstance();
+    const string boundary = "b";
+    const string body = multipart_body(boundary, string(100, 'x'));
+
+    //配额足够时保存并计入已用量
+    quota->init(dir.c_str(), 1000, 10);
+    form_parser p;
+    p.begin(form_parser::MULTIPART, boundary.c_str(), dir.c_str(), quota);
+    CHECK(p.parse(body.data(), body.size()) == form_parser::PARSE_DONE);
+    CHECK(quota->bytes() == 100 && quota->files() == 1);
+
+    //超出字节配额时失败，占用的配额全部归还
+    quota->init(dir.c_str(), 150, 10);
+    p.begin(form_parser::MULTIPART, boundary.c_str(), dir.c_str(), quota);
+    CHECK(p.parse(body.data(), body.size()) == form_parser::PARSE_ERROR);
+    CHECK(p.error() && strcmp(p.error(), "upload directory quota exceeded") == 0);
+    CHECK(quota->bytes() == 100 && quota->files() == 1);
+
+    //文件个数已满
+    quota->init(dir.c_str(), 0, 1);
+    p.begin(form_parser::MULTIPART, boundary.c_str(), dir.c_str(), quota);
+    CHECK(p.parse(body.data(), body.size()) == form_parser::PARSE_ERROR);
+    CHECK(p.error() && strcmp(p.error(), "upload directory is full") == 0);
+    CHECK(quota->files() == 1);
+    p.reset();
+    int parts;
+    CHECK(count_files(dir, &parts) == 1 && parts == 0);
+    remove_files(dir);
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/form_parser_test.XXXXXX";
+    if (!mkdtemp(tmpl))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    string dir = tmpl;
+
+    test_url_decode();
+    test_boundary();
+    test_urlencoded();
+    test_multipart(dir);
+    test_quota(dir);
+
+    remove_files(dir);
+    rmdir(dir.c_str());
+    return check_report("form_parser_test");
+}
@@ -2,6 +2,8 @@
 
 #include <mysql/mysql.h>
 #include <fstream>
+#include <atomic>
+#include <sys/time.h>
 
 //定义http响应的一些状态信息
 const char *ok_200_title = "OK";
@@ -13,10 +15,14 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form = "The server is too busy to handle the request, please try again later.\n";
+
+//上传的文件保存在网站根目录之外，不会被当作静态资源直接访问
+const char *http_conn::UPLOAD_DIR = "./upload";
 
 //全局变量
-locker m_lock;              
-map<string, string> users;
+user_table *users = user_table::GetInstance();  //用户名到密码的并发哈希表，登录查询无锁
 
 //全局函数
 
@@ -68,38 +74,112 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode)
 }
 
 //静态变量
-int http_conn::m_user_count = 0;
+std::atomic<int> http_conn::m_user_count(0);
 int http_conn::m_epollfd = -1;
+bulkhead<http_conn> *http_conn::m_db_pool = NULL;
+bulkhead<http_conn> *http_conn::m_hash_pool = NULL;
+
+//后台加载用户表
+static const int LOAD_BATCH = 10000;            //每加载这么多行检查一次停止标志并记录进度
+static pthread_t load_tid;
+static bool load_started = false;
+static std::atomic<bool> load_stop(false);
 
-void http_conn::initmysql_result(connection_pool* connPool)
+//从一个分片的user表流式加载，读取完整时返回true
+static bool load_shard(connection_pool *connPool, long long &rows)
 {
+    int m_close_log = connPool->m_close_log;        //供LOG_*宏使用
+
     //先从连接池中取一个连接
-    MYSQL* mysql = NULL;
+    MYSQL *mysql = NULL;
     //用RAII机制管理资源
     connectionRAII mysqlcon(&mysql, connPool);
+    if (!mysql)                     //数据库暂不可用，登录时回退到逐条查询
+    {
+        LOG_ERROR("load user table from %s:%d: no mysql connection", connPool->m_url.c_str(), connPool->m_Port);
+        return false;
+    }
 
     //在user表中检索username，passwd数据，浏览器端输入
     if (mysql_query(mysql, "SELECT username,passwd FROM user"))
     {
         LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+        return false;
     }
 
-    //从表中检索完整的结果集
-    MYSQL_RES* result = mysql_store_result(mysql);
+    //逐行从服务端读取结果，不在客户端缓存完整结果集，内存占用与表大小无关
+    MYSQL_RES *result = mysql_use_result(mysql);
+    if (!result)
+    {
+        LOG_ERROR("load user table error:%s", mysql_error(mysql));
+        return false;
+    }
 
-    //返回结果集中的列数
-    int num_fields = mysql_num_fields(result);
+    //从结果集中获取下一行，存入用户表；加载期间注册或回查到的用户更新，不被覆盖
+    while (MYSQL_ROW row = mysql_fetch_row(result))
+    {
+        if (row[0] && row[1])
+            users->insert(row[0], row[1]);
+        if (++rows % LOAD_BATCH == 0)
+        {
+            if (load_stop.load(std::memory_order_relaxed))
+                break;
+            LOG_INFO("load user table: %lld rows", rows);
+        }
+    }
+    bool complete = !load_stop.load(std::memory_order_relaxed) && mysql_errno(mysql) == 0;
+    if (!complete && mysql_errno(mysql))
+        LOG_ERROR("load user table error:%s", mysql_error(mysql));
+    mysql_free_result(result);
+    return complete;
+}
 
-    //返回所有字段结构的数组
-    MYSQL_FIELD* fields = mysql_fetch_fields(result);
+static void *load_users(void *arg)
+{
+    int m_close_log = connection_pool::GetInstance()->m_close_log;     //供LOG_*宏使用
+    mysql_thread_init();
+    struct timeval begin, end;
+    gettimeofday(&begin, NULL);
+
+    //依次读取每个分片，优先从副本读
+    sql_shard_map *shards = sql_shard_map::GetInstance();
+    long long rows = 0;
+    bool complete = true;
+    for (int i = 0; i < shards->count() && !load_stop.load(std::memory_order_relaxed); ++i)
+        complete = load_shard(shards->shard(i)->reader(NULL), rows) && complete;
+    complete = complete && !load_stop.load(std::memory_order_relaxed);
+
+    gettimeofday(&end, NULL);
+    if (complete)
+    {
+        users->set_loaded(true);
+        LOG_INFO("load user table: %lld rows from %d shards in %ldms, %zu bytes", rows, shards->count(),
+                 (end.tv_sec - begin.tv_sec) * 1000 + (end.tv_usec - begin.tv_usec) / 1000, users->memory_usage());
+    }
+    mysql_thread_end();
+    return NULL;
+}
 
-    //从结果集中获取下一行，将对应的用户名和密码，存入map中
-    while (MYSQL_ROW row = mysql_fetch_row(result))
+void http_conn::initmysql_result()
+{
+    if (load_started)
+        return;
+    load_stop.store(false);
+    if (pthread_create(&load_tid, NULL, load_users, NULL) != 0)
     {
-        string temp1(row[0]);
-        string temp2(row[1]);
-        users[temp1] = temp2;
+        LOG_ERROR("%s", "create user table loader failed");
+        return;
     }
+    load_started = true;
+}
+
+void http_conn::stop_load()
+{
+    if (!load_started)
+        return;
+    load_stop.store(true);
+    pthread_join(load_tid, NULL);
+    load_started = false;
 }
 
 //关闭连接，关闭一个连接，客户总量减一
@@ -108,9 +188,12 @@ void http_conn::close_conn(bool real_close)
     if (real_close && (m_sockfd != -1))
     {
         printf("close %d\n", m_sockfd);
+        PROBE1(close, m_sockfd);
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
+        m_form.reset();                     //删除未传完的上传文件
         m_user_count--;
+        metrics::add(metrics::CONN_CLOSED);
     }
 }
 
@@ -123,6 +206,8 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 
     addfd(m_epollfd, sockfd, true, m_TRIGMode);
     m_user_count++;
+    metrics::add(metrics::CONN_ACCEPTED);
+    PROBE3(accept, sockfd, addr.sin_addr.s_addr, addr.sin_port);
 
     //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
     doc_root = root;
@@ -134,13 +219,13 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
     strcpy(sql_name, sqlname.c_str());
 
     init();
+    m_trace.mark(req_trace::ACCEPT);
 }
 
 //初始化新接受的连接
 //check_state默认为分析请求行状态
 void http_conn::init()
 {
-    mysql = NULL;
     bytes_to_send = 0;
     bytes_have_send = 0;
     m_check_state = CHECK_STATE_REQUESTLINE;
@@ -155,6 +240,30 @@ void http_conn::init()
     m_read_idx = 0;
     m_write_idx = 0;
     cgi = 0;
+    m_string = 0;
+    m_form.reset();
+    m_form_type = form_parser::URLENCODED;
+    m_boundary[0] = '\0';
+    m_body_stream = false;
+    m_body_read = 0;
+    m_db_stage = false;
+    m_db_done = false;
+    m_form_ok = false;
+    m_cookie_sid[0] = '\0';
+    m_new_sid[0] = '\0';
+    m_session_user.clear();
+    m_end_session = false;
+    m_passwd_hash.clear();
+    m_auth_done = false;
+    m_auth_ok = false;
+    m_hash_job = HASH_PASSWORD;
+    m_start_us = 0;
+    m_trace.reset();
+    m_status = 0;
+    m_route = metrics::ROUTE_BAD;
+    m_access_path[0] = '\0';
+    m_referer[0] = '\0';
+    m_agent[0] = '\0';
     m_state = 0;
     timer_flag = 0;
     improv = 0;
@@ -209,6 +318,11 @@ bool http_conn::read_once()
         return false;
     }
     int bytes_read = 0;
+    if (!m_start_us && (access_log::GetInstance()->enabled() || metrics::enabled() || req_tracer::enabled()))
+    {
+        m_start_us = pool_stats::now_us();
+        m_trace.mark(req_trace::FIRST_BYTE);
+    }
 
     //LT读取数据
     if (0 == m_TRIGMode)
@@ -218,8 +332,11 @@ bool http_conn::read_once()
 
         if (bytes_read <= 0)
         {
+            PROBE3(read, m_sockfd, m_read_idx, 0);
             return false;
         }
+        metrics::add(metrics::BYTES_READ, bytes_read);
+        PROBE3(read, m_sockfd, m_read_idx, 1);
 
         return true;
     }
@@ -233,14 +350,20 @@ bool http_conn::read_once()
             {
                 if (errno == EAGAIN || errno == EWOULDBLOCK)        //读至没有数据可读
                     break;
+                PROBE3(read, m_sockfd, m_read_idx, 0);
                 return false;
             }
             else if (bytes_read == 0)
             {
+                PROBE3(read, m_sockfd, m_read_idx, 0);
                 return false;
             }
             m_read_idx += bytes_read;
+            metrics::add(metrics::BYTES_READ, bytes_read);
+            if (m_read_idx >= READ_BUFFER_SIZE)     //缓冲区已满，处理完消息体后重新注册EPOLLIN时会再次触发
+                break;
         }
+        PROBE3(read, m_sockfd, m_read_idx, 1);
         return true;
     }
 }
@@ -293,6 +416,9 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
 
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
+    m_route = metrics::route_of(m_url);
+    if (access_log::GetInstance()->enabled() || req_tracer::enabled())
+        snprintf(m_access_path, sizeof(m_access_path), "%s", m_url);
     //当url为/时，显示判断界面
     if (strlen(m_url) == 1)
         strcat(m_url, "judge.html");
@@ -305,8 +431,27 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
 {
     if (text[0] == '\0')                                //判断是空头还是请求头，空头需要改变状态机状态
     {
+        m_trace.mark(req_trace::HEADER_DONE);
+        resolve_session();
         if (m_content_length != 0)                      //具体判断是get请求还是post请求
         {
+            if (m_content_length < 0 || m_content_length > MAX_BODY_SIZE)
+                return BAD_REQUEST;
+            //只有已登录用户的上传请求接受文件，并受上传目录配额限制
+            //未登录的上传不读消息体，直接响应登录页并关闭连接
+            const char *p = strrchr(m_url, '/');
+            bool upload = *(p + 1) == '8';
+            if (upload && m_session_user.empty())
+            {
+                LOG_WARN("upload without a session rejected, %ld bytes", m_content_length);
+                m_linger = false;
+                return GET_REQUEST;
+            }
+            m_form.begin(m_form_type, m_boundary, upload ? UPLOAD_DIR : NULL, upload ? upload_quota::GetInstance() : NULL);
+            //消息体末尾要补\0，剩余空间放不下时边读边解析
+            m_body_stream = m_form_type == form_parser::MULTIPART || m_content_length >= READ_BUFFER_SIZE - m_checked_idx;
+            if (m_body_stream && READ_BUFFER_SIZE - m_checked_idx < MIN_BODY_ROOM)
+                return BAD_REQUEST;
             m_check_state = CHECK_STATE_CONTENT;        //post请求需要改变主状态机的状态
             return NO_REQUEST;
         }
@@ -327,12 +472,52 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         text += strspn(text, " \t");
         m_content_length = atol(text);                          //atol(const char*str)：将str所指的字符串转换为一个long int的长整数
     }
+    else if (strncasecmp(text, "Content-Type:", 13) == 0)       //multipart表单需要取出分隔符
+    {
+        text += 13;
+        text += strspn(text, " \t");
+        if (strncasecmp(text, "multipart/form-data", 19) == 0)
+        {
+            if (!form_parser::parse_boundary(text + 19, m_boundary, sizeof(m_boundary)))
+                return BAD_REQUEST;
+            m_form_type = form_parser::MULTIPART;
+        }
+    }
     else if (strncasecmp(text, "Host:", 5) == 0)                //解析请求头部host字段
     {
         text += 5;
         text += strspn(text, " \t");
         m_host = text;
     }
+    else if (strncasecmp(text, "Cookie:", 7) == 0)              //解析Cookie中的会话令牌sid
+    {
+        text += 7;
+        while (*text)
+        {
+            text += strspn(text, " \t;");
+            size_t len = strcspn(text, ";");
+            if (strncmp(text, "sid=", 4) == 0 && len - 4 == (size_t)session_store::TOKEN_LEN)
+            {
+                memcpy(m_cookie_sid, text + 4, session_store::TOKEN_LEN);
+                m_cookie_sid[session_store::TOKEN_LEN] = '\0';
+            }
+            text += len;
+        }
+    }
+    else if (strncasecmp(text, "Referer:", 8) == 0)             //访问日志需要时记下Referer和User-Agent
+    {
+        text += 8;
+        text += strspn(text, " \t");
+        if (access_log::GetInstance()->want_headers())
+            snprintf(m_referer, sizeof(m_referer), "%s", text);
+    }
+    else if (strncasecmp(text, "User-Agent:", 11) == 0)
+    {
+        text += 11;
+        text += strspn(text, " \t");
+        if (access_log::GetInstance()->want_headers())
+            snprintf(m_agent, sizeof(m_agent), "%s", text);
+    }
     else
     {
         LOG_INFO("oop!unknow header: %s", text);
@@ -340,14 +525,32 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
     return NO_REQUEST;
 }
 
-//判断http请求是否被完整读入
+//判断http请求是否被完整读入，并解析表单
+//边读边解析时把已读到的部分交给解析器，之后读缓冲区从消息体起始处重新使用
 http_conn::HTTP_CODE http_conn::parse_content(char *text)
 {
+    if (m_body_stream)
+    {
+        long n = m_read_idx - m_checked_idx;
+        if (n > m_content_length - m_body_read)
+            n = m_content_length - m_body_read;
+        if (m_form.feed(text, n) == form_parser::PARSE_ERROR)
+            return BAD_REQUEST;
+        m_body_read += n;
+        m_read_idx = m_checked_idx;
+        if (m_body_read < m_content_length)
+            return NO_REQUEST;
+        return m_form.finish() == form_parser::PARSE_DONE ? GET_REQUEST : BAD_REQUEST;
+    }
+
     if (m_read_idx >= (m_content_length + m_checked_idx))
     {
         text[m_content_length] = '\0';
         //POST请求中最后为输入的用户名和密码
         m_string = text;        //用户名和密码
+        //整块解析，字段直接指向读缓冲区
+        if (m_form.parse(text, m_content_length) == form_parser::PARSE_ERROR)
+            return BAD_REQUEST;
         return GET_REQUEST;
     }
     return NO_REQUEST;
@@ -366,7 +569,10 @@ http_conn::HTTP_CODE http_conn::process_read()
     {
         text = get_line();              // 获取一行的字符，从状态机已经将每一行末尾的“\r”、“\n”符号改为“\0”。
         m_start_line = m_checked_idx;   // 更新下一行的起始位置
-        LOG_INFO("%s", text);
+        if (!m_body_stream)             // 分块的消息体不以\0结尾，也可能是二进制文件
+        {
+            LOG_INFO("%s", text);
+        }
         switch (m_check_state)                      //三种状态转换逻辑
         {
             case CHECK_STATE_REQUESTLINE:           //正在分析请求行
@@ -392,6 +598,12 @@ http_conn::HTTP_CODE http_conn::process_read()
                 ret = parse_content(text);
                 if (ret == GET_REQUEST)             //post请求，跳转到报文响应函数
                     return do_request();
+                if (ret == BAD_REQUEST)             //消息体没有读完，不能再复用连接
+                {
+                    LOG_WARN("bad request body: %s", m_form.error() ? m_form.error() : "malformed");
+                    m_linger = false;
+                    return BAD_REQUEST;
+                }
                 line_status = LINE_OPEN;            //更新，跳出循环，代表解析完了消息体
                 break;
             }
@@ -402,6 +614,168 @@ http_conn::HTTP_CODE http_conn::process_read()
     return NO_REQUEST;
 }
 
+//将表单中的用户名和密码解码到m_form_user、m_form_passwd
+//字段顺序不限，缺少字段、超出缓冲区长度或编码错误的表单按失败处理
+void http_conn::parse_user_form()
+{
+    m_form_ok = m_form.get("user", m_form_user, sizeof(m_form_user)) &&
+                m_form.get("password", m_form_passwd, sizeof(m_form_passwd));
+    if (!m_form_ok)
+    {
+        m_form_user[0] = '\0';
+        m_form_passwd[0] = '\0';
+    }
+}
+
+//注册，先检测是否有重名的，没有重名的，进行增加数据
+//异步数据库返回结果后再次进入时，直接使用m_db_result
+void http_conn::do_register()
+{
+    const char *name = m_form_user;
+    if (!m_form_ok || (!m_db_done && users->contains(name)))
+    {
+        strcpy(m_url, "/registerError.html");
+        return;
+    }
+    //启用密码哈希时保存哈希，哈希通常已在哈希执行器中算好
+    if (password_hasher::GetInstance()->enabled() && m_passwd_hash.empty() &&
+        !password_hasher::GetInstance()->hash(m_form_passwd, m_passwd_hash))
+    {
+        strcpy(m_url, "/registerError.html");
+        return;
+    }
+    const char *password = stored_passwd();
+
+    sql_stmt::RESULT res = sql_stmt::SQL_ERROR;
+    if (m_db_done)
+    {
+        res = (sql_stmt::RESULT)m_db_result;
+        if (res == sql_stmt::SQL_OK)
+            users->insert(name, password);
+    }
+    else
+    {
+        //只在执行语句期间占用数据库连接，连接池大小只限制数据库并发；写操作走主库
+        req_trace::db_span span(m_trace);
+        MYSQL *mysql = NULL;
+        connectionRAII mysqlcon(&mysql, sql_shard_map::GetInstance()->route(name)->writer());
+        span.acquired();
+        if (mysql)
+        {
+            //不加全局锁：用户名上的唯一键保证并发注册同一用户名时只有一条成功，其余返回重名
+            //没有唯一键时(未执行user/username_unique.sql)由insert_user在本进程内按用户名串行化
+            res = sql_stmt::insert_user(mysql, name, password);    //预编译语句插入，参数绑定
+            if (res == sql_stmt::SQL_OK)
+                users->insert(name, password);                      //写操作只锁哈希表的一个分片
+            if (res == sql_stmt::SQL_ERROR)
+                LOG_ERROR("INSERT error:%s", mysql_error(mysql));
+        }
+        else
+            LOG_ERROR("%s", "get mysql connection failed");
+    }
+
+    if (res == sql_stmt::SQL_OK)            //注册成功
+    {
+        sql_shard_map::GetInstance()->route(name)->note_write(name);   //副本追上之前该用户的回查读主库
+        strcpy(m_url, "/log.html");
+    }
+    else
+        strcpy(m_url, "/registerError.html");
+}
+
+//登录，若浏览器端输入的用户名和密码在表中可以查找到则成功
+//启用密码哈希时，取得保存的哈希后返回true，由哈希执行器校验后再次进入
+bool http_conn::do_login()
+{
+    const char *name = m_form_user, *password = m_form_passwd;
+    bool ok = false;
+    if (m_auth_done)                        //哈希执行器已完成校验
+        ok = m_auth_ok;
+    else if (m_form_ok)
+    {
+        string stored;
+        bool found = users->find(name, stored);
+        //内存中没有该用户（例如由其他实例注册），回查数据库
+        if (!found)
+        {
+            sql_stmt::RESULT res = sql_stmt::SQL_ERROR;
+            if (m_db_done)
+            {
+                res = (sql_stmt::RESULT)m_db_result;
+                stored = m_db_passwd;
+            }
+            else
+            {
+                //读用户所在分片的副本，副本出错时摘除它并改读主库
+                sql_cluster *cluster = sql_shard_map::GetInstance()->route(name);
+                connection_pool *pool = cluster->reader(name);
+                {
+                    req_trace::db_span span(m_trace);
+                    MYSQL *mysql = NULL;
+                    connectionRAII mysqlcon(&mysql, pool);
+                    span.acquired();
+                    if (mysql)
+                        res = sql_stmt::query_passwd(mysql, name, stored);
+                }
+                if (res == sql_stmt::SQL_ERROR && pool != cluster->writer())
+                {
+                    cluster->report_failure(pool);
+                    req_trace::db_span span(m_trace);
+                    MYSQL *mysql = NULL;
+                    connectionRAII mysqlcon(&mysql, cluster->writer());
+                    span.acquired();
+                    if (mysql)
+                        res = sql_stmt::query_passwd(mysql, name, stored);
+                }
+            }
+            if (res == sql_stmt::SQL_OK)
+            {
+                users->set(name, stored.c_str());
+                found = true;
+            }
+        }
+        if (found && password_hasher::GetInstance()->enabled())
+        {
+            m_db_passwd = stored;
+            return true;
+        }
+        ok = found && password_hasher::GetInstance()->verify(password, stored.c_str());
+    }
+    if (ok)
+    {
+        //建立会话，之后的登录请求凭Cookie直接通过
+        session_store::GetInstance()->create(name, m_new_sid);
+        strcpy(m_url, "/welcome.html");
+    }
+    else
+        strcpy(m_url, "/logError.html");
+    return false;
+}
+
+void http_conn::resolve_session()
+{
+    m_session_user.clear();
+    if (m_cookie_sid[0] && !session_store::GetInstance()->find(m_cookie_sid, m_session_user))
+        m_session_user.clear();
+}
+
+//表单为空或与会话是同一用户时才使用会话，换用户登录仍校验密码
+bool http_conn::check_session()
+{
+    if (m_session_user.empty())
+        return false;
+    parse_user_form();
+    return !m_form_ok || m_session_user == m_form_user;
+}
+
+//未启用会话时无法识别用户，这些页面按原来的方式直接访问
+bool http_conn::login_required(char route) const
+{
+    if (route < '5' || route > '8')
+        return false;
+    return session_store::GetInstance()->enabled() && m_session_user.empty();
+}
+
 http_conn::HTTP_CODE http_conn::do_request()
 {
     //doc_root初始化时设定
@@ -411,11 +785,16 @@ http_conn::HTTP_CODE http_conn::do_request()
     const char *p = strrchr(m_url, '/');                //找到m_url中“/”的位置
 
     //处理cgi
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
+    if (cgi == 1 && *(p + 1) == '2' && check_session())
     {
-
-        //根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
+        //会话有效，不再解析表单、校验密码或访问数据库
+        strcpy(m_url, "/welcome.html");
+    }
+    else if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
+    {
+        //登录/注册需要访问数据库，先交给数据库执行器，避免阻塞处理静态请求的线程
+        if (!m_db_stage && m_db_pool)
+            return DB_REQUEST;
 
         char *m_url_real = (char *)malloc(sizeof(char) * 200);
         strcpy(m_url_real, "/");
@@ -426,59 +805,25 @@ http_conn::HTTP_CODE http_conn::do_request()
         free(m_url_real);
 
         //将用户名和密码提取出来
-        //user=123  &  passwd=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
+        parse_user_form();
 
         if (*(p + 1) == '3')
-        {
-            //如果是注册，先检测数据库中是否有重名的
-            //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end())                //说明库中没有重名
-            {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);                   //在数据库中插入数据
-                users.insert(pair<string, string>(name, password));         //操作user，共享资源，加锁
-                m_lock.unlock();
-
-                if (!res)                               //注册成功
-                    strcpy(m_url, "/log.html");         
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
-        }
-        //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2')
-        {
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/logError.html");
-        }
+            do_register();
+        else if (*(p + 1) == '2' && do_login())
+            return HASH_REQUEST;            //交给哈希执行器校验密码
     }
 
 
 
-    if (*(p + 1) == '0')                            //如果请求资源为/0，表示跳转注册界面
+    if (login_required(*(p + 1)))                   //未登录时访问需要登录的页面，转到登录页
+    {
+        char *m_url_real = (char *)malloc(sizeof(char) * 200);
+        strcpy(m_url_real, "/log.html");
+        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+
+        free(m_url_real);
+    }
+    else if (*(p + 1) == '0')                       //如果请求资源为/0，表示跳转注册界面
     {
         char *m_url_real = (char *)malloc(sizeof(char) * 200);
         strcpy(m_url_real, "/register.html");
@@ -518,6 +863,34 @@ http_conn::HTTP_CODE http_conn::do_request()
 
         free(m_url_real);
     }
+    else if (*(p + 1) == '8')                       //上传页面，POST时文件已在解析消息体时保存
+    {
+        const vector<form_parser::file> &files = m_form.files();
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            LOG_INFO("upload %s: %s -> %s (%ld bytes)", files[i].field.c_str(), files[i].name.c_str(),
+                     files[i].path.c_str(), files[i].size);
+        }
+
+        char *m_url_real = (char *)malloc(sizeof(char) * 200);
+        strcpy(m_url_real, "/upload.html");
+        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+
+        free(m_url_real);
+    }
+    else if (*(p + 1) == '9')                       //退出登录：删除会话并让浏览器清除Cookie，之后转到登录页
+    {
+        if (!m_session_user.empty())
+            session_store::GetInstance()->remove(m_cookie_sid);
+        m_session_user.clear();
+        m_end_session = true;
+
+        char *m_url_real = (char *)malloc(sizeof(char) * 200);
+        strcpy(m_url_real, "/log.html");
+        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+
+        free(m_url_real);
+    }
     else
         strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
 
@@ -567,14 +940,18 @@ bool http_conn::write()
         {
             if (errno == EAGAIN)                                        //判断缓冲区是否已满
             {
+                m_trace.mark(req_trace::WRITE_BLOCKED);
                 modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);       //重新注册写事件，等待下一次触发
                 return true;
             }
             unmap();                                                    //发送失败，但不是缓冲区问题，取消映射
+            PROBE4(write, m_sockfd, bytes_have_send, m_status, 0);
+            finish_request();
             return false;
         }
 
         bytes_have_send += temp;                                        //更新已发送字节数
+        metrics::add(metrics::BYTES_WRITTEN, temp);
         bytes_to_send -= temp;
         //调整iovec中的指针和长度
         if (bytes_have_send >= m_iv[0].iov_len)                         //第一个iovec信息的数据已发送完，发送第二个iovec数据
@@ -592,6 +969,8 @@ bool http_conn::write()
         if (bytes_to_send <= 0)                                             //判断条件，数据已全部发送完
         {
             unmap();
+            PROBE4(write, m_sockfd, bytes_have_send, m_status, 1);
+            finish_request();
             modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);                //在epoll树上重置EPOLLONESHOT事件
 
             if (m_linger)                                                   //浏览器的请求为长连接
@@ -607,6 +986,39 @@ bool http_conn::write()
     }
 }
 
+//每个请求只记录一次，没有读到请求的连接不记录
+void http_conn::finish_request()
+{
+    static const char *methods[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH"};
+    access_log *log = access_log::GetInstance();
+    if (!m_start_us)
+        return;
+    long long latency_us = pool_stats::now_us() - m_start_us;
+    m_start_us = 0;
+    metrics::observe(m_route, m_status, latency_us);
+    if (req_tracer::enabled())
+    {
+        m_trace.mark(req_trace::LAST_BYTE);
+        req_tracer::GetInstance()->finish(m_trace, m_sockfd, m_access_path[0] ? methods[m_method] : NULL, m_access_path, m_status);
+    }
+    int weight = log->sample(m_status, latency_us);
+    if (!weight)
+        return;
+    char client[INET_ADDRSTRLEN];
+    if (!inet_ntop(AF_INET, &m_address.sin_addr, client, sizeof(client)))
+        client[0] = '\0';
+    access_record r;
+    r.client = client;
+    r.method = m_access_path[0] ? methods[m_method] : NULL;
+    r.path = m_access_path;
+    r.referer = m_referer;
+    r.agent = m_agent;
+    r.status = m_status;
+    r.bytes = bytes_have_send;
+    r.latency_us = latency_us;
+    log->write(r, weight);
+}
+
 bool http_conn::add_response(const char *format, ...)
 {
     if (m_write_idx >= WRITE_BUFFER_SIZE)
@@ -628,12 +1040,13 @@ bool http_conn::add_response(const char *format, ...)
 }
 bool http_conn::add_status_line(int status, const char *title)
 {
+    m_status = status;
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 bool http_conn::add_headers(int content_len)
 {
     return add_content_length(content_len) && add_linger() &&
-           add_blank_line();
+           add_session_cookie() && add_blank_line();
 }
 bool http_conn::add_content_length(int content_len)
 {
@@ -647,6 +1060,15 @@ bool http_conn::add_linger()
 {
     return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
 }
+bool http_conn::add_session_cookie()
+{
+    if (m_end_session)
+        return add_response("%s", "Set-Cookie:sid=; Path=/; Max-Age=0; HttpOnly\r\n");
+    if (!m_new_sid[0])
+        return true;
+    return add_response("Set-Cookie:sid=%s; Path=/; Max-Age=%d; HttpOnly\r\n", m_new_sid,
+                        session_store::GetInstance()->ttl());
+}
 bool http_conn::add_blank_line()
 {
     return add_response("%s", "\r\n");
@@ -676,6 +1098,14 @@ bool http_conn::process_write(HTTP_CODE ret)
             return false;
         break;
     }
+    case SERVICE_UNAVAILABLE:                           //执行器繁忙，503
+    {
+        add_status_line(503, error_503_title);
+        add_headers(strlen(error_503_form));
+        if (!add_content(error_503_form))
+            return false;
+        break;
+    }
     case FORBIDDEN_REQUEST:                             //资源没有访问权限，403
     {
         add_status_line(403, error_403_title);
@@ -720,16 +1150,189 @@ void http_conn::process()
 {
     // 解析请求报文
     HTTP_CODE read_ret = process_read();
-    
+    if (read_ret != NO_REQUEST)
+        PROBE3(parse, m_sockfd, read_ret, m_url);
+
     // 表示请求不完整，需要继续接收请求数据
     if (read_ret == NO_REQUEST)
     {
+        m_trace.mark(req_trace::READ_MORE);
         modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);    //重新注册epollin事件，服务器主线程检测读事件，并重置oneshot事件
         return;
     }
 
+    if (read_ret == DB_REQUEST)
+    {
+        //需要计算密码哈希的请求先交给哈希执行器
+        if (!start_hash())
+            dispatch_db();
+        return;
+    }
+
+    complete(read_ret);
+}
+
+//访问数据库的请求优先提交给异步数据库层，否则转交数据库执行器，其队列满时直接返回503
+void http_conn::dispatch_db()
+{
+    if (start_async_db())
+        return;
+    if (m_db_pool->append(this))
+        return;
+    complete(SERVICE_UNAVAILABLE);
+}
+
+bool http_conn::start_hash()
+{
+    if (!password_hasher::GetInstance()->enabled() || !m_hash_pool)
+        return false;
+
+    parse_user_form();
+    if (!m_form_ok)
+        return false;
+    const char *p = strrchr(m_url, '/');
+    if (*(p + 1) == '3' && !users->contains(m_form_user))
+        m_hash_job = HASH_PASSWORD;         //注册：先算出哈希再写数据库
+    else if (*(p + 1) == '2' && users->find(m_form_user, m_db_passwd))
+        m_hash_job = HASH_VERIFY;           //登录且内存中有该用户：直接校验，不经过数据库
+    else
+        return false;
+
+    if (!m_hash_pool->append(this))
+        complete(SERVICE_UNAVAILABLE);
+    return true;
+}
+
+void http_conn::process_hash()
+{
+    password_hasher *hasher = password_hasher::GetInstance();
+    if (m_hash_job == HASH_PASSWORD)
+    {
+        if (!hasher->hash(m_form_passwd, m_passwd_hash))
+        {
+            complete(INTERNAL_ERROR);
+            return;
+        }
+        dispatch_db();
+        return;
+    }
+
+    m_auth_ok = hasher->verify(m_form_passwd, m_db_passwd.c_str());
+    if (m_auth_ok && hasher->needs_rehash(m_db_passwd.c_str()))
+        rehash_passwd();
+    m_auth_done = true;
+    m_db_stage = true;
+    complete(do_request());
+}
+
+//旧的明文记录在登录成功后改存为哈希；按原明文条件更新，失败时保留原记录，下次登录再试
+void http_conn::rehash_passwd()
+{
+    string hashed;
+    if (!password_hasher::GetInstance()->hash(m_form_passwd, hashed))
+        return;
+    sql_cluster *cluster = sql_shard_map::GetInstance()->route(m_form_user);
+    sql_stmt::RESULT res = sql_stmt::SQL_ERROR;
+    {
+        req_trace::db_span span(m_trace);
+        MYSQL *mysql = NULL;
+        connectionRAII mysqlcon(&mysql, cluster->writer());
+        span.acquired();
+        if (mysql)
+            res = sql_stmt::update_passwd(mysql, m_form_user, m_db_passwd.c_str(), hashed.c_str());
+    }
+    if (res == sql_stmt::SQL_OK)
+    {
+        users->set(m_form_user, hashed.c_str());
+        cluster->note_write(m_form_user);
+    }
+    else if (res == sql_stmt::SQL_ERROR)
+    {
+        LOG_WARN("rehash password of %s failed", m_form_user);
+    }
+}
+
+bool http_conn::start_async_db()
+{
+    sql_async *async = sql_async::GetInstance();
+    register_batcher *batcher = register_batcher::GetInstance();
+    if (!async->enabled() && !batcher->enabled())
+        return false;
+
+    parse_user_form();
+    const char *p = strrchr(m_url, '/');
+    bool submitted = false;
+    bool need_db = false;
+    if (m_form_ok && *(p + 1) == '3' && !users->contains(m_form_user))
+    {
+        need_db = true;
+        m_trace.mark(req_trace::DB_SUBMIT);     //回调可能在提交返回之前执行，须先记下
+        //注册优先走组提交，多条INSERT共用一次事务提交
+        //没有唯一键时只有阻塞方式的insert_user按用户名串行化，退回阻塞执行器
+        if (!sql_stmt::unique_name())
+            submitted = false;
+        else if (batcher->enabled())
+            submitted = batcher->submit(m_form_user, stored_passwd(), on_async_db, this);
+        else
+            submitted = async->insert_user(m_form_user, stored_passwd(), on_async_db, this);
+    }
+    else if (m_form_ok && *(p + 1) == '2' && !users->contains(m_form_user))
+    {
+        need_db = true;
+        if (async->enabled())
+        {
+            m_trace.mark(req_trace::DB_SUBMIT);
+            submitted = async->query_passwd(m_form_user, on_async_db, this);
+        }
+    }
+
+    if (submitted)
+        return true;
+    if (need_db)
+    {
+        m_trace.undo(req_trace::DB_SUBMIT);
+        return false;               //未启用或队列已满，退回阻塞执行器
+    }
+
+    //结果只取决于内存中的用户表，直接在当前线程完成
+    m_db_stage = true;
+    complete(do_request());
+    return true;
+}
+
+void http_conn::on_async_db(void *arg, sql_stmt::RESULT result, const char *passwd)
+{
+    http_conn *conn = (http_conn *)arg;
+    conn->m_trace.mark(req_trace::DB_RELEASE);
+    conn->m_db_result = result;
+    if (passwd)
+        conn->m_db_passwd = passwd;
+    conn->m_db_done = true;
+    conn->m_db_stage = true;
+    conn->complete(conn->do_request());
+}
+
+void http_conn::process_db()
+{
+    m_db_stage = true;
+    complete(do_request());
+}
+
+void http_conn::complete(HTTP_CODE read_ret)
+{
+    //数据库阶段取得了保存的哈希，转到哈希执行器校验，之后再次进入complete
+    if (read_ret == HASH_REQUEST)
+    {
+        m_hash_job = HASH_VERIFY;
+        if (m_hash_pool && m_hash_pool->append(this))
+            return;
+        read_ret = SERVICE_UNAVAILABLE;
+    }
+    PROBE2(request, m_sockfd, read_ret);
+
     //调用process_write完成报文响应
     bool write_ret = process_write(read_ret);
+    m_trace.mark(req_trace::RESPONSE_READY);         //注册写事件后主线程可能立即开始发送，须在此之前记下
     if (!write_ret)
     {
         close_conn();
@@ -20,11 +20,27 @@
 #include <sys/wait.h>
 #include <sys/uio.h>
 #include <map>
+#include <atomic>
 
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "../CGImysql/sql_stmt.h"
+#include "../CGImysql/sql_async.h"
+#include "../CGImysql/sql_batch.h"
+#include "../CGImysql/sql_cluster.h"
+#include "../CGImysql/sql_shard.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "../log/access_log.h"
+#include "../metrics/metrics.h"
+#include "../metrics/req_trace.h"
+#include "../probes/probes.h"
+#include "../threadpool/bulkhead.h"
+#include "../user/user_table.h"
+#include "../user/session_store.h"
+#include "../user/password_hasher.h"
+#include "form_parser.h"
+#include "upload_quota.h"
 
 class http_conn
 {
@@ -32,6 +48,9 @@ public:
     static const int FILENAME_LEN = 200;
     static const int READ_BUFFER_SIZE = 2048;
     static const int WRITE_BUFFER_SIZE = 1024;
+    static const long MAX_BODY_SIZE = 64L << 20;    //消息体的长度上限
+    static const char *UPLOAD_DIR;                  //上传目录
+    static const int MIN_BODY_ROOM = 256;           //边读边解析时读缓冲区中至少要留给消息体的空间
     
     //请求方法
     enum METHOD
@@ -74,7 +93,10 @@ public:
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
         INTERNAL_ERROR,
-        CLOSED_CONNECTION
+        CLOSED_CONNECTION,
+        DB_REQUEST,             //需要访问数据库，转交数据库执行器处理
+        HASH_REQUEST,           //需要校验密码哈希，转交哈希执行器处理
+        SERVICE_UNAVAILABLE     //执行器队列已满，拒绝服务
     };
 
 
@@ -89,6 +111,10 @@ public:
     void close_conn(bool real_close = true);
     //完成请求报文的解析及响应
     void process();
+    //在数据库执行器中继续处理登录/注册请求
+    void process_db();
+    //登录/注册在哈希执行器中的处理入口：计算注册密码的哈希或校验登录密码
+    void process_hash();
     //向m_read_buf中读入请求报文
     bool read_once();
     //将内存映射区以及缓冲区中的数据发送给客户端
@@ -97,7 +123,15 @@ public:
     {
         return &m_address;
     }
-    void initmysql_result(connection_pool *connPool);
+    //线程池按fd选择连接固定的工作队列
+    int get_sockfd() const
+    {
+        return m_sockfd;
+    }
+    //在后台线程中依次从每个分片流式加载用户表，立即返回；加载完成前表中没有的用户回查数据库
+    void initmysql_result();
+    //停止并等待后台加载线程
+    static void stop_load();
 
     //reactor模式：只有reactor模式下，标志位improv和timer_flag才会发挥作用        
     int timer_flag;             //timer_flag：当http的读写失败后置1，用于判断用户连接是否异常
@@ -112,6 +146,8 @@ private:
     HTTP_CODE process_read();
     //向m_write_buf中写入响应报文
     bool process_write(HTTP_CODE ret);
+    //生成响应并注册写事件
+    void complete(HTTP_CODE ret);
 
     // 下面这一组函数被process_read调用以分析HTTP请求
 
@@ -123,6 +159,32 @@ private:
     HTTP_CODE parse_content(char *text);
     //对客户请求进行响应
     HTTP_CODE do_request();
+    //从解析好的表单中取出用户名和密码
+    void parse_user_form();
+    //请求结束时记录时延指标和慢请求的分段耗时，并按采样写一行访问日志
+    void finish_request();
+    //注册与登录检测，结果写入m_url
+    void do_register();
+    bool do_login();
+    //写入数据库和用户表的密码：启用哈希时为哈希，否则为明文
+    const char *stored_passwd() const { return m_passwd_hash.empty() ? m_form_passwd : m_passwd_hash.c_str(); }
+    //需要计算或校验密码哈希时提交给哈希执行器并返回true
+    bool start_hash();
+    //登录成功后把旧的明文记录改存为哈希，在哈希执行器中调用
+    void rehash_passwd();
+    //提交给异步数据库层或数据库执行器，都不可用时返回503
+    void dispatch_db();
+    //头部解析完时查找Cookie中的会话，有效时记下会话的用户名
+    void resolve_session();
+    //登录请求可以直接凭会话通过时返回true
+    bool check_session();
+    //访问需要登录的页面(/5 /6 /7 /8)但没有有效会话
+    bool login_required(char route) const;
+    //把注册提交给组提交批处理或异步数据库层，登录提交给异步数据库层
+    //不需要访问数据库时直接完成，无法提交时返回false
+    bool start_async_db();
+    //异步数据库操作/批量注册完成的回调，在对应线程上继续处理请求
+    static void on_async_db(void *arg, sql_stmt::RESULT result, const char *passwd);
     char *get_line() { return m_read_buf + m_start_line; };
     //分析出一行内容,返回值为行的读取状态，有LINE_OK,LINE_BAD,LINE_OPEN
     LINE_STATUS parse_line();
@@ -144,14 +206,18 @@ private:
     bool add_content_length(int content_length);
     //添加连接状态
     bool add_linger();
+    //登录成功后添加Set-Cookie
+    bool add_session_cookie();
     //添加空行
     bool add_blank_line();
 
 public:
     static int m_epollfd;           // 所有socket上的事件都被注册到同一个epoll内核事件中，所以设置成静态的
-    static int m_user_count;        // 统计用户的数量
-    MYSQL *mysql;       //数据库连接
+    static std::atomic<int> m_user_count;   // 统计用户的数量，主线程和工作线程都会修改
+    static bulkhead<http_conn> *m_db_pool;  // 数据库执行器，登录/注册请求在其中执行，与静态请求隔离
+    static bulkhead<http_conn> *m_hash_pool;    // 哈希执行器，计算和校验密码哈希，与静态请求和数据库执行器隔离
     int m_state;        //读为0, 写为1
+    req_trace m_trace;  //当前请求各阶段的时间点，线程池和执行器出入队时也会记录
 
 private:
     
@@ -179,7 +245,38 @@ private:
     struct iovec m_iv[2];   // iovec定义向量元素，通常该结构用作一个多元素的数组，一个元素用来存响应数据，一个用来存响应http
     int m_iv_count;         // m_iv_count表示被写内存块的数量。
     int cgi;                // 是否启用的POST
+    bool m_db_stage;        // 是否已在数据库执行器中
+    bool m_db_done;         // 异步数据库操作是否已返回结果
+    int m_db_result;        // 异步数据库操作的结果，sql_stmt::RESULT
+    string m_db_passwd;     // 异步查询返回的密码
+    char m_form_user[100];  // 表单中的用户名
+    char m_form_passwd[100];// 表单中的密码
+    bool m_form_ok;         // 表单是否合法
+    char m_cookie_sid[session_store::TOKEN_LEN + 1];    // 请求Cookie中的会话令牌
+    char m_new_sid[session_store::TOKEN_LEN + 1];       // 本次登录新建的会话令牌，随响应下发
+    string m_session_user;  // 会话对应的用户名，头部解析完时确定，为空表示未登录
+    bool m_end_session;     // 本次请求退出登录，响应中让浏览器清除Cookie
+    enum HASH_JOB
+    {
+        HASH_PASSWORD = 0,  // 计算注册密码的哈希
+        HASH_VERIFY         // 校验登录密码，保存的哈希在m_db_passwd中
+    };
+    HASH_JOB m_hash_job;    // 哈希执行器要做的工作
+    string m_passwd_hash;   // 注册密码的哈希
+    bool m_auth_done;       // 哈希执行器是否已完成登录校验
+    bool m_auth_ok;         // 登录校验的结果
     char *m_string;         // 存储请求头数据
+    form_parser m_form;     // 消息体的表单解析器
+    form_parser::TYPE m_form_type;                  // 由Content-Type确定的表单类型
+    char m_boundary[form_parser::BOUNDARY_LEN + 1]; // multipart的分隔符
+    bool m_body_stream;     // 消息体放不进读缓冲区或为multipart时，边读边解析，读缓冲区的消息体区域反复使用
+    long m_body_read;       // 已解析的消息体字节数
+    long long m_start_us;   // 读到请求第一个字节的时间，启用访问日志或指标时才记录
+    int m_status;           // 响应的状态码
+    int m_route;            // 请求对应的页面，metrics::ROUTE
+    char m_access_path[access_log::FIELD_LEN];  // 原始请求路径，m_url在处理过程中会被改写
+    char m_referer[access_log::FIELD_LEN];
+    char m_agent[access_log::FIELD_LEN];
     int bytes_to_send;      // 将要发送的数据的字节数
     int bytes_have_send;    // 已经发送的字节数
     char *doc_root;
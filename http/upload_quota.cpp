@@ -0,0 +1,123 @@
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "upload_quota.h"
+
+upload_quota::upload_quota() : m_max_bytes(0), m_max_files(0), m_saved_bytes(0), m_saved_files(0), m_pending_bytes(0),
+                               m_pending_files(0), m_last_scan(0)
+{
+}
+
+upload_quota::~upload_quota()
+{
+}
+
+upload_quota *upload_quota::GetInstance()
+{
+    static upload_quota quota;
+    return &quota;
+}
+
+void upload_quota::init(const char *dir, long long max_bytes, int max_files)
+{
+    m_lock.lock();
+    m_dir = dir;
+    m_max_bytes = max_bytes;
+    m_max_files = max_files;
+    rescan();
+    m_lock.unlock();
+}
+
+//.part-开头的是未完成的临时文件，已计入m_pending_bytes
+void upload_quota::rescan()
+{
+    m_last_scan = time(NULL);
+    DIR *d = opendir(m_dir.c_str());
+    if (!d)
+    {
+        m_saved_bytes = 0;
+        m_saved_files = 0;
+        return;
+    }
+    long long bytes = 0;
+    int files = 0;
+    while (struct dirent *e = readdir(d))
+    {
+        if (strncmp(e->d_name, ".part-", 6) == 0)
+            continue;
+        struct stat st;
+        string path = m_dir + "/" + e->d_name;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+        {
+            bytes += st.st_size;
+            ++files;
+        }
+    }
+    closedir(d);
+    m_saved_bytes = bytes;
+    m_saved_files = files;
+}
+
+bool upload_quota::acquire_file()
+{
+    m_lock.lock();
+    bool ok = m_max_files <= 0 || m_saved_files + m_pending_files < m_max_files;
+    if (!ok && time(NULL) - m_last_scan >= RESCAN_SEC)
+    {
+        rescan();
+        ok = m_saved_files + m_pending_files < m_max_files;
+    }
+    if (ok)
+        ++m_pending_files;
+    m_lock.unlock();
+    return ok;
+}
+
+bool upload_quota::acquire_bytes(long long n)
+{
+    m_lock.lock();
+    bool ok = m_max_bytes <= 0 || m_saved_bytes + m_pending_bytes + n <= m_max_bytes;
+    if (!ok && time(NULL) - m_last_scan >= RESCAN_SEC)
+    {
+        rescan();
+        ok = m_saved_bytes + m_pending_bytes + n <= m_max_bytes;
+    }
+    if (ok)
+        m_pending_bytes += n;
+    m_lock.unlock();
+    return ok;
+}
+
+void upload_quota::release(long long bytes)
+{
+    m_lock.lock();
+    m_pending_bytes -= bytes;
+    --m_pending_files;
+    m_lock.unlock();
+}
+
+void upload_quota::commit(long long bytes)
+{
+    m_lock.lock();
+    m_pending_bytes -= bytes;
+    --m_pending_files;
+    m_saved_bytes += bytes;
+    ++m_saved_files;
+    m_lock.unlock();
+}
+
+long long upload_quota::bytes()
+{
+    m_lock.lock();
+    long long n = m_saved_bytes + m_pending_bytes;
+    m_lock.unlock();
+    return n;
+}
+
+int upload_quota::files()
+{
+    m_lock.lock();
+    int n = m_saved_files + m_pending_files;
+    m_lock.unlock();
+    return n;
+}
@@ -0,0 +1,57 @@
+/*************************************************************
+*上传目录的配额：限制目录中文件的总字节数和个数，所有连接共用
+*正在上传的文件边写边占用空间，失败或被拒绝时归还，保存后计入已保存的用量
+*已保存的用量启动时扫描目录得到；配额不足时重新扫描（最多每RESCAN_SEC一次），运维删除文件后无需重启
+**************************************************************/
+
+#ifndef UPLOAD_QUOTA_H
+#define UPLOAD_QUOTA_H
+
+#include <string>
+#include <time.h>
+#include "../lock/locker.h"
+
+using namespace std;
+
+class upload_quota
+{
+public:
+    static upload_quota *GetInstance();
+
+    //max_bytes、max_files不大于0时对应的一项不限制
+    void init(const char *dir, long long max_bytes, int max_files);
+    const char *dir() const { return m_dir.c_str(); }
+
+    //开始写一个新文件前占用一个名额，目录已满时返回false
+    bool acquire_file();
+    //写入n字节前占用空间，超出配额时返回false
+    bool acquire_bytes(long long n);
+    //放弃正在上传的文件，归还它占用的名额和bytes字节
+    void release(long long bytes);
+    //正在上传的文件已保存
+    void commit(long long bytes);
+
+    long long bytes();
+    int files();
+
+private:
+    upload_quota();
+    ~upload_quota();
+
+    static const int RESCAN_SEC = 10;
+
+    //超出配额时重新统计目录中已保存的文件，调用方持有m_lock
+    void rescan();
+
+    string m_dir;
+    long long m_max_bytes;
+    int m_max_files;
+    long long m_saved_bytes;        //目录中已保存文件的总字节数
+    int m_saved_files;
+    long long m_pending_bytes;      //正在上传的文件已占用的字节数
+    int m_pending_files;
+    time_t m_last_scan;
+    locker m_lock;
+};
+
+#endif
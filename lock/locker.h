@@ -2,8 +2,10 @@
 #define LOCKER_H
 
 #include <exception>
+#include <errno.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
 
 class sem
 {
@@ -26,9 +28,35 @@ public:
     {
         sem_destroy(&m_sem);
     }
+    //被信号中断时继续等待
     bool wait()
     {
-        return sem_wait(&m_sem) == 0;
+        int ret;
+        while ((ret = sem_wait(&m_sem)) != 0 && errno == EINTR)
+            ;
+        return ret == 0;
+    }
+    //增加了超时处理，超时或出错返回false；被信号中断时按原截止时间继续等待，不算超时
+    bool timewait(int ms_timeout)
+    {
+        struct timespec t = {0, 0};
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += ms_timeout / 1000;
+        t.tv_nsec += (long)(ms_timeout % 1000) * 1000000;
+        if (t.tv_nsec >= 1000000000)
+        {
+            t.tv_sec += 1;
+            t.tv_nsec -= 1000000000;
+        }
+        int ret;
+        while ((ret = sem_timedwait(&m_sem, &t)) != 0 && errno == EINTR)
+            ;
+        return ret == 0;
+    }
+    //不阻塞，没有资源时立即返回false
+    bool trywait()
+    {
+        return sem_trywait(&m_sem) == 0;
     }
     bool post()
     {
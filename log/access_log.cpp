@@ -0,0 +1,196 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include "access_log.h"
+#include "log.h"
+
+//按格式追加到[p, end)，空间不足时截断，末尾始终保留一个字节给换行符
+struct line_writer
+{
+    char *p;
+    char *end;
+
+    void put(char c)
+    {
+        if (p < end)
+            *p++ = c;
+    }
+    void format(const char *fmt, ...)
+    {
+        va_list valst;
+        va_start(valst, fmt);
+        int n = vsnprintf(p, end - p + 1, fmt, valst);
+        va_end(valst);
+        if (n > 0)
+            p += n < end - p ? n : end - p;
+    }
+    //common格式按nginx的习惯把引号、反斜杠和不可见字符写成\xHH，JSON按规范转义
+    void escaped(const char *s, bool json)
+    {
+        if (!s || !*s)
+            s = "-";
+        for (; *s && p < end; ++s)
+        {
+            unsigned char c = *s;
+            if (c == '"' || c == '\\' || c < 0x20 || c == 0x7f)
+            {
+                if (json && (c == '"' || c == '\\'))
+                {
+                    put('\\');
+                    put(c);
+                }
+                else if (json)
+                    format("\\u%04x", c);
+                else
+                    format("\\x%02X", c);
+            }
+            else
+                put(c);
+        }
+    }
+    void quoted(const char *s, bool json)
+    {
+        put('"');
+        escaped(s, json);
+        put('"');
+    }
+};
+
+access_log::access_log() : m_format(OFF), m_sample(1), m_slow_us(0), m_close_log(0), m_fd(-1)
+{
+}
+
+access_log::~access_log()
+{
+    if (m_fd < 0)
+        return;
+    stop();                             //后台线程退出前写完所有缓冲区
+    close(m_fd);
+}
+
+access_log *access_log::GetInstance()
+{
+    static access_log log;
+    return &log;
+}
+
+bool access_log::init(const char *file_name, int format, int sample, int slow_ms, int close_log)
+{
+    if (format <= OFF || format > JSON)
+        return false;
+    m_fd = open(file_name, O_WRONLY | O_APPEND | O_CREAT, 0666);
+    if (m_fd < 0)
+        return false;
+    m_sample = sample > 1 ? sample : 1;
+    m_slow_us = slow_ms > 0 ? slow_ms * 1000LL : 0;
+    m_close_log = close_log;
+    if (!start(LINE_SIZE, MAX_FULL))
+    {
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    m_format = format;
+    return true;
+}
+
+//采样计数放在线程局部变量中，各线程互不竞争
+int access_log::sample(int status, long long latency_us)
+{
+    if (m_format == OFF)
+        return 0;
+    if (status >= 400 || (m_slow_us > 0 && latency_us >= m_slow_us))
+        return 1;
+    if (m_sample <= 1)
+        return 1;
+    static thread_local unsigned int count = 0;
+    return count++ % m_sample == 0 ? m_sample : 0;
+}
+
+int access_log::format_line(char *dst, int cap, const access_record &r, int weight)
+{
+    //时间按秒缓存
+    static thread_local time_t last_sec = 0;
+    static thread_local char clf_time[32];
+    static thread_local char iso_time[32];
+    static thread_local char zone[8];
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    if (now.tv_sec != last_sec)
+    {
+        struct tm my_tm;
+        localtime_r(&now.tv_sec, &my_tm);
+        strftime(clf_time, sizeof(clf_time), "%d/%b/%Y:%H:%M:%S %z", &my_tm);
+        strftime(iso_time, sizeof(iso_time), "%Y-%m-%dT%H:%M:%S", &my_tm);
+        strftime(zone, sizeof(zone), "%z", &my_tm);
+        last_sec = now.tv_sec;
+    }
+
+    line_writer w = {dst, dst + cap - 1};
+    if (m_format == JSON)
+    {
+        w.format("{\"time\":\"%s.%03ld%s\",\"client\":", iso_time, (long)now.tv_usec / 1000, zone);
+        w.quoted(r.client, true);
+        w.format(",\"method\":");
+        w.quoted(r.method, true);
+        w.format(",\"path\":");
+        w.quoted(r.path, true);
+        w.format(",\"status\":%d,\"bytes\":%lld,\"latency_us\":%lld,\"referer\":", r.status, r.bytes, r.latency_us);
+        w.quoted(r.referer, true);
+        w.format(",\"agent\":");
+        w.quoted(r.agent, true);
+        w.format(",\"sample\":%d}", weight);
+    }
+    else
+    {
+        w.format("%s - - [%s] \"%s ", r.client && *r.client ? r.client : "-", clf_time, r.method && *r.method ? r.method : "-");
+        w.escaped(r.path, false);
+        w.format(" HTTP/1.1\" %d %lld", r.status, r.bytes);
+        if (m_format == COMBINED)
+        {
+            w.put(' ');
+            w.quoted(r.referer, false);
+            w.put(' ');
+            w.quoted(r.agent, false);
+        }
+        w.format(" %lld.%03lld", r.latency_us / 1000, r.latency_us % 1000);
+    }
+    *w.p++ = '\n';
+    return w.p - dst;
+}
+
+void access_log::write(const access_record &r, int weight)
+{
+    char *dst = begin_line();
+    end_line(format_line(dst, LINE_SIZE, r, weight));
+}
+
+void access_log::write_buffers(const vector<buffer *> &bufs)
+{
+    for (size_t i = 0; i < bufs.size(); ++i)
+    {
+        const char *p = bufs[i]->data;
+        size_t len = bufs[i]->len;
+        while (len > 0)
+        {
+            ssize_t n = ::write(m_fd, p, len);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            p += n;
+            len -= n;
+        }
+    }
+}
+
+void access_log::after_write(long long dropped)
+{
+    if (dropped > 0)
+        LOG_WARN("access log buffers full, dropped %lld lines", dropped);
+}
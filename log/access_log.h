@@ -0,0 +1,70 @@
+/*************************************************************
+*访问日志：每个完成的请求一行，与调试日志分开写入
+*格式可选common、combined(多出Referer和User-Agent)或每行一个JSON对象，common和combined末尾追加耗时(毫秒)
+*普通请求每N个记录一个，出错(状态码不小于400)和慢请求总是记录，JSON中的sample字段为该行代表的请求数
+*与调试日志一样由buffered_sink按线程缓冲，写一行只锁本线程的缓冲区
+**************************************************************/
+
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <vector>
+#include "buffered_sink.h"
+
+using namespace std;
+
+//一次请求的记录，字符串为空时按"-"输出
+struct access_record
+{
+    const char *client;         //客户端地址
+    const char *method;
+    const char *path;
+    const char *referer;
+    const char *agent;
+    int status;
+    long long bytes;            //实际发送的字节数
+    long long latency_us;       //从读到请求的第一个字节到发送完成
+};
+
+class access_log : private buffered_sink
+{
+public:
+    enum FORMAT
+    {
+        OFF = 0,
+        COMMON,
+        COMBINED,
+        JSON
+    };
+    static const int MAX_FULL = 16;             //等待写入的满缓冲区上限，超出时丢弃
+    static const int FIELD_LEN = 128;           //路径、Referer、User-Agent保留的最大长度
+    static const int LINE_SIZE = 2048;          //单行的最大长度
+
+    static access_log *GetInstance();
+
+    //sample为采样间隔N，不大于1时记录全部请求；slow_ms为慢请求阈值，0表示不按耗时强制记录
+    bool init(const char *file_name, int format, int sample, int slow_ms, int close_log);
+    bool enabled() const { return m_format != OFF; }
+    //combined和JSON格式需要请求头中的Referer和User-Agent
+    bool want_headers() const { return m_format >= COMBINED; }
+
+    //判断是否记录这次请求，返回该行代表的请求数，0表示不记录
+    int sample(int status, long long latency_us);
+    void write(const access_record &r, int weight);
+
+private:
+    access_log();
+    ~access_log();
+
+    int format_line(char *dst, int cap, const access_record &r, int weight);
+    void write_buffers(const vector<buffer *> &bufs);
+    void after_write(long long dropped);
+
+    int m_format;
+    int m_sample;
+    long long m_slow_us;
+    int m_close_log;
+    int m_fd;
+};
+
+#endif
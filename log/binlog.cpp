@@ -0,0 +1,279 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "binlog.h"
+
+bool binlog::s_enabled = false;
+
+static int64_t realtime_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+binlog::binlog() : m_fd(-1), m_today(0), m_size(0), m_tsc_hz(0), m_formats_written(0), m_stop(false)
+{
+    memset(m_active, '\0', sizeof(m_active));
+}
+
+binlog::~binlog()
+{
+    if (m_fd < 0)
+        return;
+    m_stop = true;
+    pthread_join(m_tid, NULL);          //后台线程退出前写完各环中的记录
+    m_archive.stop();
+    close(m_fd);
+}
+
+binlog *binlog::GetInstance()
+{
+    static binlog log;
+    return &log;
+}
+
+binlog::ring_holder::~ring_holder()
+{
+    if (r)
+        r->exited.store(true, std::memory_order_release);
+}
+
+bool binlog::init(const char *file_name, int max_files, long long max_bytes)
+{
+    snprintf(m_active, sizeof(m_active), "%s.bin", file_name);
+
+    //格式串编号每次启动从0开始，上次运行留下的文件不能接着写，按它的修改日期归档
+    struct stat st;
+    m_archive.init(m_active, max_files, max_bytes);
+    if (stat(m_active, &st) == 0 && st.st_size > 0)
+        m_archive.archive(log_archive::date_of(st.st_mtime));
+
+    //标定TSC频率，之后每次写文件都附带一条同步记录，解码时用最近的同步记录换算
+    int64_t ns0 = monotonic_ns();
+    uint64_t tsc0 = now_tsc();
+    usleep(20000);
+    int64_t ns1 = monotonic_ns();
+    uint64_t tsc1 = now_tsc();
+    m_tsc_hz = (double)(tsc1 - tsc0) * 1e9 / (double)(ns1 - ns0);
+
+    m_today = log_archive::date_of(time(NULL));
+    if (!open_file())
+    {
+        m_archive.stop();
+        return false;
+    }
+    flush_out();
+
+    s_enabled = true;
+    if (pthread_create(&m_tid, NULL, worker, this) != 0)
+    {
+        s_enabled = false;
+        m_archive.stop();
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+//在原名下新建文件并写入文件头，之后的drain重新写入全部格式串
+bool binlog::open_file()
+{
+    int fd = open(m_active, O_WRONLY | O_APPEND | O_CREAT, 0666);
+    if (fd < 0)
+        return false;
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = fd;
+    m_size = 0;
+    m_formats_written = 0;
+
+    binlog_file_header header;
+    memcpy(header.magic, BINLOG_MAGIC, sizeof(header.magic));
+    header.tsc_hz = m_tsc_hz;
+    append(&header, sizeof(header));
+    return true;
+}
+
+//按天或按大小切分，只由后台线程在drain开始时调用；改名或新建失败时继续写原文件，等下一次切分
+void binlog::rotate()
+{
+    int today = log_archive::date_of(time(NULL));
+    if (today == m_today && m_size < SPLIT_SIZE)
+        return;
+    if (m_archive.archive(m_today))
+        open_file();
+    m_today = today;
+    if (m_size >= SPLIT_SIZE)
+        m_size = 0;
+}
+
+int binlog::register_format(int level, const char *format)
+{
+    m_lock.lock();
+    int id = (int)m_formats.size();
+    m_formats.push_back(make_pair(level, format));
+    m_lock.unlock();
+    return id;
+}
+
+binlog::ring *binlog::local_ring()
+{
+    static thread_local ring_holder holder;
+    if (!holder.r)
+    {
+        ring *r = new ring;
+        r->data = new char[RING_SIZE];
+        r->head = 0;
+        r->tail = 0;
+        r->dropped = 0;
+        r->exited = false;
+        m_lock.lock();
+        m_rings.push_back(r);
+        m_lock.unlock();
+        holder.r = r;
+    }
+    return holder.r;
+}
+
+//单生产者：只有本线程写head，空间不足时丢弃并计数，从不等待
+void binlog::commit(const char *rec, size_t len)
+{
+    ring *r = local_ring();
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    uint64_t tail = r->tail.load(std::memory_order_acquire);
+    if (RING_SIZE - (head - tail) < len)
+    {
+        r->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    size_t off = head & (RING_SIZE - 1);
+    size_t first = len < RING_SIZE - off ? len : RING_SIZE - off;
+    memcpy(r->data + off, rec, first);
+    memcpy(r->data, rec + first, len - first);
+    r->head.store(head + len, std::memory_order_release);
+}
+
+void binlog::append(const void *data, size_t len)
+{
+    m_out.append((const char *)data, len);
+}
+
+void binlog::flush_out()
+{
+    const char *p = m_out.data();
+    size_t len = m_out.size();
+    while (len > 0)
+    {
+        ssize_t n = ::write(m_fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        p += n;
+        len -= n;
+        m_size += n;
+    }
+    m_out.clear();
+}
+
+//先写新登记的格式串和一条同步记录，再依次取出各环中的记录
+void binlog::drain()
+{
+    rotate();
+    m_lock.lock();
+    vector<pair<int, const char *> > formats(m_formats.begin() + m_formats_written, m_formats.end());
+    vector<ring *> rings = m_rings;
+    m_lock.unlock();
+
+    for (size_t i = 0; i < formats.size(); ++i)
+    {
+        size_t flen = strlen(formats[i].second);
+        if (flen > MAX_RECORD)
+            flen = MAX_RECORD;
+        binlog_record r;
+        r.size = (uint16_t)(sizeof(r) + sizeof(uint32_t) + flen);
+        r.kind = BINLOG_FORMAT;
+        r.arg = (uint8_t)formats[i].first;
+        uint32_t id = (uint32_t)(m_formats_written + i);
+        append(&r, sizeof(r));
+        append(&id, sizeof(id));
+        append(formats[i].second, flen);
+    }
+    m_formats_written += formats.size();
+
+    binlog_record sync;
+    sync.size = sizeof(sync) + sizeof(uint64_t) + sizeof(int64_t);
+    sync.kind = BINLOG_SYNC;
+    sync.arg = 0;
+    uint64_t tsc = now_tsc();
+    int64_t ns = realtime_ns();
+    append(&sync, sizeof(sync));
+    append(&tsc, sizeof(tsc));
+    append(&ns, sizeof(ns));
+
+    for (size_t i = 0; i < rings.size(); ++i)
+    {
+        ring *r = rings[i];
+        bool exited = r->exited.load(std::memory_order_acquire);
+        uint64_t head = r->head.load(std::memory_order_acquire);
+        uint64_t tail = r->tail.load(std::memory_order_relaxed);
+        size_t off = tail & (RING_SIZE - 1);
+        size_t len = head - tail;
+        size_t first = len < RING_SIZE - off ? len : RING_SIZE - off;
+        append(r->data + off, first);
+        append(r->data, len - first);
+        r->tail.store(head, std::memory_order_release);
+
+        uint64_t dropped = r->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0)
+        {
+            binlog_record d;
+            d.size = sizeof(d) + sizeof(uint64_t);
+            d.kind = BINLOG_DROPPED;
+            d.arg = 0;
+            append(&d, sizeof(d));
+            append(&dropped, sizeof(dropped));
+        }
+
+        if (exited)
+        {
+            m_lock.lock();
+            for (size_t j = 0; j < m_rings.size(); ++j)
+            {
+                if (m_rings[j] == r)
+                {
+                    m_rings.erase(m_rings.begin() + j);
+                    break;
+                }
+            }
+            m_lock.unlock();
+            delete[] r->data;
+            delete r;
+        }
+    }
+    flush_out();
+}
+
+void *binlog::worker(void *arg)
+{
+    binlog *log = (binlog *)arg;
+    while (!log->m_stop)
+    {
+        usleep(DRAIN_MS * 1000);
+        log->drain();
+    }
+    log->drain();
+    return NULL;
+}
@@ -0,0 +1,223 @@
+/*************************************************************
+*二进制延迟格式化日志：调用线程只记录格式串编号、TSC时间戳和原始参数，不做vsnprintf
+*每个线程一个单生产者单消费者的环形缓冲区，后台线程定期把各环中的记录原样写入文件
+*格式串在每个调用点首次执行时登记一次，后台线程在写该格式的记录之前先写入它的定义
+*文件由离线工具logdecode还原成与文本日志相同格式的内容
+*与文本日志一样写入固定名字的文件，按天或按大小切分归档，压缩和清理由log_archive完成
+*每个文件以文件头开始，切分后重新写入全部格式串，单个文件(包括归档)可独立解码
+**************************************************************/
+
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <type_traits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+#include "../lock/locker.h"
+#include "log_archive.h"
+
+using namespace std;
+
+//文件格式：文件头之后是连续的记录，每条记录以binlog_record开头，size为整条记录的字节数
+#define BINLOG_MAGIC "BINLOG01"
+
+struct binlog_file_header
+{
+    char magic[8];
+    double tsc_hz;              //启动时标定的TSC频率，解码时与同步记录一起换算时间
+};
+
+enum BINLOG_KIND
+{
+    BINLOG_FORMAT = 1,          //格式串定义：level(uint8)、id(uint32)、格式串
+    BINLOG_SYNC,                //时间同步：tsc(uint64)、realtime_ns(int64)
+    BINLOG_ENTRY,               //日志：id(uint32)、tsc(uint64)、参数
+    BINLOG_DROPPED              //环满丢弃的条数：count(uint64)
+};
+
+//参数的类型标记，后面跟对应的数据：整数、浮点、指针为8字节，字符串为uint16长度加内容
+enum BINLOG_ARG
+{
+    BINLOG_INT = 1,
+    BINLOG_UINT,
+    BINLOG_DOUBLE,
+    BINLOG_STR,
+    BINLOG_PTR
+};
+
+struct binlog_record
+{
+    uint16_t size;
+    uint8_t kind;
+    uint8_t arg;                //BINLOG_ENTRY为参数个数，BINLOG_FORMAT为日志级别
+} __attribute__((packed));
+
+class binlog
+{
+public:
+    static const size_t RING_SIZE = 512 * 1024;     //每个线程环形缓冲区的大小，须为2的幂
+    static const size_t MAX_RECORD = 2048;          //单条记录的最大长度，超出的参数被截断
+    static const size_t MAX_STR = 512;              //单个字符串参数的最大长度
+    static const int DRAIN_MS = 50;                 //后台线程写文件的间隔(毫秒)
+    static const long long SPLIT_SIZE = 256LL << 20;    //单个文件超过该大小时切分
+
+    static binlog *GetInstance();
+    //是否启用二进制日志，LOG_*宏据此选择记录方式
+    static bool enabled() { return s_enabled; }
+
+    //file_name与文本日志相同，实际文件名加.bin后缀；上次运行留下的文件先归档
+    //max_files、max_bytes为压缩后归档文件的保留个数和总字节数，0表示不限
+    bool init(const char *file_name, int max_files = 0, long long max_bytes = 0);
+    //登记调用点的格式串，返回编号；format须为字符串字面量
+    int register_format(int level, const char *format);
+
+    static uint64_t now_tsc()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+    }
+
+    template <typename... Args>
+    void write(int id, Args... args)
+    {
+        char rec[MAX_RECORD];
+        size_t pos = sizeof(binlog_record) + sizeof(uint32_t) + sizeof(uint64_t);
+        int n = 0;
+        put_args(rec, pos, n, args...);
+
+        binlog_record *r = (binlog_record *)rec;
+        r->size = (uint16_t)pos;
+        r->kind = BINLOG_ENTRY;
+        r->arg = (uint8_t)n;
+        uint32_t fid = id;
+        uint64_t tsc = now_tsc();
+        memcpy(rec + sizeof(binlog_record), &fid, sizeof(fid));
+        memcpy(rec + sizeof(binlog_record) + sizeof(fid), &tsc, sizeof(tsc));
+        commit(rec, pos);
+    }
+
+private:
+    binlog();
+    ~binlog();
+
+    struct ring
+    {
+        char *data;
+        std::atomic<uint64_t> head;         //生产者写入位置
+        std::atomic<uint64_t> tail;         //后台线程读取位置
+        std::atomic<uint64_t> dropped;      //环满丢弃的条数
+        std::atomic<bool> exited;           //所属线程已退出，写完后释放
+    };
+    struct ring_holder
+    {
+        ring *r;
+        ring_holder() : r(NULL) {}
+        ~ring_holder();
+    };
+
+    ring *local_ring();
+    void commit(const char *rec, size_t len);
+    void drain();
+    bool open_file();
+    void rotate();
+    void append(const void *data, size_t len);
+    void flush_out();
+    static void *worker(void *arg);
+
+    //按类型序列化参数，放不下的参数直接略去，解码时显示为<?>
+    static bool reserve(size_t pos, size_t need) { return pos + need <= MAX_RECORD; }
+    static void put_tagged(char *rec, size_t &pos, int &n, uint8_t tag, const void *v)
+    {
+        if (!reserve(pos, 9))
+            return;
+        rec[pos] = tag;
+        memcpy(rec + pos + 1, v, 8);
+        pos += 9;
+        ++n;
+    }
+    template <typename T>
+    static typename enable_if<is_integral<T>::value || is_enum<T>::value>::type
+    put(char *rec, size_t &pos, int &n, T v)
+    {
+        if (is_signed<T>::value || is_enum<T>::value)
+        {
+            int64_t x = (int64_t)v;
+            put_tagged(rec, pos, n, BINLOG_INT, &x);
+        }
+        else
+        {
+            uint64_t x = (uint64_t)v;
+            put_tagged(rec, pos, n, BINLOG_UINT, &x);
+        }
+    }
+    template <typename T>
+    static typename enable_if<is_floating_point<T>::value>::type
+    put(char *rec, size_t &pos, int &n, T v)
+    {
+        double x = v;
+        put_tagged(rec, pos, n, BINLOG_DOUBLE, &x);
+    }
+    template <typename T>
+    static void put(char *rec, size_t &pos, int &n, T *p)
+    {
+        uint64_t x = (uint64_t)(uintptr_t)p;
+        put_tagged(rec, pos, n, BINLOG_PTR, &x);
+    }
+    static void put(char *rec, size_t &pos, int &n, const char *s)
+    {
+        if (!reserve(pos, 3))
+            return;
+        size_t len = s ? strnlen(s, MAX_STR) : 0;
+        if (!reserve(pos, 3 + len))
+            len = MAX_RECORD - pos - 3;
+        uint16_t l = (uint16_t)len;
+        rec[pos] = BINLOG_STR;
+        memcpy(rec + pos + 1, &l, 2);
+        memcpy(rec + pos + 3, s, len);
+        pos += 3 + len;
+        ++n;
+    }
+    static void put(char *rec, size_t &pos, int &n, char *s)
+    {
+        put(rec, pos, n, (const char *)s);
+    }
+    static void put_args(char *, size_t &, int &) {}
+    template <typename T, typename... Rest>
+    static void put_args(char *rec, size_t &pos, int &n, T v, Rest... rest)
+    {
+        put(rec, pos, n, v);
+        put_args(rec, pos, n, rest...);
+    }
+
+    static bool s_enabled;
+
+    int m_fd;
+    char m_active[256];                     //正在写入的文件
+    int m_today;                            //当前文件所属的日期(yyyymmdd)，只由后台线程访问
+    long long m_size;                       //当前文件已写入的字节数
+    double m_tsc_hz;                        //写入每个文件头的TSC频率
+    log_archive m_archive;
+    locker m_lock;                          //保护m_rings和m_formats
+    vector<ring *> m_rings;
+    vector<pair<int, const char *> > m_formats;     //编号即下标
+    size_t m_formats_written;               //已写入文件的格式串个数，只由后台线程访问
+    string m_out;                           //后台线程的写缓冲
+    std::atomic<bool> m_stop;
+    pthread_t m_tid;
+};
+
+#endif
@@ -0,0 +1,190 @@
+//二进制日志的单元测试：各类型参数经binlog编码、写入文件后由logdecode的解码还原成原文，
+//以及格式串替换的边界、多线程写入、时间换算和不完整文件的处理
+//日志文件写在临时目录中，结束时删除
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "binlog.h"
+#include "../logdecode/binlog_decode.h"
+#include "../test/check.h"
+
+using namespace std;
+
+static const int THREAD_LINES = 1000;
+
+static string read_file(const string &path)
+{
+    string out;
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return out;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        out.append(buf, n);
+    fclose(fp);
+    return out;
+}
+
+static binlog_arg int_arg(long long v)
+{
+    binlog_arg a;
+    a.tag = BINLOG_INT;
+    a.u = (uint64_t)v;
+    a.d = 0;
+    return a;
+}
+
+static binlog_arg str_arg(const string &s)
+{
+    binlog_arg a;
+    a.tag = BINLOG_STR;
+    a.u = 0;
+    a.d = 0;
+    a.s = s;
+    return a;
+}
+
+static void test_render()
+{
+    vector<binlog_arg> args;
+    CHECK(binlog_render("plain 100%%", args) == "plain 100%");
+    CHECK(binlog_render("%d", args) == "<?>");
+
+    args.push_back(int_arg(42));
+    args.push_back(str_arg("ab"));
+    CHECK(binlog_render("%5d|%-3s|", args) == "   42|ab |");
+    CHECK(binlog_render("%ld %s %d", args) == "42 ab <?>");
+    CHECK(binlog_render("%s %d", args) == "<?> <?>");     //类型与转换不符
+    CHECK(binlog_render("%c%s", args) == "*ab");
+    CHECK(binlog_render("%03x", args) == "02a");
+    CHECK(binlog_render("tail %", args) == "tail %");
+    CHECK(binlog_render("%d%", args) == "42%");
+
+    args.clear();
+    args.push_back(str_arg(""));
+    CHECK(binlog_render("[%s]", args) == "[]");
+}
+
+static void *thread_writer(void *arg)
+{
+    int id = *(int *)arg;
+    for (int i = 0; i < THREAD_LINES; ++i)
+        binlog::GetInstance()->write(id, i);
+    return NULL;
+}
+
+//等后台线程把记录写进文件，最多等2秒
+static bool decode_when_ready(const string &path, size_t want, vector<binlog_line> &lines, string &data)
+{
+    for (int i = 0; i < 40; ++i)
+    {
+        usleep(binlog::DRAIN_MS * 1000);
+        data = read_file(path);
+        lines.clear();
+        if (binlog_decode(data.data(), data.size(), lines) && lines.size() >= want)
+            return true;
+    }
+    return false;
+}
+
+static void test_roundtrip(const string &base)
+{
+    binlog *log = binlog::GetInstance();
+    CHECK(log->init(base.c_str()));
+    CHECK(binlog::enabled());
+
+    int f_mixed = log->register_format(1, "user %s id %d uid %u hex %x");
+    int f_double = log->register_format(2, "load %.2f ratio %g");
+    int f_ptr = log->register_format(3, "conn %p fd %d");
+    int f_long = log->register_format(0, "%s");
+    int f_thread = log->register_format(1, "thread line %d");
+
+    string long_str(binlog::MAX_STR + 100, 'z');
+    time_t before = time(NULL);
+    log->write(f_mixed, "alice", -5, 7u, 255);
+    log->write(f_double, 3.14159, 0.5f);
+    log->write(f_ptr, (void *)0x1234, 9);
+    log->write(f_long, long_str.c_str());
+    log->write(f_mixed, (const char *)NULL, 1LL << 40, (unsigned long long)-1, (short)-1);
+    log->write(f_double);
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, thread_writer, &f_thread);
+    pthread_join(tid, NULL);
+
+    vector<binlog_line> lines;
+    string data;
+    const size_t total = 6 + THREAD_LINES;
+    CHECK(decode_when_ready(base + ".bin", total, lines, data));
+    CHECK(lines.size() == total);
+    if (lines.size() != total)
+        return;
+
+    CHECK(lines[0].text == "user alice id -5 uid 7 hex ff" && lines[0].level == 1);
+    CHECK(lines[1].text == "load 3.14 ratio 0.5" && lines[1].level == 2);
+    CHECK(lines[2].text == "conn 0x1234 fd 9" && lines[2].level == 3);
+    CHECK(lines[3].text == string(binlog::MAX_STR, 'z') && lines[3].level == 0);
+    CHECK(lines[4].text == "user  id 1099511627776 uid 18446744073709551615 hex ffffffffffffffff");
+    CHECK(lines[5].text == "load <?> ratio <?>");
+
+    //同一线程的记录保持写入顺序
+    int wrong = 0;
+    for (int i = 0; i < THREAD_LINES; ++i)
+    {
+        char want[32];
+        snprintf(want, sizeof(want), "thread line %d", i);
+        if (lines[6 + i].text != want || lines[6 + i].level != 1)
+            ++wrong;
+        if (i > 0 && lines[6 + i].tsc < lines[5 + i].tsc)
+            ++wrong;
+    }
+    CHECK(wrong == 0);
+
+    //换算出的时间与写入时的墙上时间相差不超过1秒
+    time_t after = time(NULL);
+    int off_clock = 0;
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        time_t sec = (time_t)(lines[i].ns / 1000000000LL);
+        if (sec < before - 1 || sec > after + 1)
+            ++off_clock;
+    }
+    CHECK(off_clock == 0);
+
+    //文件末尾的记录不完整时只丢弃这一条
+    vector<binlog_line> cut;
+    CHECK(binlog_decode(data.data(), data.size() - 3, cut));
+    CHECK(cut.size() == total - 1);
+
+    cut.clear();
+    CHECK(!binlog_decode("not a binlog", 12, cut));
+    CHECK(!binlog_decode(data.data(), sizeof(binlog_file_header) - 1, cut));
+    CHECK(binlog_decode(data.data(), sizeof(binlog_file_header), cut) && cut.empty());
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/binlog_test.XXXXXX";
+    if (!mkdtemp(tmpl))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    string dir = tmpl;
+    string base = dir + "/ServerLog";
+
+    test_render();
+    test_roundtrip(base);
+
+    //后台线程在进程退出时才结束，文件先删掉，之后的写入落在已删除的文件上
+    unlink((base + ".bin").c_str());
+    rmdir(dir.c_str());
+    return check_report("binlog_test");
+}
@@ -0,0 +1,278 @@
+#include <time.h>
+#include "buffered_sink.h"
+
+buffered_sink::buffered_sink() : m_line_size(0), m_max_full(0), m_dropped(0), m_flush(false), m_stop(false), m_started(false)
+{
+    if (pthread_key_create(&m_key, thread_exit) != 0)
+        throw std::exception();
+}
+
+//后台线程已停止，剩下的缓冲区都已写出，只需释放
+buffered_sink::~buffered_sink()
+{
+    pthread_key_delete(m_key);
+    for (size_t i = 0; i < m_threads.size(); ++i)
+    {
+        free_buffer(m_threads[i]->cur);
+        if (m_threads[i]->spare)
+            free_buffer(m_threads[i]->spare);
+        delete m_threads[i];
+    }
+    for (size_t i = 0; i < m_free.size(); ++i)
+        free_buffer(m_free[i]);
+}
+
+buffered_sink::buffer *buffered_sink::new_buffer()
+{
+    buffer *b = new buffer;
+    b->data = new char[BUFFER_SIZE];
+    b->len = 0;
+    b->lines = 0;
+    return b;
+}
+
+void buffered_sink::free_buffer(buffer *b)
+{
+    delete[] b->data;
+    delete b;
+}
+
+void buffered_sink::thread_exit(void *arg)
+{
+    thread_buffer *tb = (thread_buffer *)arg;
+    tb->lock.lock();
+    tb->exited = true;
+    tb->lock.unlock();
+}
+
+bool buffered_sink::start(int line_size, int max_full)
+{
+    //单行必须能放进空缓冲区
+    m_line_size = line_size < BUFFER_SIZE ? line_size : BUFFER_SIZE;
+    m_max_full = max_full;
+    m_started = pthread_create(&m_tid, NULL, worker, this) == 0;
+    return m_started;
+}
+
+void buffered_sink::stop()
+{
+    if (!m_started)
+        return;
+    m_lock.lock();
+    m_stop = true;
+    m_cond.signal();
+    m_lock.unlock();
+    pthread_join(m_tid, NULL);
+    m_started = false;
+}
+
+void buffered_sink::flush_now()
+{
+    m_lock.lock();
+    m_flush = true;
+    m_cond.signal();
+    m_lock.unlock();
+}
+
+//首次写入的线程分配并注册自己的缓冲区
+buffered_sink::thread_buffer *buffered_sink::local_buffer()
+{
+    thread_buffer *tb = (thread_buffer *)pthread_getspecific(m_key);
+    if (!tb)
+    {
+        tb = new thread_buffer;
+        tb->cur = new_buffer();
+        tb->spare = new_buffer();
+        tb->exited = false;
+        m_lock.lock();
+        m_threads.push_back(tb);
+        m_lock.unlock();
+        pthread_setspecific(m_key, tb);
+    }
+    return tb;
+}
+
+char *buffered_sink::begin_line()
+{
+    thread_buffer *tb = local_buffer();
+    tb->lock.lock();
+    //剩余空间可能放不下一行时，把当前缓冲区交给后台线程，换上备用的
+    if (BUFFER_SIZE - tb->cur->len < m_line_size)
+    {
+        m_lock.lock();
+        if ((int)m_full.size() < m_max_full)
+        {
+            m_full.push_back(tb->cur);
+            tb->cur = NULL;
+        }
+        else
+        {
+            //后台线程跟不上，丢弃整块缓冲区，由后台线程补记丢弃的行数
+            m_dropped += tb->cur->lines;
+            tb->cur->len = 0;
+            tb->cur->lines = 0;
+        }
+        if (!tb->cur && tb->spare)
+        {
+            tb->cur = tb->spare;
+            tb->spare = NULL;
+        }
+        else if (!tb->cur && !m_free.empty())
+        {
+            tb->cur = m_free.back();
+            m_free.pop_back();
+        }
+        m_cond.signal();
+        m_lock.unlock();
+        //备用和空闲的都用完时才分配，不在全局锁内
+        if (!tb->cur)
+            tb->cur = new_buffer();
+    }
+    return tb->cur->data + tb->cur->len;
+}
+
+void buffered_sink::end_line(int len)
+{
+    thread_buffer *tb = (thread_buffer *)pthread_getspecific(m_key);
+    tb->cur->len += len;
+    tb->cur->lines++;
+    tb->lock.unlock();
+}
+
+void buffered_sink::sweep(vector<buffer *> &bufs, vector<thread_buffer *> &alive)
+{
+    m_lock.lock();
+    vector<thread_buffer *> threads = m_threads;
+    m_lock.unlock();
+
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        thread_buffer *tb = threads[i];
+        buffer *fresh = NULL;
+        tb->lock.lock();
+        bool exited = tb->exited;
+        if (exited)
+        {
+            bufs.push_back(tb->cur);
+            if (tb->spare)
+                bufs.push_back(tb->spare);
+        }
+        else if (tb->cur->len > 0 && tb->spare)
+        {
+            bufs.push_back(tb->cur);
+            tb->cur = tb->spare;
+            tb->spare = NULL;
+        }
+        else if (tb->cur->len > 0)
+            fresh = tb->cur;
+        tb->lock.unlock();
+
+        //没有备用缓冲区时在锁外分配一块再换；其间该线程已自行换过缓冲区的，新分配的留作空闲
+        if (fresh)
+        {
+            buffer *b = new_buffer();
+            tb->lock.lock();
+            if (tb->cur == fresh)
+            {
+                bufs.push_back(fresh);
+                tb->cur = b;
+            }
+            else
+                bufs.push_back(b);
+            tb->lock.unlock();
+        }
+        if (!exited)
+        {
+            alive.push_back(tb);
+            continue;
+        }
+        m_lock.lock();
+        for (size_t j = 0; j < m_threads.size(); ++j)
+        {
+            if (m_threads[j] == tb)
+            {
+                m_threads.erase(m_threads.begin() + j);
+                break;
+            }
+        }
+        m_lock.unlock();
+        delete tb;
+    }
+}
+
+void *buffered_sink::worker(void *arg)
+{
+    ((buffered_sink *)arg)->run();
+    return NULL;
+}
+
+void buffered_sink::run()
+{
+    vector<buffer *> bufs;
+    time_t last_sweep = time(NULL);
+    bool stop = false;
+    while (!stop)
+    {
+        m_lock.lock();
+        if (m_full.empty() && !m_stop && !m_flush)
+        {
+            struct timespec t;
+            clock_gettime(CLOCK_REALTIME, &t);
+            t.tv_sec += FLUSH_INTERVAL;
+            m_cond.timewait(m_lock.get(), t);
+        }
+        stop = m_stop;
+        //满缓冲区源源不断时只写满的，每隔FLUSH_INTERVAL秒或被flush_now唤醒时才换下各线程未写满的缓冲区
+        time_t now = time(NULL);
+        bool swept = stop || m_flush || now - last_sweep >= FLUSH_INTERVAL;
+        m_flush = false;
+        bufs.swap(m_full);
+        long long dropped = m_dropped;
+        m_dropped = 0;
+        m_lock.unlock();
+
+        vector<thread_buffer *> alive;
+        if (swept)
+        {
+            last_sweep = now;
+            sweep(bufs, alive);
+        }
+        else
+        {
+            m_lock.lock();
+            alive = m_threads;
+            m_lock.unlock();
+        }
+
+        write_buffers(bufs);
+        for (size_t i = 0; i < bufs.size(); ++i)
+        {
+            bufs[i]->len = 0;
+            bufs[i]->lines = 0;
+        }
+        after_write(dropped);
+
+        //写完的缓冲区先补给没有备用缓冲区的线程，其余放回空闲列表
+        for (size_t i = 0; i < alive.size() && !bufs.empty(); ++i)
+        {
+            thread_buffer *tb = alive[i];
+            tb->lock.lock();
+            if (!tb->spare)
+            {
+                tb->spare = bufs.back();
+                bufs.pop_back();
+            }
+            tb->lock.unlock();
+        }
+        m_lock.lock();
+        for (size_t i = 0; i < bufs.size(); ++i)
+        {
+            if (m_free.size() < FREE_BUFFERS)
+                m_free.push_back(bufs[i]);
+            else
+                free_buffer(bufs[i]);
+        }
+        m_lock.unlock();
+        bufs.clear();
+    }
+}
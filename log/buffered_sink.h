@@ -0,0 +1,86 @@
+/*************************************************************
+*按线程缓冲的日志写入，调试日志和访问日志共用
+*每个线程有自己的追加缓冲区和一块备用缓冲区，写一行只锁本线程的缓冲区，互不竞争
+*缓冲区写满时交给后台线程并换上备用的；后台线程每隔FLUSH_INTERVAL秒也会把各线程未写满的缓冲区换下来
+*后台线程把取到的缓冲区交给派生类写出，写完后作为备用缓冲区还给各线程，多余的留作空闲或释放
+*线程退出时标记其缓冲区，后台线程写完其中的内容后回收
+**************************************************************/
+
+#ifndef BUFFERED_SINK_H
+#define BUFFERED_SINK_H
+
+#include <pthread.h>
+#include <vector>
+#include "../lock/locker.h"
+
+using namespace std;
+
+class buffered_sink
+{
+public:
+    static const int BUFFER_SIZE = 64 * 1024;   //每个线程追加缓冲区的大小
+    static const int FLUSH_INTERVAL = 1;        //后台线程最长多久写一次(秒)
+    static const size_t FREE_BUFFERS = 16;      //后台线程最多保留的空闲缓冲区个数
+
+protected:
+    struct buffer
+    {
+        char *data;
+        int len;
+        long long lines;
+    };
+
+    buffered_sink();
+    virtual ~buffered_sink();
+
+    //启动后台线程；line_size为单行的最大长度，max_full为等待写入的满缓冲区个数上限，超出时丢弃整块缓冲区
+    bool start(int line_size, int max_full);
+    //后台线程写完所有缓冲区后退出；派生类须在自己析构之前调用，之后不再回调派生类
+    void stop();
+    //锁住本线程的缓冲区并保证至少有line_size字节可写，返回写入位置；写完后调用end_line
+    char *begin_line();
+    //提交刚写入的len字节(一行)并解锁
+    void end_line(int len);
+    //唤醒后台线程，立即换下并写出各线程的缓冲区
+    void flush_now();
+
+    //由后台线程调用，按顺序写出一批缓冲区，写完后由基类清空
+    virtual void write_buffers(const vector<buffer *> &bufs) = 0;
+    //由后台线程在每一轮写完之后调用，即使没有可写的内容；dropped为这期间丢弃的行数
+    virtual void after_write(long long dropped) {}
+
+private:
+    struct thread_buffer
+    {
+        locker lock;
+        buffer *cur;            //正在追加的缓冲区
+        buffer *spare;          //备用缓冲区，为NULL时表示在后台线程手中
+        bool exited;            //所属线程已退出，后台线程写完后释放
+    };
+
+    static buffer *new_buffer();
+    static void free_buffer(buffer *b);
+    //线程退出时由pthread调用，标记其缓冲区
+    static void thread_exit(void *arg);
+    thread_buffer *local_buffer();
+    //换下各线程未写满的缓冲区放入bufs；已退出的线程取走全部缓冲区后释放，其余的放入alive
+    void sweep(vector<buffer *> &bufs, vector<thread_buffer *> &alive);
+    static void *worker(void *arg);
+    void run();
+
+    pthread_key_t m_key;                //每个实例各自的线程缓冲区
+    int m_line_size;
+    int m_max_full;
+    locker m_lock;                      //保护以下各成员，只在交换缓冲区时加锁
+    cond m_cond;                        //有满缓冲区或需要刷新时唤醒后台线程
+    vector<thread_buffer *> m_threads;  //已注册的线程缓冲区
+    vector<buffer *> m_full;            //等待写入的满缓冲区
+    vector<buffer *> m_free;            //空闲缓冲区
+    long long m_dropped;                //后台线程跟不上而丢弃的行数
+    bool m_flush;                       //flush_now()请求立即换下各线程的缓冲区
+    bool m_stop;
+    bool m_started;
+    pthread_t m_tid;
+};
+
+#endif
@@ -0,0 +1,208 @@
+//按线程缓冲写入的单元测试：多线程写入不丢不乱、线程退出后缓冲区照常写出、flush立即写出、
+//满缓冲区超出上限时丢弃并计数，以及同一线程写两个实例时互不混淆
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "buffered_sink.h"
+#include "../test/check.h"
+
+using namespace std;
+
+static const int THREADS = 8;
+static const int PER_THREAD = 20000;
+
+//写出的内容收集在内存中
+class memory_sink : public buffered_sink
+{
+public:
+    memory_sink() : m_lines(0), m_dropped(0), m_rounds(0) {}
+    ~memory_sink() { stop(); }
+
+    bool start(int line_size, int max_full) { return buffered_sink::start(line_size, max_full); }
+    void stop() { buffered_sink::stop(); }
+    void flush_now() { buffered_sink::flush_now(); }
+    void write(const char *line)
+    {
+        int len = strlen(line);
+        memcpy(begin_line(), line, len);
+        end_line(len);
+    }
+
+    string text()
+    {
+        m_lock.lock();
+        string s = m_text;
+        m_lock.unlock();
+        return s;
+    }
+    long long lines()
+    {
+        m_lock.lock();
+        long long n = m_lines;
+        m_lock.unlock();
+        return n;
+    }
+    long long dropped()
+    {
+        m_lock.lock();
+        long long n = m_dropped;
+        m_lock.unlock();
+        return n;
+    }
+
+private:
+    void write_buffers(const vector<buffer *> &bufs)
+    {
+        m_lock.lock();
+        for (size_t i = 0; i < bufs.size(); ++i)
+        {
+            m_text.append(bufs[i]->data, bufs[i]->len);
+            m_lines += bufs[i]->lines;
+        }
+        m_lock.unlock();
+    }
+    void after_write(long long dropped)
+    {
+        m_lock.lock();
+        m_dropped += dropped;
+        ++m_rounds;
+        m_lock.unlock();
+    }
+
+    locker m_lock;
+    string m_text;
+    long long m_lines;
+    long long m_dropped;
+    long long m_rounds;
+};
+
+struct writer_arg
+{
+    memory_sink *sink;
+    int id;
+};
+
+static void *writer(void *arg)
+{
+    writer_arg *w = (writer_arg *)arg;
+    char line[64];
+    for (int i = 0; i < PER_THREAD; ++i)
+    {
+        snprintf(line, sizeof(line), "%d %d\n", w->id, i);
+        w->sink->write(line);
+    }
+    return NULL;
+}
+
+//每个线程的行都在，且保持写入顺序
+static int check_order(const string &text, int threads, int per_thread)
+{
+    vector<int> next(threads, 0);
+    int wrong = 0;
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        size_t end = text.find('\n', pos);
+        if (end == string::npos)
+            return wrong + 1;
+        int id, seq;
+        if (sscanf(text.c_str() + pos, "%d %d", &id, &seq) != 2 || id < 0 || id >= threads || seq != next[id])
+            ++wrong;
+        else
+            ++next[id];
+        pos = end + 1;
+    }
+    for (int t = 0; t < threads; ++t)
+    {
+        if (next[t] != per_thread)
+            ++wrong;
+    }
+    return wrong;
+}
+
+static bool wait_lines(memory_sink &sink, long long want, int ms)
+{
+    for (int i = 0; i < ms / 10; ++i)
+    {
+        if (sink.lines() >= want)
+            return true;
+        usleep(10000);
+    }
+    return sink.lines() >= want;
+}
+
+//写入的线程全部退出后，不等stop，后台线程也会写出并回收它们的缓冲区
+static void test_threads()
+{
+    memory_sink sink;
+    CHECK(sink.start(64, 1024));
+    pthread_t tids[THREADS];
+    writer_arg args[THREADS];
+    for (int t = 0; t < THREADS; ++t)
+    {
+        args[t].sink = &sink;
+        args[t].id = t;
+        pthread_create(&tids[t], NULL, writer, &args[t]);
+    }
+    for (int t = 0; t < THREADS; ++t)
+        pthread_join(tids[t], NULL);
+
+    CHECK(wait_lines(sink, THREADS * PER_THREAD, 3000 * buffered_sink::FLUSH_INTERVAL));
+    CHECK(sink.lines() == THREADS * PER_THREAD);
+    CHECK(check_order(sink.text(), THREADS, PER_THREAD) == 0);
+    CHECK(sink.dropped() == 0);
+}
+
+static void test_flush()
+{
+    memory_sink sink;
+    CHECK(sink.start(64, 16));
+    sink.write("0 0\n");
+    sink.flush_now();
+    //远早于FLUSH_INTERVAL
+    CHECK(wait_lines(sink, 1, 300));
+    sink.write("0 1\n");
+    sink.stop();
+    CHECK(sink.text() == "0 0\n0 1\n");
+}
+
+//没有满缓冲区的名额时整块丢弃，写出的加丢弃的等于写入的行数
+static void test_drop()
+{
+    memory_sink sink;
+    CHECK(sink.start(64, 0));
+    const int n = buffered_sink::BUFFER_SIZE / 8 * 3;
+    for (int i = 0; i < n; ++i)
+        sink.write("0 0 abc\n");
+    sink.stop();
+    CHECK(sink.dropped() > 0);
+    CHECK(sink.lines() + sink.dropped() == n);
+    CHECK(sink.lines() < n);
+}
+
+//同一线程写两个实例，各自的缓冲区互不影响
+static void test_two_sinks()
+{
+    memory_sink a, b;
+    CHECK(a.start(64, 16) && b.start(64, 16));
+    a.write("a\n");
+    b.write("b\n");
+    a.write("a\n");
+    a.stop();
+    b.stop();
+    CHECK(a.text() == "a\na\n");
+    CHECK(b.text() == "b\n");
+}
+
+int main()
+{
+    test_threads();
+    test_flush();
+    test_drop();
+    test_two_sinks();
+    return check_report("buffered_sink_test");
+}
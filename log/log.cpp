@@ -2,172 +2,236 @@
 #include <time.h>
 #include <sys/time.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
 #include "log.h"
 #include <pthread.h>
 using namespace std;
 
+std::atomic<int> Log::s_level(0);
+
+static bool write_all(int fd, const char *data, int len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
 Log::Log()
 {
     m_count = 0;
     m_is_async = false;
+    m_ring = false;
+    m_fd = -1;
+    m_today = 0;
+    memset(m_active, '\0', sizeof(m_active));
 }
 
 Log::~Log()
 {
-    if (m_fp != NULL)
+    //m_fd可能正被后台线程替换，在锁内判断
+    m_mutex.lock();
+    bool running = m_fd >= 0;
+    m_mutex.unlock();
+    if (running)
     {
-        fclose(m_fp);
+        stop();                         //后台线程退出前写完所有缓冲区
+        m_archive.stop();
+        close(m_fd);
     }
 }
-//异步需要设置阻塞队列的长度，同步不需要设置
-bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size)
-{
-    //如果设置了max_queue_size,则设置为异步
-    if (max_queue_size >= 1)
-    {
-        m_is_async = true;
-        m_log_queue = new block_queue<string>(max_queue_size);
-        pthread_t tid;
 
-        //flush_log_thread为回调函数,这里表示创建线程异步写日志
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
-    }
-    
+//max_queue_size不小于1时为异步，同步不需要设置
+bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size,
+               int max_files, long long max_bytes)
+{
     m_close_log = close_log;
-    m_log_buf_size = log_buf_size;
-    m_buf = new char[m_log_buf_size];        //缓冲区
-    memset(m_buf, '\0', m_log_buf_size);           
+    //单条日志必须能放进线程缓冲区的剩余空间
+    m_log_buf_size = log_buf_size < BUFFER_SIZE / 4 ? log_buf_size : BUFFER_SIZE / 4;
     m_split_lines = split_lines;             //日志最大行数
+    snprintf(m_active, sizeof(m_active), "%s", file_name);
 
+    //沿用上次运行留下的文件时按它的修改日期记录，跨天的话后台线程启动后立即归档
     time_t t = time(NULL);
-    struct tm *sys_tm = localtime(&t);      //获取当前时间
-    struct tm my_tm = *sys_tm;
-
-    // 查找一个字符串在另一个字符串中末次出现的位置，并返回从字符串中的这个位置起，一直到字符串结束的所有字符；
-    const char *p = strrchr(file_name, '/');
-    char log_full_name[256] = {0};
+    struct stat st;
+    if (stat(m_active, &st) == 0)
+        t = st.st_mtime;
+    m_today = log_archive::date_of(t);
 
-    if (p == NULL)
-    {
-        snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
-    }
-    else
+    //创建/打开 日志文件
+    m_fd = open(m_active, O_WRONLY | O_APPEND | O_CREAT, 0666);
+    if (m_fd < 0)
     {
-        strcpy(log_name, p + 1);
-        strncpy(dir_name, file_name, p - file_name + 1);
-        snprintf(log_full_name, 255, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
+        return false;
     }
 
-    m_today = my_tm.tm_mday;
-    
-    //创建/打开 日志文件
-    m_fp = fopen(log_full_name, "a");
-    if (m_fp == NULL)
+    m_is_async = max_queue_size >= 1;
+    //归档的压缩和清理在单独的低优先级线程中，须在后台线程第一次切分之前就绪
+    m_archive.init(m_active, max_files, max_bytes);
+    //后台线程异步时写日志，同步时只负责切分文件；max_queue_size为等待写入的满缓冲区个数上限
+    if (!start(m_log_buf_size, m_is_async ? max_queue_size : 0))
     {
+        m_archive.stop();
+        close(m_fd);
+        m_fd = -1;
+        m_is_async = false;
         return false;
     }
-
     return true;
 }
 
-void Log::write_log(int level, const char *format, ...)
+bool Log::init_ring(const char *file_name, int close_log, int log_buf_size, size_t ring_size)
+{
+    m_close_log = close_log;
+    m_log_buf_size = log_buf_size < BUFFER_SIZE / 4 ? log_buf_size : BUFFER_SIZE / 4;
+    m_ring = ringlog::GetInstance()->init(file_name, ring_size);
+    return m_ring;
+}
+
+//格式化一条日志写入dst，返回包括换行符在内的长度，超出cap的部分截断
+//时间前缀按秒缓存在线程局部变量中，同一秒内不再调用localtime
+int Log::format_line(char *dst, int cap, int level, const char *format, va_list valst)
 {
+    static thread_local time_t last_sec = 0;
+    static thread_local char prefix[32];
     struct timeval now = {0, 0};
     gettimeofday(&now, NULL);
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
-    char s[16] = {0};
+    if (now.tv_sec != last_sec)
+    {
+        struct tm my_tm;
+        localtime_r(&now.tv_sec, &my_tm);
+        //strftime放不下时返回0而不是截断，prefix留空
+        if (strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &my_tm) == 0)
+            prefix[0] = '\0';
+        last_sec = now.tv_sec;
+    }
+    const char *s;
     switch (level)
     {
     case 0:
-        strcpy(s, "[debug]:");
-        break;
-    case 1:
-        strcpy(s, "[info]:");
+        s = "[debug]:";
         break;
     case 2:
-        strcpy(s, "[warn]:");
+        s = "[warn]:";
         break;
     case 3:
-        strcpy(s, "[erro]:");
+        s = "[erro]:";
         break;
     default:
-        strcpy(s, "[info]:");
+        s = "[info]:";
         break;
     }
-    //写入一个log，对m_count++, m_split_lines为最大行数
-    m_mutex.lock();
-    m_count++;
 
-    //若当前day不为创建日志时间 或者 行数超过最大行限制
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) //everyday log
+    //写入的具体时间内容格式
+    int n = snprintf(dst, cap, "%s.%06ld %s ", prefix, (long)now.tv_usec, s);
+    //内容格式化，返回值是未截断时的长度
+    int m = vsnprintf(dst + n, cap - n - 1, format, valst);
+    if (m < 0)
+        m = 0;
+    if (m > cap - n - 2)
+        m = cap - n - 2;
+    dst[n + m] = '\n';
+    return n + m + 1;
+}
+
+void Log::write_log(int level, const char *format, ...)
+{
+    va_list valst;
+    va_start(valst, format);
+
+    //同步：在本线程的缓冲区格式化，只在写文件时加锁；环形文件不加锁，直接拷进映射区
+    if (!m_is_async)
     {
-        
-        char new_log[256] = {0};
-        fflush(m_fp);
-        fclose(m_fp);
-        char tail[16] = {0};
-       
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
-       
-        if (m_today != my_tm.tm_mday)
+        static thread_local vector<char> line;
+        line.resize(m_log_buf_size);
+        int n = format_line(&line[0], m_log_buf_size, level, format, valst);
+        if (m_ring)
         {
-            //按当前时间创建新log，更新创建时间和行数
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday;
-            m_count = 0;
+            ringlog::GetInstance()->append(&line[0], n);
         }
         else
         {
-            //若行数超过最大行限制，在当前日志的末尾加count/max_lines为后缀创建新log
-            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
+            m_mutex.lock();
+            write_all(m_fd, &line[0], n);
+            m_mutex.unlock();
+            m_count++;
         }
-        m_fp = fopen(new_log, "a");
+        va_end(valst);
+        return;
     }
- 
-    m_mutex.unlock();
-
-    va_list valst;
-    va_start(valst, format);
-
-    string log_str;
-    m_mutex.lock();
 
-    //写入的具体时间内容格式
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
-                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
+    char *dst = begin_line();
+    end_line(format_line(dst, m_log_buf_size, level, format, valst));
 
-    //内容格式化，用于向字符串中打印数据、数据格式用户自定义，返回写入到字符数组str中的字符个数(不包含终止符)
-    //可变参数格式化输出到一个字符数组
-    int m = vsnprintf(m_buf + n, m_log_buf_size - n - 1, format, valst);
-    m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
+    va_end(valst);
+}
 
-    m_mutex.unlock();
+//按天或按行数切分日志文件，只由后台线程调用
+void Log::rotate()
+{
+    int today = log_archive::date_of(time(NULL));
+    if (today == m_today && m_count < m_split_lines)
+        return;
 
-    //异步，则放于阻塞队列中
-    if (m_is_async && !m_log_queue->full())
+    //改名失败则继续写原文件，等下一次切分
+    if (m_archive.archive(m_today))
     {
-        m_log_queue->push(log_str);
+        int fd = open(m_active, O_WRONLY | O_APPEND | O_CREAT, 0666);
+        if (fd >= 0)
+        {
+            m_mutex.lock();
+            int old = m_fd;
+            m_fd = fd;
+            m_mutex.unlock();
+            close(old);
+        }
     }
-    //同步则直接写入文件中
-    else
+    m_today = today;
+    m_count = 0;
+}
+
+void Log::write_buffers(const vector<buffer *> &bufs)
+{
+    for (size_t i = 0; i < bufs.size(); ++i)
     {
-        m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
-        m_mutex.unlock();
+        buffer *b = bufs[i];
+        if (b->len > 0)
+        {
+            rotate();
+            write_all(m_fd, b->data, b->len);
+            m_count += b->lines;
+        }
     }
+}
 
-    va_end(valst);
+void Log::after_write(long long dropped)
+{
+    rotate();               //没有日志可写时也按时跨天切分
+    if (dropped > 0)
+        write_log(2, "log buffers full, dropped %lld lines", dropped);
+}
+
+void Log::set_level(int level)
+{
+    if (level < 0)
+        level = 0;
+    if (level > 3)
+        level = 3;
+    s_level.store(level, std::memory_order_relaxed);
 }
 
 void Log::flush(void)
 {
-    m_mutex.lock();
-    //强制刷新写入流缓冲区
-    fflush(m_fp);
-    m_mutex.unlock();
+    if (m_is_async)
+        flush_now();
 }
@@ -4,13 +4,25 @@
 #include <stdio.h>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <stdarg.h>
 #include <pthread.h>
-#include "block_queue.h"
+#include <time.h>
+#include <atomic>
+#include "../lock/locker.h"
+#include "binlog.h"
+#include "ringlog.h"
+#include "log_archive.h"
+#include "buffered_sink.h"
 
 using namespace std;
 
-class Log
+/*************************************************************
+*异步模式采用buffered_sink的按线程双缓冲，写日志只锁本线程的缓冲区，后台线程把取到的缓冲区用大块write写入文件
+*日志始终写入固定名字的文件，按天或按行数切分时由后台线程把它改名归档，再在原名下新建文件换掉m_fd
+*归档文件由低优先级的压缩线程gzip压缩，并按个数和总大小清理最旧的归档，写日志的线程从不打开或关闭文件
+**************************************************************/
+class Log : private buffered_sink
 {
 public:
     //C++11以后,使用局部变量懒汉不用加锁
@@ -20,51 +32,62 @@ public:
         return &instance;
     }
 
-    static void *flush_log_thread(void *args)
-    {
-        Log::get_instance()->async_write_log();
-    }
-    //可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
-    bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0);
+    //可选择的参数有日志文件、单条日志的最大长度、最大行数以及等待写入的满缓冲区个数上限
+    //max_queue_size不小于1时为异步，超过上限时丢弃整块缓冲区并记录丢弃的行数
+    //max_files、max_bytes为压缩后归档文件的保留个数和总字节数，0表示不限
+    bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0,
+              int max_files = 0, long long max_bytes = 0);
+    //写入内存映射的环形文件：调用线程格式化后直接拷进环中，没有后台线程，也不切分文件
+    bool init_ring(const char *file_name, int close_log, int log_buf_size, size_t ring_size);
 
     void write_log(int level, const char *format, ...);
 
+    //异步时唤醒后台线程立即写入；同步时每条日志直接write，没有用户态缓冲
     void flush(void);
 
+    //运行时日志级别(0 debug ~ 3 error)，低于该级别的日志连参数都不求值，可随时修改
+    static int level() { return s_level.load(std::memory_order_relaxed); }
+    static void set_level(int level);
+
 private:
     Log();
     virtual ~Log();
-    void *async_write_log()
-    {
-        string single_log;
-        //从阻塞队列中取出一个日志string，写入文件
-        while (m_log_queue->pop(single_log))
-        {
-            m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
-        }
-    }
+
+    int format_line(char *dst, int cap, int level, const char *format, va_list valst);
+    void rotate();
+    //后台线程：异步时写出各线程的缓冲区，同步时只负责切分文件
+    void write_buffers(const vector<buffer *> &bufs);
+    void after_write(long long dropped);
 
 private:
-    char dir_name[128];     //路径名
-    char log_name[128];     //log文件名
+    char m_active[256];     //正在写入的文件，切分时改名归档
     int m_split_lines;      //日志最大行数
-    int m_log_buf_size;     //日志缓冲区大小
-    long long m_count;      //日志行数记录
-    int m_today;            //因为按天分类,记录当前时间是那一天
-    FILE *m_fp;             //打开log的文件指针
-    char *m_buf;            //缓冲区
-    block_queue<string> *m_log_queue; //阻塞队列
+    int m_log_buf_size;     //单条日志的最大长度
+    std::atomic<long long> m_count;   //当前文件的行数
+    int m_today;            //当前文件所属的日期(yyyymmdd)，只由后台线程访问
+    int m_fd;               //日志文件描述符，后台线程切分时在m_mutex内替换
     bool m_is_async;                  //是否同步标志位
-    locker m_mutex;
+    bool m_ring;                      //是否写入环形文件
+    locker m_mutex;                   //保护m_fd的替换，同步模式下串行化写文件
+    log_archive m_archive;            //归档的压缩和清理
     int m_close_log; //是否关闭日志
+    static std::atomic<int> s_level;
 };
 
+//编译期最低日志级别，低于它的调用点是常量假条件，整体被编译器消除：make LOG_MIN_LEVEL=1
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
 //全局函数
-#define LOG_DEBUG(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(0, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_INFO(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(1, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_WARN(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(2, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_ERROR(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(3, format, ##__VA_ARGS__); Log::get_instance()->flush();}
+//级别判断在参数求值之前，被过滤的日志不调用参数中的函数
+//启用二进制日志时，每个调用点首次执行时登记格式串，之后只记录编号和原始参数
+#define LOG_WRITE(lvl, format, ...) if((lvl) >= LOG_MIN_LEVEL && 0 == m_close_log && (lvl) >= Log::level()) { \
+    if (binlog::enabled()) {static const int log_fmt_id = binlog::GetInstance()->register_format(lvl, format); binlog::GetInstance()->write(log_fmt_id, ##__VA_ARGS__);} \
+    else {Log::get_instance()->write_log(lvl, format, ##__VA_ARGS__);}}
+#define LOG_DEBUG(format, ...) LOG_WRITE(0, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_WRITE(1, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_WRITE(2, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_WRITE(3, format, ##__VA_ARGS__)
 
 #endif
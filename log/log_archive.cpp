@@ -0,0 +1,265 @@
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <zlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "log_archive.h"
+
+using namespace std;
+
+static const int GZIP_CHUNK = 64 * 1024;    //压缩时每次读入的字节数
+
+enum ARCHIVE_KIND
+{
+    NOT_ARCHIVE = 0,
+    ARCHIVE_PLAIN,          //刚切分出来，还未压缩
+    ARCHIVE_GZ,
+    ARCHIVE_TMP             //压缩中途退出留下的临时文件
+};
+
+struct archive_file
+{
+    string path;
+    long long mtime;        //修改时间(纳秒)
+    long long size;
+};
+
+//归档文件名为yyyy_mm_dd_<log_name>[.N][.gz]，其他文件(包括别的日志的归档)一律不动
+static int archive_kind(const char *name, const char *log_name)
+{
+    for (int i = 0; i < 11; ++i)
+    {
+        bool sep = i == 4 || i == 7 || i == 10;
+        if (sep ? name[i] != '_' : !isdigit((unsigned char)name[i]))
+            return NOT_ARCHIVE;
+    }
+    size_t len = strlen(log_name);
+    if (strncmp(name + 11, log_name, len) != 0)
+        return NOT_ARCHIVE;
+    const char *p = name + 11 + len;
+    if (p[0] == '.' && isdigit((unsigned char)p[1]))
+    {
+        ++p;
+        while (isdigit((unsigned char)*p))
+            ++p;
+    }
+    if (*p == '\0')
+        return ARCHIVE_PLAIN;
+    if (strcmp(p, ".gz") == 0)
+        return ARCHIVE_GZ;
+    if (strcmp(p, ".gz.tmp") == 0)
+        return ARCHIVE_TMP;
+    return NOT_ARCHIVE;
+}
+
+//压缩成path.gz，先写临时文件再改名，成功后删除原文件；stop置位时放弃，下次启动再压缩
+static bool gzip_file(const char *path, const std::atomic<bool> &stop)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return false;
+    string gz = string(path) + ".gz";
+    string tmp = gz + ".tmp";
+    int in = open(path, O_RDONLY);
+    if (in < 0)
+        return false;
+    gzFile out = gzopen(tmp.c_str(), "wb6");
+    if (!out)
+    {
+        close(in);
+        return false;
+    }
+    vector<char> buf(GZIP_CHUNK);
+    bool ok = true;
+    ssize_t n;
+    while ((n = read(in, &buf[0], buf.size())) != 0)
+    {
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 || stop || gzwrite(out, &buf[0], n) != n)
+        {
+            ok = false;
+            break;
+        }
+    }
+    close(in);
+    if (gzclose(out) != Z_OK)
+        ok = false;
+    //保留原文件的修改时间，清理时按它判断新旧
+    struct timespec times[2] = {st.st_atim, st.st_mtim};
+    if (!ok || utimensat(AT_FDCWD, tmp.c_str(), times, 0) != 0 || rename(tmp.c_str(), gz.c_str()) != 0)
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+    unlink(path);
+    return true;
+}
+
+static bool newer_first(const archive_file &a, const archive_file &b)
+{
+    return a.mtime > b.mtime;
+}
+
+log_archive::log_archive() : m_max_files(0), m_max_bytes(0), m_stop(false), m_started(false)
+{
+    memset(m_dir, '\0', sizeof(m_dir));
+    memset(m_name, '\0', sizeof(m_name));
+    memset(m_active, '\0', sizeof(m_active));
+}
+
+log_archive::~log_archive()
+{
+    stop();
+}
+
+int log_archive::date_of(time_t t)
+{
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    return (my_tm.tm_year + 1900) * 10000 + (my_tm.tm_mon + 1) * 100 + my_tm.tm_mday;
+}
+
+bool log_archive::init(const char *active, int max_files, long long max_bytes)
+{
+    m_max_files = max_files;
+    m_max_bytes = max_bytes;
+    const char *p = strrchr(active, '/');
+    if (p == NULL)
+    {
+        strncpy(m_name, active, sizeof(m_name) - 1);
+    }
+    else
+    {
+        strncpy(m_name, p + 1, sizeof(m_name) - 1);
+        snprintf(m_dir, sizeof(m_dir), "%.*s", (int)(p - active + 1), active);
+    }
+    snprintf(m_active, sizeof(m_active), "%s%s", m_dir, m_name);
+
+    m_sem.post();
+    m_started = pthread_create(&m_tid, NULL, worker, this) == 0;
+    return m_started;
+}
+
+void log_archive::stop()
+{
+    if (!m_started)
+        return;
+    m_started = false;
+    m_stop = true;
+    m_sem.post();
+    pthread_join(m_tid, NULL);
+}
+
+//归档名沿用原来的日期前缀命名，同一天切分多次时依次加.1、.2后缀，跳过已存在或已压缩的名字
+void log_archive::archive_name(int day, char *dst, int cap)
+{
+    char gz[300];
+    for (int i = 0;; ++i)
+    {
+        int n = snprintf(dst, cap, "%s%d_%02d_%02d_%s", m_dir, day / 10000, day / 100 % 100, day % 100, m_name);
+        if (i > 0 && n < cap)
+            snprintf(dst + n, cap - n, ".%d", i);
+        snprintf(gz, sizeof(gz), "%s.gz", dst);
+        if (access(dst, F_OK) != 0 && access(gz, F_OK) != 0)
+            return;
+    }
+}
+
+//先改名归档，已打开的fd不受影响，换fd之前写入的内容留在归档里，不会丢失也不会写坏
+bool log_archive::archive(int day)
+{
+    char name[300];
+    archive_name(day, name, sizeof(name));
+    if (rename(m_active, name) == 0)
+    {
+        m_sem.post();
+        return true;
+    }
+    return errno == ENOENT;
+}
+
+void *log_archive::worker(void *arg)
+{
+    ((log_archive *)arg)->run();
+    return NULL;
+}
+
+//压缩线程：SCHED_IDLE只在CPU空闲时运行，不与工作线程争抢，不支持时退而求其次降低nice值
+void log_archive::run()
+{
+    struct sched_param param;
+    param.sched_priority = 0;
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+    while (!m_stop)
+    {
+        if (!m_sem.wait() || m_stop)
+            continue;
+        clean();
+    }
+}
+
+//压缩所有未压缩的归档，再从最新的往前数，超出保留个数或总大小的删除
+void log_archive::clean()
+{
+    string dir = m_dir[0] ? m_dir : "./";
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return;
+    vector<string> plain;
+    vector<archive_file> kept;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL)
+    {
+        int kind = archive_kind(e->d_name, m_name);
+        if (kind == NOT_ARCHIVE)
+            continue;
+        string path = dir + e->d_name;
+        if (kind == ARCHIVE_TMP)
+            unlink(path.c_str());
+        else if (kind == ARCHIVE_PLAIN)
+            plain.push_back(path);
+        else
+            kept.push_back(archive_file{path, 0, 0});
+    }
+    closedir(d);
+
+    for (size_t i = 0; i < plain.size(); ++i)
+    {
+        if (m_stop)
+            return;
+        //压缩失败(如磁盘已满)的原样保留，一并参与清理
+        kept.push_back(archive_file{gzip_file(plain[i].c_str(), m_stop) ? plain[i] + ".gz" : plain[i], 0, 0});
+    }
+    if (m_max_files <= 0 && m_max_bytes <= 0)
+        return;
+
+    for (size_t i = 0; i < kept.size(); ++i)
+    {
+        struct stat st;
+        if (stat(kept[i].path.c_str(), &st) == 0)
+        {
+            kept[i].mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+            kept[i].size = st.st_size;
+        }
+    }
+    sort(kept.begin(), kept.end(), newer_first);
+    long long total = 0;
+    for (size_t i = 0; i < kept.size(); ++i)
+    {
+        total += kept[i].size;
+        if ((m_max_files > 0 && (int)i >= m_max_files) || (m_max_bytes > 0 && total > m_max_bytes))
+            unlink(kept[i].path.c_str());
+    }
+}
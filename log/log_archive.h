@@ -0,0 +1,54 @@
+/*************************************************************
+*日志归档：文本日志和二进制日志共用的切分归档、压缩和清理
+*正在写入的文件名字固定，切分时改名为目录/yyyy_mm_dd_<文件名>[.N]，同一天切分多次时依次加.1、.2后缀
+*归档文件由低优先级的压缩线程gzip压缩，并按个数和总大小清理最旧的归档
+*每个日志各有一个实例，只认自己文件名的归档，互不影响
+**************************************************************/
+
+#ifndef LOG_ARCHIVE_H
+#define LOG_ARCHIVE_H
+
+#include <pthread.h>
+#include <time.h>
+#include <atomic>
+#include "../lock/locker.h"
+
+class log_archive
+{
+public:
+    log_archive();
+    ~log_archive();
+
+    //日期(yyyymmdd)，切分时按它判断是否跨天
+    static int date_of(time_t t);
+
+    //active为正在写入的文件；max_files、max_bytes为压缩后归档文件的保留个数和总字节数，0表示不限
+    //启动压缩线程，并先处理上次运行没有压缩完的归档
+    bool init(const char *active, int max_files, long long max_bytes);
+    const char *active() const { return m_active; }
+
+    //把正在写入的文件改名为day那天的归档并唤醒压缩线程，调用方随后在原名下新建文件
+    //文件已被外部删除时也返回true；改名失败返回false，调用方继续写原文件，等下一次切分
+    bool archive(int day);
+
+    //压缩线程放弃正在压缩的文件并退出，下次启动时再压缩
+    void stop();
+
+private:
+    static void *worker(void *arg);
+    void run();
+    void archive_name(int day, char *dst, int cap);
+    void clean();
+
+    char m_dir[128];            //目录，带末尾的'/'，当前目录时为空
+    char m_name[128];           //文件名
+    char m_active[256];
+    int m_max_files;
+    long long m_max_bytes;
+    sem m_sem;                  //有新归档时唤醒压缩线程
+    std::atomic<bool> m_stop;
+    bool m_started;
+    pthread_t m_tid;
+};
+
+#endif
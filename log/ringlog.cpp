@@ -0,0 +1,96 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ringlog.h"
+
+ringlog::ringlog() : m_fd(-1), m_map(NULL), m_map_len(0), m_header(NULL), m_data(NULL), m_mask(0)
+{
+}
+
+ringlog::~ringlog()
+{
+    if (!m_map)
+        return;
+    msync(m_map, m_map_len, MS_ASYNC);
+    munmap(m_map, m_map_len);
+    close(m_fd);
+}
+
+ringlog *ringlog::GetInstance()
+{
+    static ringlog ring;
+    return &ring;
+}
+
+bool ringlog::init(const char *file_name, size_t size)
+{
+    size_t data_size = MIN_SIZE;
+    while (data_size * 2 <= size)
+        data_size *= 2;
+
+    m_fd = open(file_name, O_RDWR | O_CREAT, 0666);
+    if (m_fd < 0)
+        return false;
+    m_map_len = RINGLOG_HEADER_SIZE + data_size;
+
+    //大小不同或不是环形日志的文件整个重建
+    struct stat st;
+    bool reuse = fstat(m_fd, &st) == 0 && (size_t)st.st_size == m_map_len;
+    if (!reuse && ftruncate(m_fd, m_map_len) != 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    void *p = mmap(NULL, m_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (p == MAP_FAILED)
+    {
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    m_map = (char *)p;
+    m_header = (ringlog_header *)m_map;
+    m_data = m_map + RINGLOG_HEADER_SIZE;
+    m_mask = data_size - 1;
+
+    if (!reuse || memcmp(m_header->magic, RINGLOG_MAGIC, sizeof(m_header->magic)) != 0 || m_header->size != data_size)
+    {
+        memset(m_map, 0, RINGLOG_HEADER_SIZE);
+        m_header->size = data_size;
+        m_header->cursor = 0;
+        memcpy(m_header->magic, RINGLOG_MAGIC, sizeof(m_header->magic));
+    }
+    return true;
+}
+
+void ringlog::copy_in(uint64_t pos, const char *data, size_t len)
+{
+    size_t off = pos & m_mask;
+    size_t first = len < m_mask + 1 - off ? len : m_mask + 1 - off;
+    memcpy(m_data + off, data, first);
+    memcpy(m_data, data + first, len - first);
+}
+
+void ringlog::append(const char *data, size_t len)
+{
+    if (!m_map)
+        return;
+    if (len > MAX_RECORD)
+        len = MAX_RECORD;
+    uint64_t need = ringlog_align(sizeof(ringlog_record) + len);
+    if (need > m_mask + 1)
+        return;
+    uint64_t pos = __atomic_fetch_add(&m_header->cursor, need, __ATOMIC_RELAXED);
+
+    //先拷内容再写记录头，写到一半被杀时记录头仍是旧的，读取时会被跳过
+    copy_in(pos + sizeof(ringlog_record), data, len);
+    ringlog_record r;
+    r.len = (uint32_t)len;
+    r.pos = (uint32_t)pos;
+    uint64_t word;
+    memcpy(&word, &r, sizeof(word));
+    __atomic_store_n((uint64_t *)(m_data + (pos & m_mask)), word, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,65 @@
+/*************************************************************
+*内存映射的环形日志文件：文件大小固定，进程被SIGKILL后最近写入的日志仍留在文件里
+*写日志的线程用原子fetch_add在环中预留空间，直接拷贝进映射区，不调用write，脏页由内核写回
+*每条记录以ringlog_record开头，内容拷贝完后才写记录头，读取时据此跳过未写完的记录
+*文件由离线工具ringdump按写入顺序展开
+**************************************************************/
+
+#ifndef RINGLOG_H
+#define RINGLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RINGLOG_MAGIC "RINGLOG1"
+
+//文件头占一页，数据区从第二页开始
+static const size_t RINGLOG_HEADER_SIZE = 4096;
+
+struct ringlog_header
+{
+    char magic[8];
+    uint64_t size;              //数据区大小，2的幂
+    uint64_t cursor;            //已预留的总字节数，只增不减，对size取模即下一条记录的位置
+};
+
+//记录按8字节对齐，记录头不会跨越环的末尾
+struct ringlog_record
+{
+    uint32_t len;               //内容长度，不含记录头和对齐填充
+    uint32_t pos;               //记录起点的绝对位置(低32位)，与实际位置不符说明是上一圈的旧数据或未写完
+};
+
+static inline uint64_t ringlog_align(uint64_t n)
+{
+    return (n + 7) & ~(uint64_t)7;
+}
+
+class ringlog
+{
+public:
+    static const size_t MIN_SIZE = 64 * 1024;
+    static const uint32_t MAX_RECORD = 64 * 1024;   //单条记录内容的上限，读取时用于排除误判
+
+    static ringlog *GetInstance();
+
+    //打开或创建file_name，数据区按size向下取2的幂；已有同样大小的环时接着写，保留上次运行的日志
+    bool init(const char *file_name, size_t size);
+    //多个线程可同时调用，不加锁
+    void append(const char *data, size_t len);
+
+private:
+    ringlog();
+    ~ringlog();
+
+    void copy_in(uint64_t pos, const char *data, size_t len);
+
+    int m_fd;
+    char *m_map;                //整个文件的映射
+    size_t m_map_len;
+    ringlog_header *m_header;
+    char *m_data;
+    uint64_t m_mask;
+};
+
+#endif
@@ -0,0 +1,214 @@
+//环形日志文件的单元测试：ringlog写入的记录由ringdump的读取逻辑按顺序完整取出，
+//包括多线程并发预留、绕环后只保留最近一圈、超长记录截断，以及写到一半的记录被跳过
+//环形日志文件写在临时目录中，结束时删除
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "ringlog.h"
+#include "../ringdump/ringlog_read.h"
+#include "../test/check.h"
+
+using namespace std;
+
+static const size_t RING_BYTES = 1 << 20;
+static const int THREADS = 4;
+static const int PER_THREAD = 5000;
+
+static string read_file(const string &path)
+{
+    string out;
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return out;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        out.append(buf, n);
+    fclose(fp);
+    return out;
+}
+
+static bool read_ring(const string &file, vector<string> &records, uint64_t *skipped)
+{
+    string error;
+    records.clear();
+    return ringlog_read(file.data(), file.size(), records, skipped, error);
+}
+
+static void append(const string &s)
+{
+    ringlog::GetInstance()->append(s.data(), s.size());
+}
+
+static void test_sequential(const string &path)
+{
+    vector<string> want;
+    for (int i = 0; i < 100; ++i)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "record %d%s\n", i, string(i % 13, '.').c_str());
+        want.push_back(buf);
+        append(buf);
+    }
+    want.push_back("");
+    append("");
+    //超出上限的记录截断到MAX_RECORD
+    string big(ringlog::MAX_RECORD + 1000, 'b');
+    want.push_back(big.substr(0, ringlog::MAX_RECORD));
+    append(big);
+
+    vector<string> got;
+    uint64_t skipped = 1;
+    CHECK(read_ring(read_file(path), got, &skipped));
+    CHECK(skipped == 0);
+    CHECK(got == want);
+}
+
+static void *writer(void *arg)
+{
+    int id = *(int *)arg;
+    char buf[32];
+    for (int i = 0; i < PER_THREAD; ++i)
+    {
+        int n = snprintf(buf, sizeof(buf), "%d %d\n", id, i);
+        ringlog::GetInstance()->append(buf, n);
+    }
+    return NULL;
+}
+
+//并发预留的记录互不覆盖，同一线程的记录保持写入顺序
+static void test_concurrent(const string &path, size_t before)
+{
+    pthread_t tids[THREADS];
+    int ids[THREADS];
+    for (int t = 0; t < THREADS; ++t)
+    {
+        ids[t] = t;
+        pthread_create(&tids[t], NULL, writer, &ids[t]);
+    }
+    for (int t = 0; t < THREADS; ++t)
+        pthread_join(tids[t], NULL);
+
+    vector<string> got;
+    uint64_t skipped = 1;
+    CHECK(read_ring(read_file(path), got, &skipped));
+    CHECK(skipped == 0);
+    CHECK(got.size() == before + THREADS * PER_THREAD);
+    int next[THREADS] = {0};
+    int wrong = 0;
+    for (size_t i = before; i < got.size(); ++i)
+    {
+        int id, seq;
+        if (sscanf(got[i].c_str(), "%d %d", &id, &seq) != 2 || id < 0 || id >= THREADS || seq != next[id])
+        {
+            ++wrong;
+            continue;
+        }
+        ++next[id];
+    }
+    CHECK(wrong == 0);
+    for (int t = 0; t < THREADS; ++t)
+        CHECK(next[t] == PER_THREAD);
+}
+
+//写满几圈之后只剩最近一圈，取出的是连续的一段，以最后写入的记录结束
+static void test_wrap(const string &path)
+{
+    const int n = (int)(RING_BYTES * 3 / 100);
+    for (int i = 0; i < n; ++i)
+    {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "wrap %07d %s\n", i, string(80, 'w').c_str());
+        append(buf);
+    }
+
+    string file = read_file(path);
+    vector<string> got;
+    uint64_t skipped;
+    CHECK(read_ring(file, got, &skipped));
+    CHECK(!got.empty() && got.size() < (size_t)n);
+    CHECK(skipped < 128);
+    int first = -1, wrong = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < got.size(); ++i)
+    {
+        int seq;
+        if (sscanf(got[i].c_str(), "wrap %d", &seq) != 1)
+        {
+            ++wrong;
+            continue;
+        }
+        if (first < 0)
+            first = seq - (int)i;
+        if (seq != first + (int)i)
+            ++wrong;
+        bytes += ringlog_align(sizeof(ringlog_record) + got[i].size());
+    }
+    CHECK(wrong == 0);
+    CHECK(first + (int)got.size() == n);
+    CHECK(bytes <= RING_BYTES && bytes + 256 > RING_BYTES);
+
+    //最后一条记录的头还是旧的(写到一半被杀)，只跳过这一条
+    ringlog_header header;
+    memcpy(&header, file.data(), sizeof(header));
+    uint64_t last = ringlog_align(sizeof(ringlog_record) + got.back().size());
+    size_t off = RINGLOG_HEADER_SIZE + ((header.cursor - last) & (header.size - 1));
+    file[off + offsetof(ringlog_record, pos)] ^= 1;
+    vector<string> cut;
+    CHECK(read_ring(file, cut, &skipped));
+    CHECK(cut.size() == got.size() - 1 && cut.back() == got[got.size() - 2]);
+    CHECK(skipped >= last);
+}
+
+static void test_bad_file()
+{
+    vector<string> got;
+    uint64_t skipped;
+    string error;
+    string junk(RINGLOG_HEADER_SIZE + 4096, 'x');
+    CHECK(!ringlog_read(junk.data(), junk.size(), got, &skipped, error) && error == "not a ring log");
+
+    ringlog_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RINGLOG_MAGIC, sizeof(header.magic));
+    header.size = 3000;
+    memcpy(&junk[0], &header, sizeof(header));
+    CHECK(!ringlog_read(junk.data(), junk.size(), got, &skipped, error) && error == "bad ring size 3000");
+
+    //环比文件大
+    header.size = 8192;
+    memcpy(&junk[0], &header, sizeof(header));
+    CHECK(!ringlog_read(junk.data(), junk.size(), got, &skipped, error));
+
+    header.size = 4096;
+    memcpy(&junk[0], &header, sizeof(header));
+    CHECK(ringlog_read(junk.data(), junk.size(), got, &skipped, error) && got.empty() && skipped == 0);
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/ringlog_test.XXXXXX";
+    if (!mkdtemp(tmpl))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    string dir = tmpl;
+    string path = dir + "/ServerLog.ring";
+
+    CHECK(ringlog::GetInstance()->init(path.c_str(), RING_BYTES));
+    CHECK(read_file(path).size() == RINGLOG_HEADER_SIZE + RING_BYTES);
+    test_sequential(path);
+    test_concurrent(path, 102);
+    test_wrap(path);
+    test_bad_file();
+
+    unlink(path.c_str());
+    rmdir(dir.c_str());
+    return check_report("ringlog_test");
+}
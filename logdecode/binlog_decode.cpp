@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <map>
+#include "binlog_decode.h"
+#include "../log/binlog.h"
+
+//长度修饰符统一换成ll，参数按记录中的类型标记取用
+string binlog_render(const string &fmt, const vector<binlog_arg> &args)
+{
+    string out;
+    size_t ai = 0;
+    char buf[1024];
+    for (size_t i = 0; i < fmt.size(); ++i)
+    {
+        if (fmt[i] != '%')
+        {
+            out.push_back(fmt[i]);
+            continue;
+        }
+        if (i + 1 < fmt.size() && fmt[i + 1] == '%')
+        {
+            out.push_back('%');
+            ++i;
+            continue;
+        }
+        size_t j = i + 1;
+        string spec = "%";
+        while (j < fmt.size() && strchr("-+ #0", fmt[j]))
+            spec.push_back(fmt[j++]);
+        while (j < fmt.size() && (isdigit((unsigned char)fmt[j]) || fmt[j] == '.'))
+            spec.push_back(fmt[j++]);
+        while (j < fmt.size() && strchr("hlLqjzt", fmt[j]))
+            ++j;
+        if (j >= fmt.size())
+        {
+            out.append(fmt, i, string::npos);
+            break;
+        }
+        char conv = fmt[j];
+        i = j;
+        if (ai >= args.size())
+        {
+            out += "<?>";
+            continue;
+        }
+        const binlog_arg &a = args[ai++];
+        bool integer = a.tag == BINLOG_INT || a.tag == BINLOG_UINT || a.tag == BINLOG_PTR;
+        buf[0] = '\0';
+        switch (conv)
+        {
+        case 'd':
+        case 'i':
+            if (!integer)
+                break;
+            spec += "lld";
+            snprintf(buf, sizeof(buf), spec.c_str(), (long long)a.u);
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            if (!integer)
+                break;
+            spec += "ll";
+            spec += conv;
+            snprintf(buf, sizeof(buf), spec.c_str(), (unsigned long long)a.u);
+            break;
+        case 'c':
+            if (!integer)
+                break;
+            spec += conv;
+            snprintf(buf, sizeof(buf), spec.c_str(), (int)a.u);
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (a.tag != BINLOG_DOUBLE)
+                break;
+            spec += conv;
+            snprintf(buf, sizeof(buf), spec.c_str(), a.d);
+            break;
+        case 's':
+            if (a.tag != BINLOG_STR)
+                break;
+            spec += conv;
+            snprintf(buf, sizeof(buf), spec.c_str(), a.s.c_str());
+            break;
+        case 'p':
+            if (!integer)
+                break;
+            snprintf(buf, sizeof(buf), "%p", (void *)(uintptr_t)a.u);
+            break;
+        default:
+            break;
+        }
+        out += buf[0] || (conv == 's' && a.tag == BINLOG_STR) ? buf : "<?>";
+    }
+    return out;
+}
+
+static bool parse_args(const char *p, const char *end, int count, vector<binlog_arg> &args)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        if (p >= end)
+            return false;
+        binlog_arg a;
+        a.tag = *p++;
+        a.u = 0;
+        a.d = 0;
+        if (a.tag == BINLOG_STR)
+        {
+            uint16_t len;
+            if (end - p < 2)
+                return false;
+            memcpy(&len, p, 2);
+            p += 2;
+            if (end - p < len)
+                return false;
+            a.s.assign(p, len);
+            p += len;
+        }
+        else
+        {
+            if (end - p < 8)
+                return false;
+            if (a.tag == BINLOG_DOUBLE)
+                memcpy(&a.d, p, 8);
+            else
+                memcpy(&a.u, p, 8);
+            p += 8;
+        }
+        args.push_back(a);
+    }
+    return true;
+}
+
+//时间戳用最近一条同步记录换算，TSC频率在运行超过1秒后改用同步记录之间的实测值
+bool binlog_decode(const char *data, size_t len, vector<binlog_line> &lines)
+{
+    binlog_file_header header;
+    if (len < sizeof(header) || memcmp(data, BINLOG_MAGIC, sizeof(header.magic)) != 0)
+        return false;
+    memcpy(&header, data, sizeof(header));
+
+    double hz = header.tsc_hz;
+    bool have_sync = false;
+    uint64_t first_tsc = 0, sync_tsc = 0;
+    int64_t first_ns = 0, sync_ns = 0;
+    map<uint32_t, pair<int, string> > formats;
+
+    size_t pos = sizeof(header);
+    while (pos + sizeof(binlog_record) <= len)
+    {
+        binlog_record r;
+        memcpy(&r, data + pos, sizeof(r));
+        if (r.size < sizeof(r) || pos + r.size > len)
+            break;                              //进程被杀时最后一条记录可能不完整
+        const char *p = data + pos + sizeof(r);
+        const char *end = data + pos + r.size;
+        pos += r.size;
+
+        if (r.kind == BINLOG_FORMAT && end - p >= 4)
+        {
+            uint32_t id;
+            memcpy(&id, p, 4);
+            formats[id] = make_pair((int)r.arg, string(p + 4, end));
+        }
+        else if (r.kind == BINLOG_SYNC && end - p >= 16)
+        {
+            memcpy(&sync_tsc, p, 8);
+            memcpy(&sync_ns, p + 8, 8);
+            if (!have_sync)
+            {
+                first_tsc = sync_tsc;
+                first_ns = sync_ns;
+                have_sync = true;
+            }
+            else if (sync_ns - first_ns > 1000000000LL && sync_tsc > first_tsc)
+                hz = (double)(sync_tsc - first_tsc) * 1e9 / (double)(sync_ns - first_ns);
+        }
+        else if ((r.kind == BINLOG_ENTRY && end - p >= 12) || (r.kind == BINLOG_DROPPED && end - p >= 8))
+        {
+            binlog_line l;
+            vector<binlog_arg> args;
+            if (r.kind == BINLOG_DROPPED)
+            {
+                uint64_t count;
+                memcpy(&count, p, 8);
+                char msg[64];
+                snprintf(msg, sizeof(msg), "binlog ring full, dropped %llu records", (unsigned long long)count);
+                l.tsc = sync_tsc;
+                l.level = 2;
+                l.text = msg;
+            }
+            else
+            {
+                uint32_t id;
+                memcpy(&id, p, 4);
+                memcpy(&l.tsc, p + 4, 8);
+                map<uint32_t, pair<int, string> >::iterator it = formats.find(id);
+                parse_args(p + 12, end, r.arg, args);
+                if (it == formats.end())
+                {
+                    l.level = 1;
+                    l.text = "<unknown format>";
+                }
+                else
+                {
+                    l.level = it->second.first;
+                    l.text = binlog_render(it->second.second, args);
+                }
+            }
+            //记录可能早于同步点，差值按有符号数计算
+            l.ns = sync_ns + (int64_t)((double)(int64_t)(l.tsc - sync_tsc) * 1e9 / hz);
+            lines.push_back(l);
+        }
+    }
+    return true;
+}
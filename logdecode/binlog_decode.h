@@ -0,0 +1,39 @@
+/*************************************************************
+*二进制日志的解码：解析文件中的格式串、同步记录和日志记录，按格式串还原日志正文
+*由logdecode和单元测试共用，不依赖binlog的运行时部分
+**************************************************************/
+
+#ifndef BINLOG_DECODE_H
+#define BINLOG_DECODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct binlog_arg
+{
+    uint8_t tag;
+    uint64_t u;
+    double d;
+    string s;
+};
+
+struct binlog_line
+{
+    uint64_t tsc;
+    int64_t ns;                 //换算后的墙上时间(纳秒)
+    int level;
+    string text;
+};
+
+//按格式串逐个替换转换说明，参数类型与转换不符或缺少参数时输出<?>
+string binlog_render(const string &fmt, const vector<binlog_arg> &args);
+
+//解码整个文件的内容，按文件中的顺序追加到lines；不是二进制日志时返回false
+//最后一条记录不完整(进程被杀)时丢弃它，之前的照常输出
+bool binlog_decode(const char *data, size_t len, vector<binlog_line> &lines);
+
+#endif
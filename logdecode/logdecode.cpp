@@ -0,0 +1,70 @@
+/*************************************************************
+*二进制日志解码工具：把-l 2生成的.bin日志还原成与文本日志相同格式的内容
+*用法：logdecode 日志文件 [-u]，日志文件可以是正在写入的ServerLog.bin或压缩后的归档yyyy_mm_dd_ServerLog.bin[.N].gz
+*默认按TSC时间戳排序后输出；加-u时按文件中的顺序输出，各线程的记录成块出现
+*时间戳用最近一条同步记录换算，TSC频率在运行超过1秒后改用同步记录之间的实测值
+**************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include <algorithm>
+#include <vector>
+#include "binlog_decode.h"
+
+using namespace std;
+
+static bool entry_before(const binlog_line &a, const binlog_line &b)
+{
+    return a.tsc < b.tsc;
+}
+
+static void print_line(const binlog_line &l)
+{
+    static const char *tags[] = {"[debug]:", "[info]:", "[warn]:", "[erro]:"};
+    time_t sec = (time_t)(l.ns / 1000000000LL);
+    struct tm my_tm;
+    localtime_r(&sec, &my_tm);
+    printf("%d-%02d-%02d %02d:%02d:%02d.%06ld %s %s\n",
+           my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+           my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, (long)(l.ns % 1000000000LL / 1000),
+           l.level >= 0 && l.level <= 3 ? tags[l.level] : tags[1], l.text.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s logfile [-u]\n", argv[0]);
+        return 1;
+    }
+    bool sorted = !(argc > 2 && strcmp(argv[2], "-u") == 0);
+
+    //gzread对未压缩的文件原样读出
+    gzFile fp = gzopen(argv[1], "rb");
+    if (!fp)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    vector<char> data;
+    char chunk[65536];
+    int n;
+    while ((n = gzread(fp, chunk, sizeof(chunk))) > 0)
+        data.insert(data.end(), chunk, chunk + n);
+    gzclose(fp);
+
+    vector<binlog_line> lines;
+    if (!binlog_decode(data.data(), data.size(), lines))
+    {
+        fprintf(stderr, "%s: not a binary log\n", argv[1]);
+        return 1;
+    }
+
+    if (sorted)
+        stable_sort(lines.begin(), lines.end(), entry_before);
+    for (size_t i = 0; i < lines.size(); ++i)
+        print_line(lines[i]);
+    return 0;
+}
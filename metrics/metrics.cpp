@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "metrics.h"
+#include "../log/log.h"
+
+static const int IO_TIMEOUT = 2;            //抓取连接的读写超时(秒)
+static const char *route_names[metrics::ROUTE_NUM] = {
+    "static", "register_page", "login_page", "login", "register", "picture", "video", "fans", "upload", "bad"};
+static const int status_codes[metrics::STATUS_NUM - 1] = {200, 403, 404, 500, 503};
+static const char *status_names[metrics::STATUS_NUM] = {"200", "403", "404", "500", "503", "other"};
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+bool metrics::s_enabled = false;
+
+static void appendf(string &out, const char *format, ...)
+{
+    char buf[512];
+    va_list valst;
+    va_start(valst, format);
+    int n = vsnprintf(buf, sizeof(buf), format, valst);
+    va_end(valst);
+    if (n > 0)
+        out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+metrics::metrics() : m_retired(NULL), m_listenfd(-1), m_close_log(0)
+{
+}
+
+metrics::~metrics()
+{
+    if (m_listenfd < 0)
+        return;
+    shutdown(m_listenfd, SHUT_RDWR);        //唤醒阻塞在accept上的后台线程
+    pthread_join(m_tid, NULL);
+    close(m_listenfd);
+}
+
+metrics *metrics::GetInstance()
+{
+    static metrics instance;
+    return &instance;
+}
+
+metrics::slot_holder::~slot_holder()
+{
+    if (s)
+        GetInstance()->retire(s);
+}
+
+metrics::slot *metrics::new_slot()
+{
+    void *p = NULL;
+    if (posix_memalign(&p, 64, sizeof(slot)) != 0)
+        abort();
+    memset(p, 0, sizeof(slot));
+    slot *s = (slot *)p;
+    m_lock.lock();
+    m_slots.push_back(s);
+    m_lock.unlock();
+    return s;
+}
+
+void metrics::retire(slot *s)
+{
+    m_lock.lock();
+    if (!m_retired)
+    {
+        void *p = NULL;
+        if (posix_memalign(&p, 64, sizeof(slot)) != 0)
+            abort();
+        memset(p, 0, sizeof(slot));
+        m_retired = (slot *)p;
+    }
+    for (int c = 0; c < COUNTER_NUM; ++c)
+        m_retired->counters[c].store(m_retired->counters[c].load() + s->counters[c].load());
+    for (int r = 0; r < ROUTE_NUM; ++r)
+    {
+        for (int st = 0; st < STATUS_NUM; ++st)
+        {
+            for (int b = 0; b < BUCKETS; ++b)
+                m_retired->hist[r][st][b].store(m_retired->hist[r][st][b].load() + s->hist[r][st][b].load());
+            m_retired->hist_sum[r][st].store(m_retired->hist_sum[r][st].load() + s->hist_sum[r][st].load());
+        }
+    }
+    for (size_t i = 0; i < m_slots.size(); ++i)
+    {
+        if (m_slots[i] == s)
+        {
+            m_slots.erase(m_slots.begin() + i);
+            break;
+        }
+    }
+    m_lock.unlock();
+    free(s);
+}
+
+//小于SUB的值各占一个桶；其余按最高位所在的2的幂区间分段，再取最高位之后的SUB_BITS位作为子桶
+int metrics::bucket_of(uint64_t us)
+{
+    if (us < (uint64_t)SUB)
+        return (int)us;
+    int e = 63 - __builtin_clzll(us);
+    int idx = (e - SUB_BITS + 1) * SUB + (int)((us >> (e - SUB_BITS)) & (SUB - 1));
+    return idx < BUCKETS ? idx : BUCKETS - 1;
+}
+
+uint64_t metrics::bucket_upper(int idx)
+{
+    if (idx < SUB)
+        return idx + 1;
+    int e = idx / SUB + SUB_BITS - 1;
+    uint64_t width = (uint64_t)1 << (e - SUB_BITS);
+    return (SUB + idx % SUB) * width + width;
+}
+
+int metrics::route_of(const char *url)
+{
+    const char *p = url ? strrchr(url, '/') : NULL;
+    if (!p)
+        return ROUTE_BAD;
+    switch (p[1])
+    {
+    case '0':
+        return ROUTE_REGISTER_PAGE;
+    case '1':
+        return ROUTE_LOGIN_PAGE;
+    case '2':
+        return ROUTE_LOGIN;
+    case '3':
+        return ROUTE_REGISTER;
+    case '5':
+        return ROUTE_PICTURE;
+    case '6':
+        return ROUTE_VIDEO;
+    case '7':
+        return ROUTE_FANS;
+    case '8':
+        return ROUTE_UPLOAD;
+    default:
+        return ROUTE_STATIC;
+    }
+}
+
+void metrics::observe(int route, int status, long long us)
+{
+    if (!s_enabled)
+        return;
+    int st = STATUS_NUM - 1;
+    for (int i = 0; i < STATUS_NUM - 1; ++i)
+    {
+        if (status_codes[i] == status)
+        {
+            st = i;
+            break;
+        }
+    }
+    if (route < 0 || route >= ROUTE_NUM)
+        route = ROUTE_BAD;
+    if (us < 0)
+        us = 0;
+    slot *s = local_slot();
+    std::atomic<uint64_t> &b = s->hist[route][st][bucket_of(us)];
+    b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic<uint64_t> &sum = s->hist_sum[route][st];
+    sum.store(sum.load(std::memory_order_relaxed) + us, std::memory_order_relaxed);
+}
+
+void metrics::add_gauge(const char *name, const char *help, const char *type, const string &labels,
+                        gauge_fn fn, void *arg, int key)
+{
+    gauge g;
+    g.name = name;
+    g.help = help;
+    g.type = type;
+    g.labels = labels;
+    g.fn = fn;
+    g.arg = arg;
+    g.key = key;
+    m_lock.lock();
+    m_gauges.push_back(g);
+    m_lock.unlock();
+}
+
+void metrics::render(string &out)
+{
+    static const char *counter_names[COUNTER_NUM] = {
+        "webserver_connections_accepted_total", "webserver_connections_closed_total",
+        "webserver_connections_timeout_total", "webserver_read_bytes_total", "webserver_written_bytes_total"};
+    static const char *counter_helps[COUNTER_NUM] = {
+        "Accepted connections.", "Closed connections.", "Connections closed by the idle timer.",
+        "Bytes read from clients.", "Bytes sent to clients."};
+
+    //加总各线程的数据，各线程可能同时在写，得到的是近似快照
+    vector<uint64_t> counters(COUNTER_NUM, 0);
+    vector<uint64_t> hist((size_t)ROUTE_NUM * STATUS_NUM * BUCKETS, 0);
+    vector<uint64_t> sums((size_t)ROUTE_NUM * STATUS_NUM, 0);
+    m_lock.lock();
+    vector<slot *> slots = m_slots;
+    if (m_retired)
+        slots.push_back(m_retired);
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        slot *s = slots[i];
+        for (int c = 0; c < COUNTER_NUM; ++c)
+            counters[c] += s->counters[c].load(std::memory_order_relaxed);
+        for (int r = 0; r < ROUTE_NUM; ++r)
+        {
+            for (int st = 0; st < STATUS_NUM; ++st)
+            {
+                uint64_t *h = &hist[((size_t)r * STATUS_NUM + st) * BUCKETS];
+                for (int b = 0; b < BUCKETS; ++b)
+                    h[b] += s->hist[r][st][b].load(std::memory_order_relaxed);
+                sums[r * STATUS_NUM + st] += s->hist_sum[r][st].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    vector<gauge> gauges = m_gauges;
+    m_lock.unlock();
+
+    for (int c = 0; c < COUNTER_NUM; ++c)
+    {
+        appendf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter_names[c], counter_helps[c],
+                counter_names[c], counter_names[c], (unsigned long long)counters[c]);
+    }
+
+    //回调可能要加其他模块的锁，在m_lock之外调用
+    for (size_t i = 0; i < gauges.size(); ++i)
+    {
+        const gauge &g = gauges[i];
+        if (i == 0 || g.name != gauges[i - 1].name)
+            appendf(out, "# HELP %s %s\n# TYPE %s %s\n", g.name.c_str(), g.help.c_str(), g.name.c_str(), g.type.c_str());
+        double v = g.fn(g.arg, g.key);
+        if (g.labels.empty())
+            appendf(out, "%s %.17g\n", g.name.c_str(), v);
+        else
+            appendf(out, "%s{%s} %.17g\n", g.name.c_str(), g.labels.c_str(), v);
+    }
+
+    //直方图只按2的幂输出le，分位数用子桶算出，单独作为gauge输出；没有请求的组合不输出
+    const char *hname = "webserver_request_duration_seconds";
+    appendf(out, "# HELP %s Time from the first request byte read to the last response byte sent.\n# TYPE %s histogram\n",
+            hname, hname);
+    string qout;
+    for (int r = 0; r < ROUTE_NUM; ++r)
+    {
+        for (int st = 0; st < STATUS_NUM; ++st)
+        {
+            const uint64_t *h = &hist[((size_t)r * STATUS_NUM + st) * BUCKETS];
+            uint64_t total = 0;
+            for (int b = 0; b < BUCKETS; ++b)
+                total += h[b];
+            if (total == 0)
+                continue;
+            uint64_t cum = 0;
+            int b = 0;
+            for (int e = 0; e <= MAX_EXP; ++e)
+            {
+                uint64_t le = (uint64_t)1 << e;
+                while (b < BUCKETS && bucket_upper(b) <= le)
+                    cum += h[b++];
+                appendf(out, "%s_bucket{route=\"%s\",status=\"%s\",le=\"%g\"} %llu\n", hname, route_names[r],
+                        status_names[st], le / 1e6, (unsigned long long)cum);
+            }
+            appendf(out, "%s_bucket{route=\"%s\",status=\"%s\",le=\"+Inf\"} %llu\n", hname, route_names[r],
+                    status_names[st], (unsigned long long)total);
+            appendf(out, "%s_sum{route=\"%s\",status=\"%s\"} %.6f\n", hname, route_names[r], status_names[st],
+                    sums[r * STATUS_NUM + st] / 1e6);
+            appendf(out, "%s_count{route=\"%s\",status=\"%s\"} %llu\n", hname, route_names[r], status_names[st],
+                    (unsigned long long)total);
+
+            //取累计数首次达到q*total的子桶，以其上界作为分位数
+            for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); ++q)
+            {
+                uint64_t rank = (uint64_t)(quantiles[q] * total + 0.999999);
+                uint64_t seen = 0;
+                int k = 0;
+                while (k < BUCKETS - 1 && seen + h[k] < rank)
+                    seen += h[k++];
+                appendf(qout, "%s_quantile{route=\"%s\",status=\"%s\",quantile=\"%g\"} %g\n", hname, route_names[r],
+                        status_names[st], quantiles[q], bucket_upper(k) / 1e6);
+            }
+        }
+    }
+    appendf(out, "# HELP %s_quantile Latency quantiles estimated from the fine-grained buckets.\n# TYPE %s_quantile gauge\n",
+            hname, hname);
+    out += qout;
+}
+
+bool metrics::start(const char *addr, int port, const char *path, int close_log)
+{
+    m_close_log = close_log;
+    m_path = path && path[0] == '/' ? path : "/metrics";
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, addr, &address.sin_addr) != 1)
+        return false;
+    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (m_listenfd < 0)
+        return false;
+    int flag = 1;
+    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    if (bind(m_listenfd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(m_listenfd, 16) < 0)
+    {
+        close(m_listenfd);
+        m_listenfd = -1;
+        return false;
+    }
+    s_enabled = true;
+    if (pthread_create(&m_tid, NULL, worker, this) != 0)
+    {
+        s_enabled = false;
+        close(m_listenfd);
+        m_listenfd = -1;
+        return false;
+    }
+    return true;
+}
+
+void *metrics::worker(void *arg)
+{
+    ((metrics *)arg)->serve();
+    return NULL;
+}
+
+//抓取请求很少，逐个阻塞处理，与处理业务请求的线程和epoll完全分开
+void metrics::serve()
+{
+    int m_close_log = this->m_close_log;        //供LOG_*宏使用
+    while (true)
+    {
+        int fd = accept(m_listenfd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;                              //监听套接字已关闭
+        }
+        struct timeval tv = {IO_TIMEOUT, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        //只需要请求行，读到头部结束或缓冲区满为止
+        char req[4096];
+        int len = 0;
+        while (len < (int)sizeof(req) - 1)
+        {
+            int n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+            if (n <= 0)
+                break;
+            len += n;
+            req[len] = '\0';
+            if (strstr(req, "\r\n\r\n"))
+                break;
+        }
+        req[len] = '\0';
+
+        string body;
+        const char *status = "404 Not Found";
+        const char *type = "text/plain";
+        if (strncmp(req, "GET ", 4) == 0)
+        {
+            const char *url = req + 4;
+            size_t url_len = strcspn(url, " ?\r\n");
+            if (url_len == m_path.size() && strncmp(url, m_path.c_str(), url_len) == 0)
+            {
+                render(body);
+                status = "200 OK";
+                type = "text/plain; version=0.0.4; charset=utf-8";
+            }
+        }
+        else
+            LOG_WARN("metrics: bad request from scraper");
+        string resp;
+        appendf(resp, "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                status, type, body.size());
+        resp += body;
+        const char *p = resp.data();
+        size_t left = resp.size();
+        while (left > 0)
+        {
+            ssize_t n = send(fd, p, left, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            p += n;
+            left -= n;
+        }
+        close(fd);
+    }
+}
@@ -0,0 +1,135 @@
+/*************************************************************
+*指标：计数器和请求时延直方图按线程各存一份，只由本线程写，抓取时加总，热路径上没有原子读改写和锁
+*每个线程的数据按缓存行对齐，线程退出时并入已退出线程的累计值
+*时延直方图按路由和状态码分开，桶按2的幂分段、每段再均分为SUB个子桶(HDR式对数线性)，相对误差不超过1/SUB
+*队列长度、连接池、定时器等瞬时值由各模块登记回调，抓取时现读
+*独立端口上的后台线程以Prometheus文本格式输出，默认只绑定127.0.0.1
+**************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+
+using namespace std;
+
+class metrics
+{
+public:
+    enum COUNTER
+    {
+        CONN_ACCEPTED = 0,      //接受的连接数
+        CONN_CLOSED,            //关闭的连接数
+        CONN_TIMEOUT,           //超时关闭的连接数
+        BYTES_READ,             //读入的字节数
+        BYTES_WRITTEN,          //发送的字节数
+        COUNTER_NUM
+    };
+    //与do_request中按最后一个'/'之后的字符分派的页面对应
+    enum ROUTE
+    {
+        ROUTE_STATIC = 0,
+        ROUTE_REGISTER_PAGE,    // /0
+        ROUTE_LOGIN_PAGE,       // /1
+        ROUTE_LOGIN,            // /2
+        ROUTE_REGISTER,         // /3
+        ROUTE_PICTURE,          // /5
+        ROUTE_VIDEO,            // /6
+        ROUTE_FANS,             // /7
+        ROUTE_UPLOAD,           // /8
+        ROUTE_BAD,              //请求行无法解析
+        ROUTE_NUM
+    };
+    static const int STATUS_NUM = 6;            //200、403、404、500、503和其他
+    static const int SUB_BITS = 3;
+    static const int SUB = 1 << SUB_BITS;       //每个2的幂区间的子桶数
+    static const int MAX_EXP = 26;              //最大可区分约67秒(微秒)，更大的计入最后一个桶
+    static const int BUCKETS = (MAX_EXP - SUB_BITS + 2) * SUB;
+
+    //抓取时读取瞬时值的回调，key区分同一对象的不同数值
+    typedef double (*gauge_fn)(void *arg, int key);
+
+    static metrics *GetInstance();
+    static bool enabled() { return s_enabled; }
+
+    static void add(COUNTER c, uint64_t n = 1)
+    {
+        if (!s_enabled)
+            return;
+        std::atomic<uint64_t> &v = local_slot()->counters[c];
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    //记录一次请求的时延(微秒)
+    static void observe(int route, int status, long long us);
+    static int route_of(const char *url);
+
+    //登记瞬时值，同名的须连续登记；type为gauge或counter，labels形如a="x",b="y"
+    void add_gauge(const char *name, const char *help, const char *type, const string &labels,
+                   gauge_fn fn, void *arg, int key);
+    //在addr(点分IPv4地址)的port上监听，只响应path，之后计数器才开始累计
+    bool start(const char *addr, int port, const char *path, int close_log);
+    //生成Prometheus文本格式的全部指标
+    void render(string &out);
+
+    //子桶下标与其上界(不含)的换算
+    static int bucket_of(uint64_t us);
+    static uint64_t bucket_upper(int idx);
+
+private:
+    metrics();
+    ~metrics();
+
+    struct slot
+    {
+        std::atomic<uint64_t> counters[COUNTER_NUM];
+        std::atomic<uint64_t> hist[ROUTE_NUM][STATUS_NUM][BUCKETS];
+        std::atomic<uint64_t> hist_sum[ROUTE_NUM][STATUS_NUM];     //时延之和(微秒)
+    } __attribute__((aligned(64)));
+    //线程退出时把本线程的数据并入m_retired
+    struct slot_holder
+    {
+        slot *s;
+        slot_holder() : s(NULL) {}
+        ~slot_holder();
+    };
+    struct gauge
+    {
+        string name;
+        string help;
+        string type;
+        string labels;
+        gauge_fn fn;
+        void *arg;
+        int key;
+    };
+
+    static slot *local_slot()
+    {
+        static thread_local slot_holder holder;
+        if (!holder.s)
+            holder.s = GetInstance()->new_slot();
+        return holder.s;
+    }
+    slot *new_slot();
+    void retire(slot *s);
+    void serve();
+    static void *worker(void *arg);
+
+    static bool s_enabled;
+
+    locker m_lock;                  //保护m_slots、m_retired和m_gauges
+    vector<slot *> m_slots;
+    slot *m_retired;                //已退出线程的累计值
+    vector<gauge> m_gauges;
+    int m_listenfd;
+    string m_path;
+    int m_close_log;
+    pthread_t m_tid;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <string>
+#include "req_trace.h"
+#include "../log/log.h"
+
+using namespace std;
+
+//各阶段到下一个时间点之间的时长的名称
+static const char *segment_names[req_trace::PHASE_NUM] = {
+    "connect", "read", "read", "handle", "queue", "run", "db_async", "db_acquire", "db_query", "handle",
+    "send", "send", NULL};
+//分解行中各名称的输出顺序
+static const char *breakdown_order[] = {"read", "queue", "run", "handle", "db_acquire", "db_query", "db_async", "send"};
+static const int BREAKDOWN_NUM = sizeof(breakdown_order) / sizeof(breakdown_order[0]);
+
+bool req_tracer::s_enabled = false;
+
+static void appendf(string &out, const char *format, ...)
+{
+    char buf[256];
+    va_list valst;
+    va_start(valst, format);
+    int n = vsnprintf(buf, sizeof(buf), format, valst);
+    va_end(valst);
+    if (n > 0)
+        out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+//按JSON规范转义，超出max的部分截断
+static void append_json(string &out, const char *s, size_t max)
+{
+    if (!s || !*s)
+        s = "-";
+    for (size_t i = 0; s[i] && i < max; ++i)
+    {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (c < 0x20 || c == 0x7f)
+            appendf(out, "\\u%04x", c);
+        else
+            out += c;
+    }
+}
+
+req_tracer::req_tracer() : m_slow_ns(0), m_fd(-1), m_close_log(0), m_pid(0)
+{
+}
+
+req_tracer::~req_tracer()
+{
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+req_tracer *req_tracer::GetInstance()
+{
+    static req_tracer tracer;
+    return &tracer;
+}
+
+bool req_tracer::init(const char *file_name, int slow_ms, int close_log)
+{
+    m_fd = open(file_name, O_WRONLY | O_APPEND | O_CREAT, 0666);
+    if (m_fd < 0)
+        return false;
+    //JSON数组格式允许省略结尾的]和最后一个逗号，进程被杀时文件仍可打开；多次运行接着追加，按pid区分
+    if (lseek(m_fd, 0, SEEK_END) == 0 && ::write(m_fd, "[\n", 2) != 2)
+    {
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    m_slow_ns = slow_ms > 0 ? slow_ms * 1000000LL : 0;
+    m_close_log = close_log;
+    m_pid = getpid();
+    s_enabled = true;
+    return true;
+}
+
+void req_tracer::finish(const req_trace &t, int fd, const char *method, const char *path, int status)
+{
+    if (!s_enabled)
+        return;
+    int start = 0;
+    while (start < t.count && t.phase[start] == req_trace::ACCEPT)
+        ++start;
+    if (t.count - start < 2)
+        return;
+    long long total = t.ns[t.count - 1] - t.ns[start];
+    if (total < m_slow_ns)
+        return;
+
+    long long spent[BREAKDOWN_NUM] = {0};
+    for (int i = start; i < t.count - 1; ++i)
+    {
+        const char *name = segment_names[t.phase[i]];
+        for (int j = 0; name && j < BREAKDOWN_NUM; ++j)
+        {
+            if (strcmp(name, breakdown_order[j]) == 0)
+            {
+                spent[j] += t.ns[i + 1] - t.ns[i];
+                break;
+            }
+        }
+    }
+    string line;
+    for (int j = 0; j < BREAKDOWN_NUM; ++j)
+    {
+        if (spent[j])
+            appendf(line, " %s=%.3f", breakdown_order[j], spent[j] / 1e6);
+    }
+    LOG_WARN("slow request %.3fms fd=%d %s %s %d:%s", total / 1e6, fd, method ? method : "-",
+             path && path[0] ? path : "-", status, line.c_str());
+
+    export_events(t, start, fd, method, path, status);
+}
+
+//整个请求一个事件，其下每段一个事件，同一连接上的请求在同一行(tid为连接的fd)
+//一个请求的事件用一次write追加，O_APPEND保证多个线程的写入不会交错
+void req_tracer::export_events(const req_trace &t, int start, int fd, const char *method, const char *path, int status)
+{
+    string out;
+    out.reserve(256 + t.count * 128);
+    out += "{\"name\":\"";
+    append_json(out, method, 16);
+    out += ' ';
+    append_json(out, path, 128);
+    appendf(out, "\",\"cat\":\"request\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"status\":%d}},\n",
+            t.ns[start] / 1e3, (t.ns[t.count - 1] - t.ns[start]) / 1e3, (int)m_pid, fd, status);
+    for (int i = 0; i < t.count - 1; ++i)
+    {
+        long long dur = t.ns[i + 1] - t.ns[i];
+        if (dur <= 0)
+            continue;
+        appendf(out, "{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d},\n",
+                segment_names[t.phase[i]], t.ns[i] / 1e3, dur / 1e3, (int)m_pid, fd);
+    }
+    if (::write(m_fd, out.data(), out.size()) != (ssize_t)out.size())
+    {
+        LOG_WARN("%s", "request trace: short write");
+    }
+}
@@ -0,0 +1,106 @@
+/*************************************************************
+*请求分段计时：记下一个请求经过各阶段(接受连接、读到首字节、请求头解析完、入队、出队、取得/归还数据库连接、响应就绪、发完最后一个字节)的时间点
+*时间点存在连接对象里，依次处理该请求的线程各自追加，同一时刻只有一个线程访问，不加锁
+*两个相邻时间点之间的时长按前一个时间点的阶段命名，如入队到出队为queue
+*请求总耗时从第一个不是接受连接的时间点算起，超过阈值时在调试日志中写一行各阶段耗时，并以Chrome trace-event格式追加到导出文件
+**************************************************************/
+
+#ifndef REQ_TRACE_H
+#define REQ_TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+struct req_trace;
+
+class req_tracer
+{
+public:
+    static req_tracer *GetInstance();
+    static bool enabled() { return s_enabled; }
+
+    //slow_ms为阈值，0表示每个请求都记录；file为导出文件，以JSON数组格式追加，可直接用chrome://tracing或Perfetto打开
+    bool init(const char *file_name, int slow_ms, int close_log);
+    //请求发送完毕或失败时调用，method和path为空时按"-"输出
+    void finish(const req_trace &t, int fd, const char *method, const char *path, int status);
+
+private:
+    req_tracer();
+    ~req_tracer();
+
+    void export_events(const req_trace &t, int start, int fd, const char *method, const char *path, int status);
+
+    static bool s_enabled;
+
+    long long m_slow_ns;
+    int m_fd;
+    int m_close_log;
+    pid_t m_pid;
+};
+
+struct req_trace
+{
+    enum PHASE
+    {
+        ACCEPT = 0,         //接受连接，只有连接上的第一个请求有
+        FIRST_BYTE,         //读到请求的第一个字节
+        READ_MORE,          //请求不完整，等待客户端发送剩余部分
+        HEADER_DONE,        //请求头解析完
+        ENQUEUE,            //放入线程池或执行器的队列
+        DEQUEUE,            //被工作线程取出
+        DB_SUBMIT,          //提交给异步数据库层或组提交
+        DB_WAIT,            //开始向连接池要连接
+        DB_ACQUIRE,         //取得数据库连接
+        DB_RELEASE,         //归还数据库连接，或异步数据库操作返回
+        RESPONSE_READY,     //响应已生成，等待发送
+        WRITE_BLOCKED,      //发送缓冲区已满，等待可写
+        LAST_BYTE,          //发完最后一个字节或发送失败
+        PHASE_NUM
+    };
+    static const int MAX_MARKS = 24;    //超出时覆盖最后一个，总耗时不变
+
+    long long ns[MAX_MARKS];
+    unsigned char phase[MAX_MARKS];
+    int count;
+
+    req_trace() : count(0) {}
+
+    void reset() { count = 0; }
+    void mark(PHASE p)
+    {
+        if (!req_tracer::enabled())
+            return;
+        int i = count < MAX_MARKS ? count++ : MAX_MARKS - 1;
+        ns[i] = now_ns();
+        phase[i] = p;
+    }
+    //撤销最后一个时间点，用于提交失败、请求没有真正交出去的情况
+    void undo(PHASE p)
+    {
+        if (count > 0 && phase[count - 1] == p)
+            --count;
+    }
+
+    //vDSO读取，不进入内核
+    static long long now_ns()
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (long long)t.tv_sec * 1000000000 + t.tv_nsec;
+    }
+
+    //向连接池取连接的时段：构造时记DB_WAIT，析构时记DB_RELEASE，须在connectionRAII之前定义，才会在归还连接之后析构
+    class db_span
+    {
+    public:
+        explicit db_span(req_trace &t) : m_trace(t) { m_trace.mark(DB_WAIT); }
+        ~db_span() { m_trace.mark(DB_RELEASE); }
+        void acquired() { m_trace.mark(DB_ACQUIRE); }
+
+    private:
+        req_trace &m_trace;
+    };
+};
+
+#endif
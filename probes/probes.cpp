@@ -0,0 +1,8 @@
+#include "probes.h"
+
+#ifdef HAVE_PROBES
+//信号量放在.probes段，挂载探针的工具据ELF注记找到并修改它们
+#define PROBE_DEFINE(name) volatile unsigned short PROBE_SEMAPHORE(name) __attribute__((section(".probes"))) = 0;
+WEBSERVER_PROBES(PROBE_DEFINE)
+#undef PROBE_DEFINE
+#endif
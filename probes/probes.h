@@ -0,0 +1,59 @@
+/*************************************************************
+*USDT静态探针：请求热路径上的关键点，供bpftrace/perf在不重新编译的情况下挂载
+*使用systemtap的sys/sdt.h，探针只是一条nop加ELF注记，未挂载时没有额外开销，参数只用现成的整数和指针
+*没有sys/sdt.h或编译时定义了NO_PROBES(make PROBES=0)时展开为空
+*provider统一为webserver，探针及参数：
+*  accept(fd, ip, port)                 接受连接，ip和port为网络字节序
+*  read(fd, read_idx, ok)               read_once返回，read_idx为读缓冲区中已有的字节数
+*  parse(fd, code, url)                 请求解析完(HTTP_CODE)，含需转交执行器的DB_REQUEST
+*  enqueue(pool, request)               放入线程池或执行器的队列
+*  dequeue(pool, request, wait_us)      被工作线程取出，wait_us为排队时长
+*  request(fd, code)                    请求处理的最终结果(HTTP_CODE)，之后生成响应
+*  db_acquire(pool, conn, wait_us)      从连接池取得连接，超时时conn为0
+*  db_release(pool, conn)               归还连接
+*  write(fd, bytes, status, ok)         响应发送完毕或发送失败
+*  timer_expire(fd)                     连接超时
+*  close(fd)                            关闭连接
+*每个探针带一个信号量，挂载时由bpftrace/perf置为非0；参数需要额外计算时先用PROBE_ENABLED(name)判断，未挂载时不计算
+*新增探针要同时加入WEBSERVER_PROBES，信号量在probes.cpp中定义
+*示例脚本见本目录下的*.bt
+**************************************************************/
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define HAVE_PROBES 1
+#endif
+#endif
+
+#define WEBSERVER_PROBES(X) \
+    X(accept) X(read) X(parse) X(enqueue) X(dequeue) X(request) \
+    X(db_acquire) X(db_release) X(write) X(timer_expire) X(close)
+
+#ifdef HAVE_PROBES
+//sys/sdt.h按provider_name_semaphore的名字引用信号量
+#define PROBE_SEMAPHORE(name) webserver_##name##_semaphore
+#define PROBE_DECLARE(name) extern volatile unsigned short PROBE_SEMAPHORE(name);
+WEBSERVER_PROBES(PROBE_DECLARE)
+#undef PROBE_DECLARE
+
+#define PROBE_ENABLED(name) __builtin_expect(PROBE_SEMAPHORE(name) != 0, 0)
+#define PROBE0(name) DTRACE_PROBE(webserver, name)
+#define PROBE1(name, a) DTRACE_PROBE1(webserver, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(webserver, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(webserver, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(webserver, name, a, b, c, d)
+#else
+#define PROBE_ENABLED(name) 0
+#define PROBE0(name) do {} while (0)
+#define PROBE1(name, a) do {} while (0)
+#define PROBE2(name, a, b) do {} while (0)
+#define PROBE3(name, a, b, c) do {} while (0)
+#define PROBE4(name, a, b, c, d) do {} while (0)
+#endif
+
+#endif
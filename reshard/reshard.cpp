@@ -0,0 +1,258 @@
+/*************************************************************
+*分片迁移工具：分片列表变化后，把每个用户迁移到新哈希环上它所在的分片
+*用法：reshard -u 用户名 -p 密码 -d 库名 -o 旧分片列表 -n 新分片列表 [-x]
+*分片列表与服务器的-H参数相同，为"host:port,host:port"，顺序无关
+*先以INSERT IGNORE复制需要迁移的行，再回查目标分片确认，加-x时只从原分片删除已确认的行，可重复执行
+*目标分片上已有同名但密码不同的行（迁移前已在新分片注册）视为冲突，原行保留并打印，需人工处理
+*建议步骤：以新分片列表重启服务器（未迁移的用户登录时在新分片查不到），立即运行本工具复制，确认后加-x清理
+**************************************************************/
+
+#include <mysql/mysql.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "../CGImysql/hash_ring.h"
+
+using namespace std;
+
+static const int BATCH_ROWS = 500;      //每条INSERT/SELECT/DELETE语句包含的行数
+
+struct target
+{
+    MYSQL *con;
+    vector<pair<string, string> > rows;     //待复制的(用户名,密码)
+    long long moved;
+};
+
+//与服务器用同一个函数解析并生成分片标识，两边的哈希环才一致
+static bool split_ids(const char *spec, vector<string> &ids)
+{
+    vector<pair<string, int> > endpoints;
+    if (!hash_ring::parse_endpoints(spec, endpoints))
+        return false;
+    for (size_t i = 0; i < endpoints.size(); ++i)
+        ids.push_back(hash_ring::endpoint_id(endpoints[i].first, endpoints[i].second));
+    return !ids.empty();
+}
+
+static MYSQL *connect_id(const string &id, const char *user, const char *passwd, const char *db)
+{
+    size_t colon = id.rfind(':');
+    string host = id.substr(0, colon);
+    int port = atoi(id.c_str() + colon + 1);
+    MYSQL *con = mysql_init(NULL);
+    if (con && mysql_real_connect(con, host.c_str(), user, passwd, db, port, NULL, 0))
+        return con;
+    fprintf(stderr, "connect %s failed: %s\n", id.c_str(), con ? mysql_error(con) : "out of memory");
+    if (con)
+        mysql_close(con);
+    return NULL;
+}
+
+static string quote(MYSQL *con, const char *s)
+{
+    size_t len = strlen(s);
+    vector<char> buf(len * 2 + 1);
+    mysql_real_escape_string(con, &buf[0], s, len);
+    return string("'") + &buf[0] + "'";
+}
+
+static bool run(MYSQL *con, const string &sql)
+{
+    if (mysql_query(con, sql.c_str()))
+    {
+        fprintf(stderr, "query error: %s\n", mysql_error(con));
+        return false;
+    }
+    return true;
+}
+
+//复制一批行，再回查目标分片：密码一致的行放入confirmed，可以从原分片删除
+//INSERT IGNORE跳过的同名行只有密码也相同时才算迁移成功，否则计入conflicts
+static bool flush_target(const string &id, target &t, vector<pair<string, string> > &confirmed, long long &conflicts)
+{
+    if (t.rows.empty())
+        return true;
+    string insert = "INSERT IGNORE INTO user(username, passwd) VALUES";
+    string select = "SELECT username,passwd FROM user WHERE username IN (";
+    for (size_t i = 0; i < t.rows.size(); ++i)
+    {
+        string name = quote(t.con, t.rows[i].first.c_str());
+        insert += (i ? ",(" : "(") + name + "," + quote(t.con, t.rows[i].second.c_str()) + ")";
+        select += (i ? "," : "") + name;
+    }
+    select += ")";
+
+    bool ok = run(t.con, insert) && run(t.con, select);
+    MYSQL_RES *result = ok ? mysql_store_result(t.con) : NULL;
+    if (ok && !result)
+    {
+        fprintf(stderr, "%s: %s\n", id.c_str(), mysql_error(t.con));
+        ok = false;
+    }
+    if (ok)
+    {
+        map<string, string> stored;
+        while (MYSQL_ROW row = mysql_fetch_row(result))
+            stored[row[0]] = row[1] ? row[1] : "";
+        mysql_free_result(result);
+        for (size_t i = 0; i < t.rows.size(); ++i)
+        {
+            map<string, string>::iterator it = stored.find(t.rows[i].first);
+            if (it != stored.end() && it->second == t.rows[i].second)
+            {
+                confirmed.push_back(t.rows[i]);
+                ++t.moved;
+                continue;
+            }
+            ++conflicts;
+            fprintf(stderr, "%s: user %s %s, kept on source\n", id.c_str(), t.rows[i].first.c_str(),
+                    it == stored.end() ? "missing after insert" : "exists with a different password");
+        }
+    }
+    t.rows.clear();
+    return ok;
+}
+
+//迁移一个旧分片上不再属于它的行
+static bool migrate(const string &id, const hash_ring &ring, const vector<string> &new_ids, map<string, target> &targets,
+                    const char *user, const char *passwd, const char *db, bool remove)
+{
+    MYSQL *src = connect_id(id, user, passwd, db);
+    if (!src)
+        return false;
+
+    //流式读取，不在客户端缓存整张表
+    if (!run(src, "SELECT username,passwd FROM user"))
+    {
+        mysql_close(src);
+        return false;
+    }
+    MYSQL_RES *result = mysql_use_result(src);
+    if (!result)
+    {
+        fprintf(stderr, "%s: %s\n", id.c_str(), mysql_error(src));
+        mysql_close(src);
+        return false;
+    }
+
+    bool ok = true;
+    long long scanned = 0, to_move = 0, conflicts = 0;
+    vector<pair<string, string> > confirmed;    //目标分片上已确认的行，加-x时从原分片删除
+    while (MYSQL_ROW row = mysql_fetch_row(result))
+    {
+        ++scanned;
+        if (!row[0] || !row[1])
+            continue;
+        const string &dest = new_ids[ring.locate(row[0])];
+        if (dest == id)
+            continue;
+        target &t = targets[dest];
+        t.rows.push_back(make_pair(string(row[0]), string(row[1])));
+        ++to_move;
+        if ((int)t.rows.size() >= BATCH_ROWS)
+            ok = flush_target(dest, t, confirmed, conflicts) && ok;
+    }
+    if (mysql_errno(src))
+    {
+        fprintf(stderr, "%s: %s\n", id.c_str(), mysql_error(src));
+        ok = false;
+    }
+    mysql_free_result(result);
+    for (map<string, target>::iterator it = targets.begin(); it != targets.end(); ++it)
+        ok = flush_target(it->first, it->second, confirmed, conflicts) && ok;
+    printf("%s: scanned %lld rows, %lld to move, %zu confirmed, %lld conflicts\n", id.c_str(), scanned, to_move,
+           confirmed.size(), conflicts);
+
+    //复制和回查全部成功后才删除，且只删除目标分片上已确认的行；按(用户名,密码)匹配，不会误删复制后又变化的行
+    //冲突的行保留在原分片并使退出码非0
+    if (remove && ok)
+    {
+        long long deleted = 0;
+        for (size_t i = 0; i < confirmed.size() && ok; i += BATCH_ROWS)
+        {
+            string sql = "DELETE FROM user WHERE (username,passwd) IN (";
+            for (size_t j = i; j < confirmed.size() && j < i + BATCH_ROWS; ++j)
+                sql += (j > i ? ",(" : "(") + quote(src, confirmed[j].first.c_str()) + "," +
+                       quote(src, confirmed[j].second.c_str()) + ")";
+            sql += ")";
+            ok = run(src, sql);
+            if (ok)
+                deleted += mysql_affected_rows(src);
+        }
+        printf("%s: deleted %lld rows\n", id.c_str(), deleted);
+    }
+    ok = ok && conflicts == 0;
+    mysql_close(src);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *user = "root", *passwd = "root", *db = "qgydb";
+    const char *old_spec = NULL, *new_spec = NULL;
+    bool remove = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "u:p:d:o:n:x")) != -1)
+    {
+        switch (opt)
+        {
+        case 'u':
+            user = optarg;
+            break;
+        case 'p':
+            passwd = optarg;
+            break;
+        case 'd':
+            db = optarg;
+            break;
+        case 'o':
+            old_spec = optarg;
+            break;
+        case 'n':
+            new_spec = optarg;
+            break;
+        case 'x':
+            remove = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    vector<string> old_ids, new_ids;
+    if (!old_spec || !new_spec || !split_ids(old_spec, old_ids) || !split_ids(new_spec, new_ids))
+    {
+        fprintf(stderr, "usage: %s [-u user] [-p passwd] [-d db] -o old_shards -n new_shards [-x]\n", argv[0]);
+        return 1;
+    }
+
+    hash_ring ring;
+    ring.build(new_ids);
+
+    map<string, target> targets;
+    for (size_t i = 0; i < new_ids.size(); ++i)
+    {
+        target t;
+        t.con = connect_id(new_ids[i], user, passwd, db);
+        t.moved = 0;
+        if (!t.con)
+            return 1;
+        targets[new_ids[i]] = t;
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < old_ids.size(); ++i)
+        ok = migrate(old_ids[i], ring, new_ids, targets, user, passwd, db, remove) && ok;
+
+    for (map<string, target>::iterator it = targets.begin(); it != targets.end(); ++it)
+    {
+        printf("%s: received %lld rows\n", it->first.c_str(), it->second.moved);
+        mysql_close(it->second.con);
+    }
+    return ok ? 0 : 1;
+}
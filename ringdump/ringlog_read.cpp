@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <string.h>
+#include "ringlog_read.h"
+#include "../log/ringlog.h"
+
+//记录头与所在位置对不上的(被覆盖的旧数据或写到一半的记录)按8字节步进跳过
+bool ringlog_read(const char *file, size_t len, vector<string> &records, uint64_t *skipped, string &error)
+{
+    *skipped = 0;
+    ringlog_header header;
+    if (len < RINGLOG_HEADER_SIZE || memcmp(file, RINGLOG_MAGIC, sizeof(header.magic)) != 0)
+    {
+        error = "not a ring log";
+        return false;
+    }
+    memcpy(&header, file, sizeof(header));
+    uint64_t size = header.size;
+    if (size == 0 || (size & (size - 1)) != 0 || len < RINGLOG_HEADER_SIZE + size)
+    {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "bad ring size %llu", (unsigned long long)size);
+        error = msg;
+        return false;
+    }
+    const char *data = file + RINGLOG_HEADER_SIZE;
+    uint64_t mask = size - 1;
+
+    //有效数据是游标之前的最后一圈，起点可能落在某条记录中间，靠位置校验重新对齐
+    uint64_t cursor = header.cursor;
+    uint64_t pos = cursor > size ? ringlog_align(cursor - size) : 0;
+    while (pos + sizeof(ringlog_record) <= cursor)
+    {
+        ringlog_record r;
+        memcpy(&r, data + (pos & mask), sizeof(r));
+        uint64_t need = ringlog_align(sizeof(r) + r.len);
+        if (r.pos != (uint32_t)pos || r.len > ringlog::MAX_RECORD || pos + need > cursor)
+        {
+            pos += 8;
+            *skipped += 8;
+            continue;
+        }
+        uint64_t off = (pos + sizeof(r)) & mask;
+        uint64_t first = r.len < size - off ? r.len : size - off;
+        string rec(data + off, first);
+        rec.append(data, r.len - first);
+        records.push_back(rec);
+        pos += need;
+    }
+    return true;
+}
@@ -0,0 +1,20 @@
+/*************************************************************
+*环形日志文件的读取：按写入顺序取出最近一圈中完整的记录
+*由ringdump和单元测试共用
+**************************************************************/
+
+#ifndef RINGLOG_READ_H
+#define RINGLOG_READ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//file为整个文件的内容，记录按顺序追加到records，skipped为跳过的字节数
+//不是环形日志或环的大小不对时返回false，error为原因
+bool ringlog_read(const char *file, size_t len, vector<string> &records, uint64_t *skipped, string &error);
+
+#endif
@@ -0,0 +1,32 @@
+/*************************************************************
+*单元测试用的检查宏：失败时打印位置并计数，不中断后续检查
+*每个测试是一个独立的可执行文件，main最后返回check_report的结果
+**************************************************************/
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+static int check_failures = 0;
+static int check_count = 0;
+
+#define CHECK(expr)                                                             \
+    do                                                                          \
+    {                                                                           \
+        ++check_count;                                                          \
+        if (!(expr))                                                            \
+        {                                                                       \
+            ++check_failures;                                                   \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr);     \
+        }                                                                       \
+    } while (0)
+
+//打印汇总，全部通过时返回0
+static inline int check_report(const char *name)
+{
+    printf("%s: %d checks, %d failed\n", name, check_count, check_failures);
+    return check_failures ? 1 : 0;
+}
+
+#endif
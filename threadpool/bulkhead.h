@@ -0,0 +1,152 @@
+/*************************************************************
+*隔舱执行器：为某一类请求（如访问数据库的登录/注册）单独准备线程和队列
+*线程数即该类请求的并发上限，队列长度即准入上限，超出时append返回false由调用方降级
+*任意线程都可以append，队列为互斥锁保护的链表
+*任务类型须有req_trace类型的成员m_trace，入队和出队时在其中记下时间点
+**************************************************************/
+
+#ifndef BULKHEAD_H
+#define BULKHEAD_H
+
+#include <list>
+#include <exception>
+#include <pthread.h>
+#include "../lock/locker.h"
+#include "pool_stats.h"
+#include "../metrics/req_trace.h"
+#include "../probes/probes.h"
+
+template <typename T>
+class bulkhead
+{
+public:
+    /*handler是在工作线程中对任务调用的成员函数，thread_number是并发上限，max_requests是排队上限*/
+    bulkhead(void (T::*handler)(), int thread_number = 4, int max_requests = 1000);
+    ~bulkhead();
+    bool append(T *request);
+    //当前排队的任务数
+    int queue_size();
+    const pool_stats &stats() const { return m_stats; }
+
+private:
+    static void *worker(void *arg);
+    void run();
+
+    struct task
+    {
+        T *request;
+        long long stamp;    //入队时间
+    };
+
+private:
+    void (T::*m_handler)();
+    int m_thread_number;
+    int m_max_requests;
+    pthread_t *m_threads;
+    std::list<task> m_workqueue;    //请求队列
+    locker m_queuelocker;           //保护请求队列的互斥锁
+    sem m_queuestat;                //是否有任务需要处理
+    bool m_stop;                    //关闭标志，受m_queuelocker保护
+    pool_stats m_stats;
+};
+template <typename T>
+bulkhead<T>::bulkhead(void (T::*handler)(), int thread_number, int max_requests)
+    : m_handler(handler), m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL), m_stop(false)
+{
+    if (thread_number <= 0 || max_requests <= 0)
+        throw std::exception();
+    m_threads = new pthread_t[m_thread_number];
+    for (int i = 0; i < thread_number; ++i)
+    {
+        if (pthread_create(m_threads + i, NULL, worker, this) != 0)
+        {
+            m_queuelocker.lock();
+            m_stop = true;
+            m_queuelocker.unlock();
+            for (int j = 0; j < i; ++j)
+                m_queuestat.post();
+            for (int j = 0; j < i; ++j)
+                pthread_join(m_threads[j], NULL);
+            delete[] m_threads;
+            throw std::exception();
+        }
+    }
+}
+template <typename T>
+bulkhead<T>::~bulkhead()
+{
+    m_queuelocker.lock();
+    m_stop = true;
+    m_queuelocker.unlock();
+    for (int i = 0; i < m_thread_number; ++i)
+        m_queuestat.post();
+    for (int i = 0; i < m_thread_number; ++i)
+        pthread_join(m_threads[i], NULL);
+    delete[] m_threads;
+}
+template <typename T>
+bool bulkhead<T>::append(T *request)
+{
+    request->m_trace.mark(req_trace::ENQUEUE);
+    m_queuelocker.lock();
+    if (m_stop || m_workqueue.size() >= (size_t)m_max_requests)
+    {
+        m_queuelocker.unlock();
+        request->m_trace.undo(req_trace::ENQUEUE);
+        ++m_stats.rejected;
+        return false;
+    }
+    task t = {request, pool_stats::now_us()};
+    m_workqueue.push_back(t);
+    m_queuelocker.unlock();
+    ++m_stats.admitted;
+    PROBE2(enqueue, this, request);
+    m_queuestat.post();
+    return true;
+}
+template <typename T>
+int bulkhead<T>::queue_size()
+{
+    m_queuelocker.lock();
+    int n = m_workqueue.size();
+    m_queuelocker.unlock();
+    return n;
+}
+template <typename T>
+void *bulkhead<T>::worker(void *arg)
+{
+    bulkhead *pool = (bulkhead *)arg;
+    pool->run();
+    return pool;
+}
+template <typename T>
+void bulkhead<T>::run()
+{
+    while (true)
+    {
+        m_queuestat.wait();
+        m_queuelocker.lock();
+        if (m_stop)
+        {
+            m_queuelocker.unlock();
+            return;
+        }
+        if (m_workqueue.empty())
+        {
+            m_queuelocker.unlock();
+            continue;
+        }
+        task t = m_workqueue.front();
+        m_workqueue.pop_front();
+        m_queuelocker.unlock();
+        if (!t.request)
+            continue;
+        long long wait_us = pool_stats::now_us() - t.stamp;
+        m_stats.record_wait(wait_us);
+        PROBE3(dequeue, this, t.request, wait_us);
+        t.request->m_trace.mark(req_trace::DEQUEUE);
+        (t.request->*m_handler)();
+        ++m_stats.completed;
+    }
+}
+#endif
@@ -0,0 +1,41 @@
+#ifndef POOL_STATS_H
+#define POOL_STATS_H
+
+#include <atomic>
+#include <time.h>
+
+//线程池/执行器的准入与排队时延统计，各字段独立原子更新，读取时为近似快照
+struct pool_stats
+{
+    std::atomic<long long> admitted;        //成功入队的任务数
+    std::atomic<long long> rejected;        //因队列满被拒绝的任务数
+    std::atomic<long long> completed;       //执行完毕的任务数
+    std::atomic<long long> wait_total_us;   //累计排队时间
+    std::atomic<long long> wait_max_us;     //最大排队时间
+
+    pool_stats() : admitted(0), rejected(0), completed(0), wait_total_us(0), wait_max_us(0) {}
+
+    void record_wait(long long us)
+    {
+        wait_total_us += us;
+        long long old = wait_max_us.load(std::memory_order_relaxed);
+        while (us > old && !wait_max_us.compare_exchange_weak(old, us))
+            ;
+    }
+
+    //平均排队时间（微秒）
+    long long wait_avg_us() const
+    {
+        long long n = completed.load();
+        return n > 0 ? wait_total_us.load() / n : 0;
+    }
+
+    static long long now_us()
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (long long)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+    }
+};
+
+#endif
@@ -4,115 +4,312 @@
 #include <list>
 #include <cstdio>
 #include <exception>
+#include <atomic>
 #include <pthread.h>
+#include <time.h>
 #include "../lock/locker.h"
-#include "../CGImysql/sql_connection_pool.h"
+#include "work_steal_queue.h"
+#include "pool_stats.h"
+#include "../metrics/req_trace.h"
+#include "../probes/probes.h"
 
 template <typename T>
 class threadpool
 {
 public:
-    /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
-    threadpool(int actor_model, connection_pool *connPool, int thread_number = 8, int max_request = 10000);
+    /*thread_number是常驻线程数（下限），max_thread_number是线程数上限，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
+    /*grow_wait_ms：任务排队超过该时长则扩容；idle_ms：超出下限的线程空闲该时长后退出*/
+    threadpool(int actor_model, int thread_number = 8, int max_thread_number = 32,
+               int max_request = 10000, int grow_wait_ms = 20, int idle_ms = 10000);
     ~threadpool();
+    //append和append_p只能由主线程（事件循环）调用，它是每个工作队列唯一的生产者
     bool append(T *request, int state);
     bool append_p(T *request);
+    //当前存活的工作线程数
+    int thread_count() const { return m_live.load(); }
+    //所有队列中排队的任务数
+    int queue_size() const { return m_queued.load(); }
+    const pool_stats &stats() const { return m_stats; }
 
 private:
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
     static void *worker(void *arg);
-    void run();
+    void run(int index);
+    //按连接的fd把任务放入固定的队列，满了则依次尝试其他队列；排队总数达到上限时拒绝
+    bool push(T *request);
+    //先取自己队列中的任务，没有则从其他线程的队列窃取
+    T *take(int index, long long *stamp);
+    //增加一个工作线程，已达上限或正在关闭时返回false
+    bool grow();
+    //请求管理线程扩容一个线程，不在调用方线程上创建线程
+    void request_grow();
+    static void *manager(void *arg);
+    //空闲线程尝试退出，线程数高于下限时任意空闲线程都可以退出，其编号留给之后扩容的线程
+    bool retire(int index);
+
+    //传给工作线程的参数，记录线程所属的线程池及其编号
+    struct worker_arg
+    {
+        threadpool *pool;
+        int index;
+    };
 
 private:
-    int m_thread_number;        //线程池中的线程数
-    int m_max_requests;         //请求队列中允许的最大请求数
-    pthread_t *m_threads;       //描述线程池的数组，其大小为m_thread_number
-    std::list<T *> m_workqueue; //请求队列
-    locker m_queuelocker;       //保护请求队列的互斥锁
-    sem m_queuestat;            //是否有任务需要处理
-    connection_pool *m_connPool;  //数据库
     int m_actor_model;          //模型切换
+    int m_thread_number;        //线程数下限
+    int m_max_thread_number;    //线程数上限
+    int m_max_requests;         //请求队列中允许的最大请求数
+    int m_grow_wait_us;         //排队时延超过该值则扩容
+    int m_idle_ms;              //空闲线程的退出时间
+    pthread_t *m_threads;       //描述线程池的数组，其大小为m_max_thread_number
+    bool *m_running;            //每个编号是否有存活的线程，受m_resizelocker保护
+    worker_arg *m_args;         //每个工作线程的参数
+    work_steal_queue<T> **m_workqueues; //每个工作线程优先取一个请求队列，按上限分配，其他线程也会从中取任务
+    sem m_queuestat;            //所有队列中的任务总数，有任务才唤醒线程
+    std::atomic<int> m_queued;  //所有队列中的任务总数，准入按它限制在m_max_requests以内
+    locker m_resizelocker;      //保护线程的创建、退出和关闭
+    pthread_t m_manager;        //管理线程，负责创建扩容的工作线程
+    sem m_growsem;              //扩容请求
+    std::atomic<bool> m_grow_pending;   //已有未处理的扩容请求，合并重复的请求
+    std::atomic<int> m_live;    //存活线程数
+    std::atomic<int> m_busy;    //正在处理任务（可能阻塞在数据库上）的线程数
+    std::atomic<bool> m_stop;   //线程池关闭标志
+    pool_stats m_stats;         //准入与排队时延统计
 };
 template <typename T>
-threadpool<T>::threadpool( int actor_model, connection_pool *connPool, int thread_number, int max_requests) : m_actor_model(actor_model),m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL),m_connPool(connPool)
+threadpool<T>::threadpool( int actor_model, int thread_number, int max_thread_number,
+                           int max_requests, int grow_wait_ms, int idle_ms) : m_actor_model(actor_model), m_thread_number(thread_number), m_max_thread_number(max_thread_number),
+                           m_max_requests(max_requests), m_grow_wait_us(grow_wait_ms * 1000), m_idle_ms(idle_ms), m_threads(NULL), m_running(NULL), m_args(NULL), m_workqueues(NULL),
+                           m_queued(0), m_grow_pending(false), m_live(0), m_busy(0), m_stop(false)
 {
     if (thread_number <= 0 || max_requests <= 0)
         throw std::exception();
-    m_threads = new pthread_t[m_thread_number];
+    if (m_max_thread_number < m_thread_number)
+        m_max_thread_number = m_thread_number;
+    m_threads = new pthread_t[m_max_thread_number];
     if (!m_threads)
         throw std::exception();
-    for (int i = 0; i < thread_number; ++i)
+    m_args = new worker_arg[m_max_thread_number];
+    m_running = new bool[m_max_thread_number];
+
+    //队列按上限线程数分配，每个的容量按上限线程数平分最大请求数；容量取整到2的幂后总和会超出，准入另由m_queued限制
+    int per_queue = (m_max_requests + m_max_thread_number - 1) / m_max_thread_number;
+    m_workqueues = new work_steal_queue<T> *[m_max_thread_number];
+    for (int i = 0; i < m_max_thread_number; ++i)
     {
-        if (pthread_create(m_threads + i, NULL, worker, this) != 0)
-        {
-            delete[] m_threads;
-            throw std::exception();
-        }
-        if (pthread_detach(m_threads[i]))
-        {
-            delete[] m_threads;
-            throw std::exception();
-        }
+        m_args[i].pool = this;
+        m_args[i].index = i;
+        m_running[i] = false;
+        m_workqueues[i] = new work_steal_queue<T>(per_queue);
+    }
+
+    //常驻线程的编号为[0, thread_number)，创建失败时回收已创建的线程
+    bool ok = true;
+    for (int i = 0; i < thread_number && ok; ++i)
+        ok = grow();
+    if (ok)
+        ok = pthread_create(&m_manager, NULL, manager, this) == 0;
+    if (!ok)
+    {
+        m_stop = true;
+        int live = m_live.load();
+        for (int j = 0; j < live; ++j)
+            m_queuestat.post();
+        for (int j = 0; j < live; ++j)
+            pthread_join(m_threads[j], NULL);
+        delete[] m_threads;
+        delete[] m_running;
+        delete[] m_args;
+        for (int j = 0; j < m_max_thread_number; ++j)
+            delete m_workqueues[j];
+        delete[] m_workqueues;
+        throw std::exception();
     }
 }
 template <typename T>
 threadpool<T>::~threadpool()
 {
+    //唤醒所有线程并等待其退出，已退出的线程在retire时已分离；m_stop之后不再有线程创建或退出
+    m_resizelocker.lock();
+    m_stop = true;
+    int live = m_live.load();
+    m_resizelocker.unlock();
+
+    m_growsem.post();
+    pthread_join(m_manager, NULL);
+    for (int i = 0; i < live; ++i)
+        m_queuestat.post();
+    for (int i = 0; i < m_max_thread_number; ++i)
+    {
+        if (m_running[i])
+            pthread_join(m_threads[i], NULL);
+    }
+
     delete[] m_threads;
+    delete[] m_running;
+    delete[] m_args;
+    for (int i = 0; i < m_max_thread_number; ++i)
+        delete m_workqueues[i];
+    delete[] m_workqueues;
 }
 template <typename T>
-bool threadpool<T>::append(T *request, int state)
+bool threadpool<T>::grow()
 {
-    m_queuelocker.lock();
-    if (m_workqueue.size() >= m_max_requests)
+    m_resizelocker.lock();
+    int n = m_live.load();
+    if (m_stop || n >= m_max_thread_number)
     {
-        m_queuelocker.unlock();
+        m_resizelocker.unlock();
         return false;
     }
-    request->m_state = state;
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post();
+    //存活线程少于上限，一定有空闲的编号
+    int slot = 0;
+    while (m_running[slot])
+        ++slot;
+    if (pthread_create(m_threads + slot, NULL, worker, m_args + slot) != 0)
+    {
+        m_resizelocker.unlock();
+        return false;
+    }
+    m_running[slot] = true;
+    m_live = n + 1;
+    m_resizelocker.unlock();
     return true;
 }
 template <typename T>
-bool threadpool<T>::append_p(T *request)
+void threadpool<T>::request_grow()
+{
+    if (!m_grow_pending.exchange(true))
+        m_growsem.post();
+}
+template <typename T>
+void *threadpool<T>::manager(void *arg)
+{
+    threadpool *pool = (threadpool *)arg;
+    while (true)
+    {
+        pool->m_growsem.wait();
+        if (pool->m_stop)
+            break;
+        pool->m_grow_pending = false;
+        pool->grow();
+    }
+    return pool;
+}
+template <typename T>
+bool threadpool<T>::retire(int index)
 {
-    m_queuelocker.lock();
-    if (m_workqueue.size() >= m_max_requests)
+    m_resizelocker.lock();
+    int n = m_live.load();
+    if (m_stop || n <= m_thread_number)
     {
-        m_queuelocker.unlock();
+        m_resizelocker.unlock();
         return false;
     }
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post();
+    //该编号的队列中若还有残留任务，或之后按fd放入的任务，都会被其他线程取走
+    m_running[index] = false;
+    m_live = n - 1;
+    pthread_detach(m_threads[index]);
+    m_resizelocker.unlock();
     return true;
 }
 template <typename T>
+bool threadpool<T>::push(T *request)
+{
+    //同一连接的fd不变，按常驻线程数取模选出固定的队列，使其缓冲区留在同一个核的缓存中；不随扩缩容变化
+    if (m_queued.fetch_add(1) >= m_max_requests)
+    {
+        --m_queued;
+        ++m_stats.rejected;
+        return false;
+    }
+    int live = m_live.load();
+    int fd = request->get_sockfd();
+    int home = (fd > 0 ? fd : 0) % m_thread_number;
+    long long stamp = pool_stats::now_us();
+    request->m_trace.mark(req_trace::ENQUEUE);          //入队后可能立即被取走，须在入队前记下
+    for (int i = 0; i < m_max_thread_number; ++i)
+    {
+        if (m_workqueues[(home + i) % m_max_thread_number]->push(request, stamp))
+        {
+            ++m_stats.admitted;
+            PROBE2(enqueue, this, request);
+            m_queuestat.post();
+            //所有线程都在忙（多半阻塞在数据库上），新任务只能排队，由管理线程扩容，主线程不创建线程
+            if (m_busy.load() >= live)
+                request_grow();
+            return true;
+        }
+    }
+    request->m_trace.undo(req_trace::ENQUEUE);
+    --m_queued;
+    ++m_stats.rejected;
+    return false;
+}
+template <typename T>
+bool threadpool<T>::append(T *request, int state)
+{
+    request->m_state = state;
+    return push(request);
+}
+template <typename T>
+bool threadpool<T>::append_p(T *request)
+{
+    return push(request);
+}
+template <typename T>
+T *threadpool<T>::take(int index, long long *stamp)
+{
+    //信号量保证了至少有一个任务属于当前线程，竞争失败时重新扫描即可
+    while (true)
+    {
+        for (int i = 0; i < m_max_thread_number; ++i)
+        {
+            T *request = NULL;
+            work_steal_queue<T> *queue = m_workqueues[(index + i) % m_max_thread_number];
+            typename work_steal_queue<T>::STEAL_STATUS status;
+            while ((status = queue->steal(request, stamp)) == work_steal_queue<T>::STEAL_ABORT)
+                ;
+            if (status == work_steal_queue<T>::STEAL_OK)
+                return request;
+        }
+    }
+}
+template <typename T>
 void *threadpool<T>::worker(void *arg)
 {
-    threadpool *pool = (threadpool *)arg;
-    pool->run();
+    worker_arg *warg = (worker_arg *)arg;
+    threadpool *pool = warg->pool;
+    pool->run(warg->index);
     return pool;
 }
 template <typename T>
-void threadpool<T>::run()
+void threadpool<T>::run(int index)
 {
     while (true)
     {
-        m_queuestat.wait();
-        m_queuelocker.lock();
-        if (m_workqueue.empty())
+        if (!m_queuestat.timewait(m_idle_ms))
         {
-            m_queuelocker.unlock();
+            //空闲超时，线程数多于下限时退出
+            if (retire(index))
+                return;
             continue;
         }
-        T *request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
+        if (m_stop)
+            return;
+        long long stamp = 0;
+        T *request = take(index, &stamp);
         if (!request)
             continue;
+        --m_queued;
+        request->m_trace.mark(req_trace::DEQUEUE);
+        //排队过久说明线程不够用
+        long long wait_us = pool_stats::now_us() - stamp;
+        m_stats.record_wait(wait_us);
+        PROBE3(dequeue, this, request, wait_us);
+        if (wait_us > m_grow_wait_us)
+            request_grow();
+        ++m_busy;
         if (1 == m_actor_model)                 //Reactor
         {
             if (0 == request->m_state)
@@ -120,7 +317,6 @@ void threadpool<T>::run()
                 if (request->read_once())       //读请求数据
                 {
                     request->improv = 1;
-                    connectionRAII mysqlcon(&request->mysql, m_connPool);
                     request->process();
                 }
                 else
@@ -144,9 +340,11 @@ void threadpool<T>::run()
         }
         else                                    //Preactor
         {
-            connectionRAII mysqlcon(&request->mysql, m_connPool);
+            //访问数据库的请求在process中被转交给数据库执行器，连接在执行语句时才获取
             request->process();
         }
+        --m_busy;
+        ++m_stats.completed;
     }
 }
 #endif
@@ -0,0 +1,116 @@
+/*************************************************************
+*单生产者多消费者的无锁有界FIFO队列（定长环形数组，不扩容）
+*下标和内存序沿用Chase-Lev队列的top/bottom写法，但只保留steal一端：没有属主从bottom端LIFO弹出的pop，
+*所以它不是Chase-Lev双端队列。属主线程与其他线程一样从top端CAS取任务，先到的请求先处理
+*push只允许单一生产者调用（主线程的事件循环），steal可被任意线程并发调用
+*每个元素附带一个入队时间戳，供线程池统计排队时延
+**************************************************************/
+
+#ifndef WORK_STEAL_QUEUE_H
+#define WORK_STEAL_QUEUE_H
+
+#include <atomic>
+#include <exception>
+
+template <class T>
+class work_steal_queue
+{
+public:
+    //steal的返回状态
+    enum STEAL_STATUS
+    {
+        STEAL_OK = 0,       //成功取到任务
+        STEAL_EMPTY,        //队列为空
+        STEAL_ABORT         //与其他线程竞争失败，可重试
+    };
+
+    work_steal_queue(int capacity = 1024) : m_top(0), m_bottom(0)
+    {
+        if (capacity <= 0)
+        {
+            throw std::exception();
+        }
+
+        //容量向上取整到2的幂，下标用位与代替取余
+        m_capacity = 1;
+        while (m_capacity < capacity)
+            m_capacity <<= 1;
+        m_mask = m_capacity - 1;
+        m_array = new slot[m_capacity];
+        for (long i = 0; i < m_capacity; ++i)
+        {
+            m_array[i].item.store(NULL, std::memory_order_relaxed);
+            m_array[i].stamp.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~work_steal_queue()
+    {
+        delete[] m_array;
+    }
+
+    //生产者在bottom端放入任务，队列满时返回false
+    bool push(T *item, long long stamp = 0)
+    {
+        long b = m_bottom.load(std::memory_order_relaxed);
+        long t = m_top.load(std::memory_order_acquire);
+        if (b - t >= m_capacity)
+        {
+            return false;
+        }
+        m_array[b & m_mask].item.store(item, std::memory_order_relaxed);
+        m_array[b & m_mask].stamp.store(stamp, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);       //保证元素先于bottom对窃取者可见
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    //从top端取任务，属主线程和窃取线程都调用它
+    STEAL_STATUS steal(T *&item, long long *stamp = NULL)
+    {
+        long t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b)
+        {
+            return STEAL_EMPTY;
+        }
+        T *tmp = m_array[t & m_mask].item.load(std::memory_order_relaxed);
+        long long tmp_stamp = m_array[t & m_mask].stamp.load(std::memory_order_relaxed);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return STEAL_ABORT;
+        }
+        item = tmp;
+        if (stamp)
+            *stamp = tmp_stamp;
+        return STEAL_OK;
+    }
+
+    //近似长度，仅用于统计和调度参考
+    long size() const
+    {
+        long b = m_bottom.load(std::memory_order_relaxed);
+        long t = m_top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+private:
+    struct slot
+    {
+        std::atomic<T *> item;
+        std::atomic<long long> stamp;
+    };
+
+    work_steal_queue(const work_steal_queue &);
+    work_steal_queue &operator=(const work_steal_queue &);
+
+    //top和bottom分处不同缓存行，避免生产者与窃取者伪共享
+    alignas(64) std::atomic<long> m_top;      //窃取端
+    alignas(64) std::atomic<long> m_bottom;   //生产端
+    alignas(64) slot *m_array;                //环形数组
+    long m_capacity;
+    long m_mask;
+};
+
+#endif
@@ -1,10 +1,13 @@
 #include "lst_timer.h"
 #include "../http/http_conn.h"
+#include "../metrics/metrics.h"
+#include "../probes/probes.h"
 
 sort_timer_lst::sort_timer_lst()
 {
     head = NULL;
     tail = NULL;
+    m_count = 0;
 }
 sort_timer_lst::~sort_timer_lst()
 {
@@ -23,6 +26,7 @@ void sort_timer_lst::add_timer(util_timer *timer)
     {
         return;
     }
+    m_count++;
     if (!head)
     {
         head = tail = timer;
@@ -68,6 +72,7 @@ void sort_timer_lst::del_timer(util_timer *timer)
     {
         return;
     }
+    m_count--;
     if ((timer == head) && (timer == tail))
     {
         delete timer;
@@ -108,7 +113,10 @@ void sort_timer_lst::tick()
         {
             break;
         }
+        PROBE1(timer_expire, tmp->user_data->sockfd);
         tmp->cb_func(tmp->user_data);
+        metrics::add(metrics::CONN_TIMEOUT);
+        m_count--;
         head = tmp->next;
         if (head)
         {
@@ -223,6 +231,8 @@ void cb_func(client_data *user_data)
 {
     epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
+    PROBE1(close, user_data->sockfd);
     close(user_data->sockfd);
     http_conn::m_user_count--;
+    metrics::add(metrics::CONN_CLOSED);
 }
@@ -22,6 +22,7 @@
 #include <sys/uio.h>
 
 #include <time.h>
+#include <atomic>
 #include "../log/log.h"
 
 //前置声明
@@ -61,12 +62,14 @@ public:
     void adjust_timer(util_timer *timer);   //调整定时器
     void del_timer(util_timer *timer);      //删除定时器
     void tick();                            //将过了时间的定时器删除，调用定时器的回调函数指针              
+    int size() const { return m_count.load(std::memory_order_relaxed); }   //定时器个数，可在其他线程读取
 
 private:
     void add_timer(util_timer *timer, util_timer *lst_head);
 
     util_timer *head;       //头结点
     util_timer *tail;       //尾结点
+    std::atomic<int> m_count;
 };
 
 //工具类
@@ -0,0 +1,73 @@
+/*************************************************************
+*布隆过滤器：用于快速判断用户名是否“一定不存在”
+*只支持插入和查询，位数组大小在构造时固定，插入和查询都无锁
+*由调用者提供64位哈希值，按双重哈希 h1 + i*h2 派生k个位置
+**************************************************************/
+
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <atomic>
+#include <exception>
+#include <stdint.h>
+#include <stddef.h>
+
+class bloom_filter
+{
+public:
+    //bits向上取整到2的幂，hashes为每个元素置位的个数
+    bloom_filter(size_t bits = 1 << 24, int hashes = 7) : m_hashes(hashes)
+    {
+        if (bits == 0 || hashes <= 0)
+        {
+            throw std::exception();
+        }
+        size_t n = 64;
+        while (n < bits)
+            n <<= 1;
+        m_mask = n - 1;
+        m_words = new std::atomic<uint64_t>[n / 64];
+        for (size_t i = 0; i < n / 64; ++i)
+            m_words[i].store(0, std::memory_order_relaxed);
+    }
+
+    ~bloom_filter()
+    {
+        delete[] m_words;
+    }
+
+    void add(uint64_t h)
+    {
+        uint64_t h1 = h, h2 = (h >> 32) | (h << 32) | 1;
+        for (int i = 0; i < m_hashes; ++i, h1 += h2)
+        {
+            size_t bit = (size_t)h1 & m_mask;
+            m_words[bit >> 6].fetch_or((uint64_t)1 << (bit & 63), std::memory_order_relaxed);
+        }
+    }
+
+    //返回false时元素一定不存在，返回true时可能存在
+    bool may_contain(uint64_t h) const
+    {
+        uint64_t h1 = h, h2 = (h >> 32) | (h << 32) | 1;
+        for (int i = 0; i < m_hashes; ++i, h1 += h2)
+        {
+            size_t bit = (size_t)h1 & m_mask;
+            if (!(m_words[bit >> 6].load(std::memory_order_relaxed) & ((uint64_t)1 << (bit & 63))))
+                return false;
+        }
+        return true;
+    }
+
+    size_t bits() const { return m_mask + 1; }
+
+private:
+    bloom_filter(const bloom_filter &);
+    bloom_filter &operator=(const bloom_filter &);
+
+    std::atomic<uint64_t> *m_words;
+    size_t m_mask;
+    int m_hashes;
+};
+
+#endif
@@ -0,0 +1,71 @@
+//布隆过滤器的单元测试：不漏判、误判率在理论值附近、位数取整和非法参数
+
+#include <stdio.h>
+#include <math.h>
+#include <exception>
+#include "bloom_filter.h"
+#include "../test/check.h"
+
+//splitmix64，给测试提供分布均匀的64位哈希
+static uint64_t mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static bool throws(size_t bits, int hashes)
+{
+    try
+    {
+        bloom_filter f(bits, hashes);
+    }
+    catch (std::exception &)
+    {
+        return true;
+    }
+    return false;
+}
+
+int main()
+{
+    //位数向上取整到2的幂，至少64位
+    CHECK(bloom_filter(1, 1).bits() == 64);
+    CHECK(bloom_filter(1000, 3).bits() == 1024);
+    CHECK(bloom_filter(1 << 20, 7).bits() == (1 << 20));
+    CHECK(throws(0, 7));
+    CHECK(throws(1024, 0));
+
+    const size_t bits = 1 << 20;
+    const int hashes = 7;
+    const int n = 100000;
+    bloom_filter f(bits, hashes);
+    CHECK(!f.may_contain(mix(0)));
+
+    for (int i = 0; i < n; ++i)
+        f.add(mix(i));
+    int missed = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        if (!f.may_contain(mix(i)))
+            ++missed;
+    }
+    CHECK(missed == 0);
+
+    //理论误判率(1-e^(-kn/m))^k，约0.65%；实测不应超过两倍
+    const int probes = 200000;
+    int false_positives = 0;
+    for (int i = 0; i < probes; ++i)
+    {
+        if (f.may_contain(mix(n + i)))
+            ++false_positives;
+    }
+    double expected = pow(1 - exp(-(double)hashes * n / bits), hashes);
+    double rate = (double)false_positives / probes;
+    printf("bloom_filter_test: false positive rate %.4f, expected %.4f\n", rate, expected);
+    CHECK(rate < expected * 2);
+    CHECK(false_positives > 0);
+
+    return check_report("bloom_filter_test");
+}
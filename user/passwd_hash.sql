@@ -0,0 +1,3 @@
+-- 启用密码哈希(-k大于0，默认开启)前，在每个分片的主库上执行一次
+-- yescrypt/bcrypt的哈希约70字节，passwd列需不小于128字节，否则服务器启动时不启用哈希
+ALTER TABLE user MODIFY passwd VARCHAR(128);
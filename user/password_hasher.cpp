@@ -0,0 +1,80 @@
+#include <crypt.h>
+#include <string.h>
+#include "password_hasher.h"
+#include "../threadpool/pool_stats.h"
+
+password_hasher::password_hasher() : m_enabled(false), m_count(0), m_failures(0), m_total_us(0), m_max_us(0)
+{
+}
+
+password_hasher::~password_hasher()
+{
+}
+
+password_hasher *password_hasher::GetInstance()
+{
+    static password_hasher hasher;
+    return &hasher;
+}
+
+void password_hasher::init(int threads)
+{
+    m_enabled = threads > 0;
+}
+
+void password_hasher::record(long long us)
+{
+    ++m_count;
+    m_total_us += us;
+    long long old = m_max_us.load(std::memory_order_relaxed);
+    while (us > old && !m_max_us.compare_exchange_weak(old, us))
+        ;
+}
+
+bool password_hasher::hash(const char *passwd, string &out)
+{
+    long long start = pool_stats::now_us();
+    char salt[CRYPT_GENSALT_OUTPUT_SIZE];
+    //盐的随机数由libxcrypt从系统获取，count为0时使用该算法的默认代价
+    if (!crypt_gensalt_rn("$y$", 0, NULL, 0, salt, sizeof(salt)) &&
+        !crypt_gensalt_rn("$2b$", 0, NULL, 0, salt, sizeof(salt)))
+    {
+        ++m_failures;
+        return false;
+    }
+    struct crypt_data data;
+    memset(&data, 0, sizeof(data));
+    const char *h = crypt_rn(passwd, salt, &data, sizeof(data));
+    if (!h || h[0] == '*')
+    {
+        ++m_failures;
+        return false;
+    }
+    out = h;
+    record(pool_stats::now_us() - start);
+    return true;
+}
+
+//常量时间比较，避免按匹配的前缀长度泄露信息
+static bool equal(const char *a, const char *b)
+{
+    size_t la = strlen(a), lb = strlen(b);
+    unsigned char diff = la != lb;
+    for (size_t i = 0; i < la && i < lb; ++i)
+        diff |= (unsigned char)(a[i] ^ b[i]);
+    return diff == 0;
+}
+
+bool password_hasher::verify(const char *passwd, const char *stored)
+{
+    if (stored[0] != '$')
+        return equal(passwd, stored);
+
+    long long start = pool_stats::now_us();
+    struct crypt_data data;
+    memset(&data, 0, sizeof(data));
+    const char *h = crypt_rn(passwd, stored, &data, sizeof(data));
+    bool ok = h && h[0] != '*' && equal(h, stored);
+    record(pool_stats::now_us() - start);
+    return ok;
+}
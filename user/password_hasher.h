@@ -0,0 +1,59 @@
+/*************************************************************
+*密码哈希：使用libxcrypt的yescrypt（内存困难，基于scrypt），不支持时退回bcrypt
+*结果为crypt格式字符串（如$y$...），盐和参数都包含在其中，校验时直接传回crypt_rn
+*不以$开头的旧记录视为明文，按常量时间比较，兼容升级前注册的用户
+*哈希和校验每次耗时数毫秒，应在单独的执行器上调用，这里只记录耗时统计
+*哈希长度约70字节，user表的passwd列需不小于128字节，旧表先执行同目录下的passwd_hash.sql
+*启动时检查列宽，不足时不启用哈希；登录成功的明文用户在哈希执行器中改存为哈希
+**************************************************************/
+
+#ifndef PASSWORD_HASHER_H
+#define PASSWORD_HASHER_H
+
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+class password_hasher
+{
+public:
+    static password_hasher *GetInstance();
+
+    //保存哈希所需的passwd列宽
+    static const int MIN_COLUMN_WIDTH = 128;
+
+    //threads为哈希执行器的线程数，不大于0时不启用，密码按明文保存和比较
+    void init(int threads);
+    bool enabled() const { return m_enabled; }
+
+    //生成密码的哈希
+    bool hash(const char *passwd, string &out);
+    //校验密码与保存的哈希（或旧的明文）是否一致
+    bool verify(const char *passwd, const char *stored);
+    //启用哈希时，保存的是旧的明文记录，登录成功后应改存为哈希
+    bool needs_rehash(const char *stored) const { return m_enabled && stored[0] != '$'; }
+
+    long long count() const { return m_count.load(); }                 //哈希与校验的次数
+    long long failures() const { return m_failures.load(); }           //生成哈希失败的次数
+    long long latency_avg_us() const
+    {
+        long long n = m_count.load();
+        return n > 0 ? m_total_us.load() / n : 0;
+    }
+    long long latency_max_us() const { return m_max_us.load(); }
+
+private:
+    password_hasher();
+    ~password_hasher();
+
+    void record(long long us);
+
+    bool m_enabled;
+    std::atomic<long long> m_count;
+    std::atomic<long long> m_failures;
+    std::atomic<long long> m_total_us;
+    std::atomic<long long> m_max_us;
+};
+
+#endif
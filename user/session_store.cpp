@@ -0,0 +1,136 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/random.h>
+#include "session_store.h"
+
+session_store::session_store() : m_ttl(0)
+{
+    m_shards = new shard[SHARD_COUNT];
+}
+
+session_store::~session_store()
+{
+    delete[] m_shards;
+}
+
+session_store *session_store::GetInstance()
+{
+    static session_store sessions;
+    return &sessions;
+}
+
+void session_store::init(int ttl)
+{
+    m_ttl = ttl;
+}
+
+bool session_store::random_token(char *token)
+{
+    unsigned char buf[TOKEN_LEN / 2];
+    size_t got = 0;
+    while (got < sizeof(buf))
+    {
+        ssize_t n = getrandom(buf + got, sizeof(buf) - got, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        got += n;
+    }
+    static const char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < sizeof(buf); ++i)
+    {
+        token[2 * i] = hex[buf[i] >> 4];
+        token[2 * i + 1] = hex[buf[i] & 0xf];
+    }
+    token[TOKEN_LEN] = '\0';
+    return true;
+}
+
+//令牌本身是随机的，直接取前两位十六进制作为分片下标
+session_store::shard &session_store::shard_of(const char *token)
+{
+    int h = 0;
+    for (int i = 0; i < 2 && token[i]; ++i)
+    {
+        char c = token[i];
+        h = h * 16 + (c >= 'a' ? c - 'a' + 10 : c - '0');
+    }
+    return m_shards[h & (SHARD_COUNT - 1)];
+}
+
+bool session_store::create(const char *name, char *token)
+{
+    if (!enabled() || !random_token(token))
+        return false;
+    session s;
+    s.name = name;
+    s.expire = time(NULL) + m_ttl;
+
+    shard &sh = shard_of(token);
+    sh.lock.lock();
+    sh.sessions[token] = s;
+    sh.order.push_back(make_pair(s.expire, string(token)));
+    sh.lock.unlock();
+    return true;
+}
+
+bool session_store::find(const char *token, string &name)
+{
+    if (!enabled() || strlen(token) != TOKEN_LEN)
+        return false;
+    shard &sh = shard_of(token);
+    bool found = false;
+    sh.lock.lock();
+    unordered_map<string, session>::iterator it = sh.sessions.find(token);
+    if (it != sh.sessions.end() && it->second.expire > time(NULL))
+    {
+        name = it->second.name;
+        found = true;
+    }
+    sh.lock.unlock();
+    return found;
+}
+
+void session_store::remove(const char *token)
+{
+    shard &sh = shard_of(token);
+    sh.lock.lock();
+    sh.sessions.erase(token);               //order中的令牌到期时再清理
+    sh.lock.unlock();
+}
+
+int session_store::expire()
+{
+    int n = 0;
+    time_t now = time(NULL);
+    for (int i = 0; i < SHARD_COUNT; ++i)
+    {
+        shard &sh = m_shards[i];
+        sh.lock.lock();
+        //有效期固定，order按到期时间有序，只需从队首清理
+        while (!sh.order.empty() && sh.order.front().first <= now)
+        {
+            n += sh.sessions.erase(sh.order.front().second);
+            sh.order.pop_front();
+        }
+        sh.lock.unlock();
+    }
+    return n;
+}
+
+size_t session_store::size()
+{
+    size_t n = 0;
+    for (int i = 0; i < SHARD_COUNT; ++i)
+    {
+        m_shards[i].lock.lock();
+        n += m_shards[i].sessions.size();
+        m_shards[i].lock.unlock();
+    }
+    return n;
+}
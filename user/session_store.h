@@ -0,0 +1,67 @@
+/*************************************************************
+*服务端会话：登录成功后发放随机令牌（Set-Cookie: sid=...），之后的请求凭Cookie识别用户
+*令牌为128位随机数的十六进制表示，按令牌前两位分片，每个分片一把锁
+*会话有效期固定，每个分片按创建顺序保存到期时间，由定时器的tick逐个清理到期会话
+**************************************************************/
+
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <list>
+#include <string>
+#include <utility>
+#include <unordered_map>
+#include <time.h>
+#include "../lock/locker.h"
+
+using namespace std;
+
+class session_store
+{
+public:
+    static const int TOKEN_LEN = 32;        //令牌长度（十六进制字符数）
+
+    static session_store *GetInstance();
+
+    //ttl为会话有效期(秒)，不大于0时不启用会话
+    void init(int ttl);
+    bool enabled() const { return m_ttl > 0; }
+    int ttl() const { return m_ttl; }
+
+    //为用户创建会话，令牌写入token（TOKEN_LEN+1字节）
+    bool create(const char *name, char *token);
+    //查找未过期的会话，找到时把用户名写入name
+    bool find(const char *token, string &name);
+    //删除会话
+    void remove(const char *token);
+    //清理到期的会话，由定时器周期调用，返回清理的个数
+    int expire();
+    size_t size();
+
+private:
+    session_store();
+    ~session_store();
+
+    struct session
+    {
+        string name;
+        time_t expire;
+    };
+
+    struct shard
+    {
+        locker lock;
+        unordered_map<string, session> sessions;
+        list<pair<time_t, string> > order;      //按到期时间排列的令牌
+    };
+
+    static const int SHARD_COUNT = 64;
+
+    static bool random_token(char *token);
+    shard &shard_of(const char *token);
+
+    shard *m_shards;
+    int m_ttl;
+};
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "user_snapshot.h"
+
+static const char SNAPSHOT_MAGIC[8] = {'U', 'S', 'E', 'R', 'S', 'N', 'A', 'P'};
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+user_snapshot::user_snapshot() : m_addr(NULL), m_size(0), m_buckets(NULL), m_mask(0), m_count(0)
+{
+}
+
+user_snapshot::~user_snapshot()
+{
+    if (m_addr)
+        munmap(m_addr, m_size);
+}
+
+user_snapshot *user_snapshot::open(const char *path)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(header))
+    {
+        close(fd);
+        return NULL;
+    }
+    //只读共享映射，多个进程共用页缓存
+    char *addr = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    const header *h = (const header *)addr;
+    size_t buckets_end = sizeof(header) + ((size_t)1 << h->bucket_bits) * sizeof(bucket);
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || h->version != SNAPSHOT_VERSION ||
+        h->bucket_bits > 32 || h->file_size != (uint64_t)st.st_size || buckets_end > (size_t)st.st_size)
+    {
+        munmap(addr, st.st_size);
+        return NULL;
+    }
+    //桶数组按随机访问，不做预读
+    madvise(addr, buckets_end, MADV_RANDOM);
+
+    user_snapshot *snap = new user_snapshot;
+    snap->m_addr = addr;
+    snap->m_size = st.st_size;
+    snap->m_buckets = (const bucket *)(addr + sizeof(header));
+    snap->m_mask = ((uint64_t)1 << h->bucket_bits) - 1;
+    snap->m_count = h->count;
+    return snap;
+}
+
+const user_snapshot::entry *user_snapshot::entry_at(uint32_t off) const
+{
+    size_t pos = (size_t)off * 8;
+    if (pos + offsetof(entry, data) > m_size)
+        return NULL;
+    const entry *e = (const entry *)(m_addr + pos);
+    if (pos + offsetof(entry, data) + e->name_len + e->passwd_len > m_size)
+        return NULL;
+    return e;
+}
+
+bool user_snapshot::find(uint64_t h, const char *name, size_t len, const char **passwd, size_t *passwd_len) const
+{
+    uint32_t tag = (uint32_t)(h >> 32);
+    //写入时保证至少有一个空槽位，探测必然终止
+    for (uint64_t i = h & m_mask;; i = (i + 1) & m_mask)
+    {
+        const bucket &b = m_buckets[i];
+        for (int j = 0; j < BUCKET_SLOTS; ++j)
+        {
+            if (b.off[j] == 0)
+                return false;
+            if (b.tag[j] != tag)
+                continue;
+            const entry *e = entry_at(b.off[j]);
+            if (e && e->name_len == len && memcmp(e->data, name, len) == 0)
+            {
+                *passwd = e->data + e->name_len;
+                *passwd_len = e->passwd_len;
+                return true;
+            }
+        }
+    }
+}
+
+void user_snapshot::for_each(visitor v, void *arg) const
+{
+    for (uint64_t i = 0; i <= m_mask; ++i)
+    {
+        const bucket &b = m_buckets[i];
+        for (int j = 0; j < BUCKET_SLOTS && b.off[j]; ++j)
+        {
+            const entry *e = entry_at(b.off[j]);
+            if (e)
+                v(arg, e->data, e->name_len, e->data + e->name_len, e->passwd_len);
+        }
+    }
+}
+
+bool user_snapshot::write(const char *path, const vector<record> &records)
+{
+    //负载因子不超过3/4
+    uint32_t bits = 0;
+    while (((size_t)BUCKET_SLOTS << bits) * 3 < (records.size() + 1) * 4)
+        ++bits;
+    size_t nbuckets = (size_t)1 << bits;
+    vector<bucket> buckets(nbuckets);
+    memset(&buckets[0], 0, nbuckets * sizeof(bucket));
+
+    //先确定每条记录的偏移并填好桶数组
+    size_t pos = sizeof(header) + nbuckets * sizeof(bucket);
+    for (size_t k = 0; k < records.size(); ++k)
+    {
+        const record &r = records[k];
+        if (r.name_len > 0xffff || r.passwd_len > 0xffff || pos / 8 > 0xffffffffULL)
+            return false;
+        bool placed = false;
+        for (size_t i = r.hash & (nbuckets - 1); !placed; i = (i + 1) & (nbuckets - 1))
+        {
+            for (int j = 0; j < BUCKET_SLOTS; ++j)
+            {
+                if (buckets[i].off[j] == 0)
+                {
+                    buckets[i].tag[j] = (uint32_t)(r.hash >> 32);
+                    buckets[i].off[j] = (uint32_t)(pos / 8);
+                    placed = true;
+                    break;
+                }
+            }
+        }
+        pos += (offsetof(entry, data) + r.name_len + r.passwd_len + 7) & ~(size_t)7;
+    }
+
+    header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    h.version = SNAPSHOT_VERSION;
+    h.bucket_bits = bits;
+    h.count = records.size();
+    h.file_size = pos;
+
+    string tmp = string(path) + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp)
+        return false;
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+              fwrite(&buckets[0], sizeof(bucket), nbuckets, fp) == nbuckets;
+    static const char zeros[8] = {0};
+    for (size_t k = 0; ok && k < records.size(); ++k)
+    {
+        const record &r = records[k];
+        uint16_t lens[2] = {(uint16_t)r.name_len, (uint16_t)r.passwd_len};
+        size_t len = offsetof(entry, data) + r.name_len + r.passwd_len;
+        ok = fwrite(lens, sizeof(lens), 1, fp) == 1 &&
+             fwrite(r.name, 1, r.name_len, fp) == r.name_len &&
+             fwrite(r.passwd, 1, r.passwd_len, fp) == r.passwd_len &&
+             fwrite(zeros, 1, ((len + 7) & ~(size_t)7) - len, fp) == ((len + 7) & ~(size_t)7) - len;
+    }
+    ok = fflush(fp) == 0 && ok;
+    ok = fsync(fileno(fp)) == 0 && ok;
+    ok = fclose(fp) == 0 && ok;
+    //rename是原子的，已映射旧文件的进程继续使用旧的inode
+    if (!ok || rename(tmp.c_str(), path) != 0)
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
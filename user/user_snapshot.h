@@ -0,0 +1,88 @@
+/*************************************************************
+*用户表快照：只读的磁盘索引文件，启动时mmap后即可查询，无需从数据库重建
+*文件布局：64字节文件头 | 桶数组（每桶一条缓存行，8个槽位） | 记录区
+*槽位保存哈希高32位和记录偏移（8字节为单位），查找通常只触及一条缓存行和一条记录
+*写入时先写临时文件再rename，正在使用旧文件的进程不受影响
+**************************************************************/
+
+#ifndef USER_SNAPSHOT_H
+#define USER_SNAPSHOT_H
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+using namespace std;
+
+class user_snapshot
+{
+public:
+    //待写入的一条记录，name和passwd不要求以\0结尾
+    struct record
+    {
+        uint64_t hash;
+        const char *name;
+        size_t name_len;
+        const char *passwd;
+        size_t passwd_len;
+    };
+
+    //遍历回调
+    typedef void (*visitor)(void *arg, const char *name, size_t name_len, const char *passwd, size_t passwd_len);
+
+    //打开并映射快照文件，文件不存在或格式不符时返回NULL
+    static user_snapshot *open(const char *path);
+    //把记录写成快照文件，hash须与查询时使用的哈希函数一致
+    static bool write(const char *path, const vector<record> &records);
+
+    ~user_snapshot();
+
+    //查找用户，找到时passwd指向映射区中的密码（不以\0结尾）
+    bool find(uint64_t h, const char *name, size_t len, const char **passwd, size_t *passwd_len) const;
+    void for_each(visitor v, void *arg) const;
+
+    size_t size() const { return m_count; }
+    size_t file_size() const { return m_size; }
+
+private:
+    static const int BUCKET_SLOTS = 8;
+
+    //文件头，占一条缓存行
+    struct header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t bucket_bits;
+        uint64_t count;
+        uint64_t file_size;
+        char reserved[32];
+    };
+
+    struct bucket
+    {
+        uint32_t tag[BUCKET_SLOTS];     //哈希高32位
+        uint32_t off[BUCKET_SLOTS];     //记录偏移/8，0表示空槽位
+    };
+
+    //记录区中的一条记录，随后依次是用户名和密码
+    struct entry
+    {
+        uint16_t name_len;
+        uint16_t passwd_len;
+        char data[1];
+    };
+
+    user_snapshot();
+    user_snapshot(const user_snapshot &);
+    user_snapshot &operator=(const user_snapshot &);
+
+    const entry *entry_at(uint32_t off) const;
+
+    char *m_addr;                   //映射区
+    size_t m_size;
+    const bucket *m_buckets;
+    uint64_t m_mask;                //桶数-1
+    size_t m_count;
+};
+
+#endif
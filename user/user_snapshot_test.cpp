@@ -0,0 +1,231 @@
+//用户表快照的单元测试：写入后查找与遍历、哈希冲突、替换文件不影响已映射的旧快照、损坏文件，
+//以及用户表挂载快照后的查询、增量覆盖和合并保存
+//快照文件写在临时目录中，结束时删除
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "user_snapshot.h"
+#include "user_table.h"
+#include "../test/check.h"
+
+using namespace std;
+
+static uint64_t mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static string lookup(const user_snapshot *snap, uint64_t h, const string &name, bool *found)
+{
+    const char *pw = NULL;
+    size_t len = 0;
+    *found = snap->find(h, name.data(), name.size(), &pw, &len);
+    return *found ? string(pw, len) : string();
+}
+
+static void collect(void *arg, const char *name, size_t name_len, const char *passwd, size_t passwd_len)
+{
+    (*(map<string, string> *)arg)[string(name, name_len)] = string(passwd, passwd_len);
+}
+
+static void write_file(const string &path, const void *data, size_t len)
+{
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp)
+        return;
+    fwrite(data, 1, len, fp);
+    fclose(fp);
+}
+
+static string read_file(const string &path)
+{
+    string out;
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return out;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        out.append(buf, n);
+    fclose(fp);
+    return out;
+}
+
+static void test_write_find(const string &path)
+{
+    const int n = 50000;
+    vector<string> names(n), passwds(n);
+    vector<user_snapshot::record> records;
+    for (int i = 0; i < n; ++i)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "user%d", i);
+        names[i] = buf;
+        passwds[i] = string(i % 17, 'p') + buf;
+    }
+    for (int i = 0; i < n; ++i)
+    {
+        //每100个用户共用一个哈希值，测试同一标签下按用户名区分和跨桶探测
+        uint64_t h = i % 100 == 0 ? mix(0) : mix(i);
+        user_snapshot::record r = {h, names[i].data(), names[i].size(), passwds[i].data(), passwds[i].size()};
+        records.push_back(r);
+    }
+    CHECK(user_snapshot::write(path.c_str(), records));
+
+    user_snapshot *snap = user_snapshot::open(path.c_str());
+    CHECK(snap != NULL);
+    if (!snap)
+        return;
+    CHECK(snap->size() == (size_t)n);
+    int wrong = 0;
+    bool found;
+    for (int i = 0; i < n; ++i)
+    {
+        if (lookup(snap, records[i].hash, names[i], &found) != passwds[i] || !found)
+            ++wrong;
+    }
+    CHECK(wrong == 0);
+    lookup(snap, mix(0), "user1", &found);
+    CHECK(!found);
+    lookup(snap, mix(n + 1), "nobody", &found);
+    CHECK(!found);
+    lookup(snap, mix(1), "user1x", &found);
+    CHECK(!found);
+
+    map<string, string> all;
+    snap->for_each(collect, &all);
+    CHECK(all.size() == (size_t)n);
+    CHECK(all["user123"] == passwds[123]);
+
+    //替换文件后已映射的旧快照照常可用，新打开的看到新内容
+    string old_pw = passwds[7];
+    vector<user_snapshot::record> one(1, records[0]);
+    CHECK(user_snapshot::write(path.c_str(), one));
+    CHECK(lookup(snap, records[7].hash, names[7], &found) == old_pw && found);
+    user_snapshot *fresh = user_snapshot::open(path.c_str());
+    CHECK(fresh && fresh->size() == 1);
+    delete fresh;
+    delete snap;
+
+    //空快照
+    CHECK(user_snapshot::write(path.c_str(), vector<user_snapshot::record>()));
+    snap = user_snapshot::open(path.c_str());
+    CHECK(snap && snap->size() == 0);
+    if (snap)
+    {
+        lookup(snap, mix(1), "user1", &found);
+        CHECK(!found);
+    }
+    delete snap;
+}
+
+static void test_corrupt(const string &path)
+{
+    CHECK(user_snapshot::open((path + ".missing").c_str()) == NULL);
+
+    user_snapshot::record r = {mix(1), "alice", 5, "secret", 6};
+    CHECK(user_snapshot::write(path.c_str(), vector<user_snapshot::record>(1, r)));
+    string good = read_file(path);
+    CHECK(good.size() > 64);
+
+    string bad = good;
+    bad[0] = 'X';                                   //magic
+    write_file(path, bad.data(), bad.size());
+    CHECK(user_snapshot::open(path.c_str()) == NULL);
+
+    write_file(path, good.data(), good.size() - 8); //截断，与文件头中的大小不符
+    CHECK(user_snapshot::open(path.c_str()) == NULL);
+
+    write_file(path, good.data(), 10);              //不足一个文件头
+    CHECK(user_snapshot::open(path.c_str()) == NULL);
+
+    //长度超过16位的用户名无法写入，原文件保持不变
+    string long_name(0x10000, 'n');
+    user_snapshot::record too_long = {mix(2), long_name.data(), long_name.size(), "x", 1};
+    CHECK(!user_snapshot::write(path.c_str(), vector<user_snapshot::record>(1, too_long)));
+    CHECK(read_file(path) == string(good.data(), 10));
+
+    write_file(path, good.data(), good.size());
+    user_snapshot *snap = user_snapshot::open(path.c_str());
+    CHECK(snap && snap->size() == 1);
+    delete snap;
+}
+
+//子进程的用户表写出快照，父进程的用户表挂载它，覆盖部分用户后再合并保存
+static void test_table(const string &path, const string &merged)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        user_table *users = user_table::GetInstance();
+        users->insert("alice", "a1");
+        users->insert("bob", "b1");
+        bool ok = users->save_snapshot(path.c_str());
+        _exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    user_table *users = user_table::GetInstance();
+    CHECK(users->load_snapshot(path.c_str()));
+    CHECK(users->snapshot_size() == 2);
+    CHECK(users->size() == 0);
+    string pw;
+    CHECK(users->find("alice", pw) && pw == "a1");
+    CHECK(users->check("bob", "b1"));
+    CHECK(!users->contains("carol"));
+    CHECK(!users->insert("alice", "a2"));           //快照中已有的用户不能重复注册
+
+    users->set("alice", "a2");
+    users->insert("carol", "c1");
+    CHECK(users->check("alice", "a2") && !users->check("alice", "a1"));
+    CHECK(users->size() == 2);
+
+    CHECK(users->save_snapshot(merged.c_str()));
+    user_snapshot *snap = user_snapshot::open(merged.c_str());
+    CHECK(snap != NULL);
+    if (snap)
+    {
+        map<string, string> all;
+        snap->for_each(collect, &all);
+        CHECK(all.size() == 3);
+        CHECK(all["alice"] == "a2" && all["bob"] == "b1" && all["carol"] == "c1");
+        delete snap;
+    }
+
+    //没有新的写入时不重写文件
+    unlink(merged.c_str());
+    CHECK(users->save_snapshot(merged.c_str()));
+    CHECK(access(merged.c_str(), F_OK) != 0);
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/user_snapshot_test.XXXXXX";
+    if (!mkdtemp(tmpl))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    string dir = tmpl;
+    string path = dir + "/users.snap", merged = dir + "/merged.snap";
+
+    test_write_find(path);
+    test_corrupt(path);
+    test_table(path, merged);
+
+    unlink(path.c_str());
+    unlink(merged.c_str());
+    rmdir(dir.c_str());
+    return check_report("user_snapshot_test");
+}
@@ -0,0 +1,359 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <new>
+#include "user_table.h"
+
+using namespace std;
+
+user_table::user_table() : m_snapshot(NULL), m_version(0), m_saved_version(0), m_loaded(false)
+{
+    m_shards = new shard[SHARD_COUNT];
+    for (int i = 0; i < SHARD_COUNT; ++i)
+    {
+        m_shards[i].tab.store(new_table(INIT_CAPACITY), std::memory_order_relaxed);
+        m_shards[i].count = 0;
+        m_shards[i].pool.used = 0;
+        m_shards[i].pool.block_size = 0;
+        m_shards[i].pool.total = 0;
+    }
+}
+
+user_table::~user_table()
+{
+    for (int i = 0; i < SHARD_COUNT; ++i)
+    {
+        shard &s = m_shards[i];
+        free_table(s.tab.load());
+        for (size_t j = 0; j < s.retired.size(); ++j)
+            free_table(s.retired[j]);
+        for (size_t j = 0; j < s.pool.blocks.size(); ++j)
+            free(s.pool.blocks[j]);
+    }
+    delete[] m_shards;
+    delete m_snapshot.load();
+}
+
+user_table *user_table::GetInstance()
+{
+    static user_table users;
+    return &users;
+}
+
+//FNV-1a，用户名很短，足够均匀且无需额外依赖
+uint64_t user_table::hash(const char *s, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+user_table::table *user_table::new_table(size_t capacity)
+{
+    table *t = new table;
+    t->capacity = capacity;
+    t->slots = new std::atomic<const entry *>[capacity];
+    for (size_t i = 0; i < capacity; ++i)
+        t->slots[i].store(NULL, std::memory_order_relaxed);
+    return t;
+}
+
+void user_table::free_table(table *t)
+{
+    if (t)
+    {
+        delete[] t->slots;
+        delete t;
+    }
+}
+
+size_t user_table::probe(const table *t, uint64_t h, const char *name, size_t len, const entry **found)
+{
+    size_t mask = t->capacity - 1;
+    //低位用于槽位下标，高位已用于选择分片
+    size_t i = (size_t)h & mask;
+    while (true)
+    {
+        const entry *e = t->slots[i].load(std::memory_order_acquire);
+        if (!e)
+        {
+            *found = NULL;
+            return i;
+        }
+        if (e->hash == h && e->name_len == len && memcmp(e->data, name, len) == 0)
+        {
+            *found = e;
+            return i;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+const user_table::entry *user_table::lookup(const char *name, size_t len, uint64_t h) const
+{
+    if (!m_bloom.may_contain(h))        //一定不存在，不必探测槽位数组
+        return NULL;
+    const shard &s = m_shards[h >> (64 - SHARD_BITS)];
+    const entry *e = NULL;
+    probe(s.tab.load(std::memory_order_acquire), h, name, len, &e);
+    return e;
+}
+
+bool user_table::lookup_snapshot(const char *name, size_t len, uint64_t h, const char **passwd, size_t *passwd_len) const
+{
+    const user_snapshot *snap = m_snapshot.load(std::memory_order_acquire);
+    return snap && snap->find(h, name, len, passwd, passwd_len);
+}
+
+bool user_table::find(const char *name, string &passwd) const
+{
+    size_t len = strlen(name);
+    uint64_t h = hash(name, len);
+    const entry *e = lookup(name, len, h);
+    if (e)
+    {
+        passwd.assign(e->passwd(), e->passwd_len);
+        return true;
+    }
+    const char *p;
+    size_t plen;
+    if (!lookup_snapshot(name, len, h, &p, &plen))
+        return false;
+    passwd.assign(p, plen);
+    return true;
+}
+
+bool user_table::contains(const char *name) const
+{
+    size_t len = strlen(name);
+    uint64_t h = hash(name, len);
+    const char *p;
+    size_t plen;
+    return lookup(name, len, h) != NULL || lookup_snapshot(name, len, h, &p, &plen);
+}
+
+bool user_table::check(const char *name, const char *passwd) const
+{
+    size_t len = strlen(name);
+    uint64_t h = hash(name, len);
+    size_t passwd_len = strlen(passwd);
+    const entry *e = lookup(name, len, h);
+    if (e)
+        return e->passwd_len == passwd_len && memcmp(e->passwd(), passwd, passwd_len) == 0;
+    const char *p;
+    size_t plen;
+    return lookup_snapshot(name, len, h, &p, &plen) && plen == passwd_len && memcmp(p, passwd, plen) == 0;
+}
+
+const user_table::entry *user_table::make_entry(shard &s, uint64_t h, const char *name, size_t name_len,
+                                                const char *passwd, size_t passwd_len)
+{
+    //按8字节对齐分配
+    size_t need = (offsetof(entry, data) + name_len + passwd_len + 7) & ~(size_t)7;
+    arena &a = s.pool;
+    if (a.blocks.empty() || a.used + need > a.block_size)
+    {
+        size_t size = need > BLOCK_SIZE ? need : BLOCK_SIZE;
+        char *block = (char *)malloc(size);
+        if (!block)
+            throw std::bad_alloc();
+        a.blocks.push_back(block);
+        a.used = 0;
+        a.block_size = size;
+        a.total += size;
+    }
+    entry *e = (entry *)(a.blocks.back() + a.used);
+    a.used += need;
+
+    e->hash = h;
+    e->name_len = (uint16_t)name_len;
+    e->passwd_len = (uint16_t)passwd_len;
+    memcpy(e->data, name, name_len);
+    memcpy(e->data + name_len, passwd, passwd_len);
+    return e;
+}
+
+void user_table::grow(shard &s)
+{
+    table *old = s.tab.load(std::memory_order_relaxed);
+    table *t = new_table(old->capacity * 2);
+    for (size_t i = 0; i < old->capacity; ++i)
+    {
+        const entry *e = old->slots[i].load(std::memory_order_relaxed);
+        if (!e)
+            continue;
+        size_t mask = t->capacity - 1;
+        size_t j = (size_t)e->hash & mask;
+        while (t->slots[j].load(std::memory_order_relaxed))
+            j = (j + 1) & mask;
+        t->slots[j].store(e, std::memory_order_relaxed);
+    }
+    //新数组填充完毕后再发布，读者看到的要么是旧数组要么是完整的新数组
+    s.tab.store(t, std::memory_order_release);
+    s.retired.push_back(old);
+}
+
+bool user_table::insert(const char *name, const char *passwd)
+{
+    size_t name_len = strlen(name);
+    size_t passwd_len = strlen(passwd);
+    if (name_len > 0xffff || passwd_len > 0xffff)
+        return false;
+    uint64_t h = hash(name, name_len);
+    const char *p;
+    size_t plen;
+    if (lookup_snapshot(name, name_len, h, &p, &plen))
+        return false;
+    shard &s = m_shards[h >> (64 - SHARD_BITS)];
+
+    s.lock.lock();
+    //负载因子保持在3/4以下
+    if ((s.count + 1) * 4 > s.tab.load(std::memory_order_relaxed)->capacity * 3)
+        grow(s);
+    table *t = s.tab.load(std::memory_order_relaxed);
+    const entry *e = NULL;
+    size_t i = probe(t, h, name, name_len, &e);
+    if (e)
+    {
+        s.lock.unlock();
+        return false;
+    }
+    m_bloom.add(h);                     //先置位再发布记录，读者看到记录时过滤器已包含它
+    t->slots[i].store(make_entry(s, h, name, name_len, passwd, passwd_len), std::memory_order_release);
+    ++s.count;
+    m_version.fetch_add(1, std::memory_order_relaxed);
+    s.lock.unlock();
+    return true;
+}
+
+void user_table::set(const char *name, const char *passwd)
+{
+    size_t name_len = strlen(name);
+    size_t passwd_len = strlen(passwd);
+    if (name_len > 0xffff || passwd_len > 0xffff)
+        return;
+    uint64_t h = hash(name, name_len);
+    shard &s = m_shards[h >> (64 - SHARD_BITS)];
+
+    s.lock.lock();
+    if ((s.count + 1) * 4 > s.tab.load(std::memory_order_relaxed)->capacity * 3)
+        grow(s);
+    table *t = s.tab.load(std::memory_order_relaxed);
+    const entry *e = NULL;
+    size_t i = probe(t, h, name, name_len, &e);
+    if (!e)
+    {
+        ++s.count;
+        m_bloom.add(h);
+    }
+    //覆盖时旧记录留在内存池中，读者仍可安全访问
+    t->slots[i].store(make_entry(s, h, name, name_len, passwd, passwd_len), std::memory_order_release);
+    m_version.fetch_add(1, std::memory_order_relaxed);
+    s.lock.unlock();
+}
+
+size_t user_table::size() const
+{
+    size_t n = 0;
+    for (int i = 0; i < SHARD_COUNT; ++i)
+    {
+        m_shards[i].lock.lock();
+        n += m_shards[i].count;
+        m_shards[i].lock.unlock();
+    }
+    return n;
+}
+
+size_t user_table::memory_usage() const
+{
+    size_t n = 0;
+    for (int i = 0; i < SHARD_COUNT; ++i)
+    {
+        shard &s = m_shards[i];
+        s.lock.lock();
+        n += s.pool.total + s.tab.load(std::memory_order_relaxed)->capacity * sizeof(void *);
+        for (size_t j = 0; j < s.retired.size(); ++j)
+            n += s.retired[j]->capacity * sizeof(void *);
+        s.lock.unlock();
+    }
+    return n + m_bloom.bits() / 8;
+}
+
+bool user_table::load_snapshot(const char *path)
+{
+    user_snapshot *snap = user_snapshot::open(path);
+    if (!snap)
+        return false;
+    delete m_snapshot.exchange(snap);   //只在处理请求前调用，没有读者持有旧快照
+    return true;
+}
+
+struct snapshot_merge
+{
+    const user_table *table;
+    vector<user_snapshot::record> *records;
+};
+
+bool user_table::save_snapshot(const char *path)
+{
+    m_save_lock.lock();
+    unsigned long long version = m_version.load(std::memory_order_relaxed);
+    if (version == m_saved_version)
+    {
+        m_save_lock.unlock();
+        return true;
+    }
+
+    //增量中的记录在内存池中不会移动或释放，拷贝指针后即可释放分片锁
+    vector<user_snapshot::record> records;
+    for (int i = 0; i < SHARD_COUNT; ++i)
+    {
+        shard &s = m_shards[i];
+        s.lock.lock();
+        table *t = s.tab.load(std::memory_order_relaxed);
+        for (size_t j = 0; j < t->capacity; ++j)
+        {
+            const entry *e = t->slots[j].load(std::memory_order_relaxed);
+            if (!e)
+                continue;
+            user_snapshot::record r = {e->hash, e->data, e->name_len, e->passwd(), e->passwd_len};
+            records.push_back(r);
+        }
+        s.lock.unlock();
+    }
+
+    //快照中未被增量覆盖的记录
+    const user_snapshot *snap = m_snapshot.load(std::memory_order_acquire);
+    if (snap)
+    {
+        struct visit
+        {
+            static void add(void *arg, const char *name, size_t name_len, const char *passwd, size_t passwd_len)
+            {
+                snapshot_merge *m = (snapshot_merge *)arg;
+                uint64_t h = hash(name, name_len);
+                if (m->table->lookup(name, name_len, h))
+                    return;
+                user_snapshot::record r = {h, name, name_len, passwd, passwd_len};
+                m->records->push_back(r);
+            }
+        };
+        snapshot_merge m = {this, &records};
+        snap->for_each(visit::add, &m);
+    }
+
+    bool ok = user_snapshot::write(path, records);
+    if (ok)
+        m_saved_version = version;
+    m_save_lock.unlock();
+    return ok;
+}
+
+size_t user_table::snapshot_size() const
+{
+    const user_snapshot *snap = m_snapshot.load(std::memory_order_acquire);
+    return snap ? snap->size() : 0;
+}
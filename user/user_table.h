@@ -0,0 +1,122 @@
+/*************************************************************
+*用户凭据表：分片的开放寻址哈希表，替代全局的map<string, string>
+*读操作无锁：每个分片的槽位数组通过原子指针发布，扩容时整体替换，旧数组延迟到析构时释放
+*写操作只锁所在分片；用户名和密码连续存放在分片自己的内存池（arena）中，不再每个节点一个std::string
+*所有用户名同时记入布隆过滤器，查询不存在的用户名时通常不必访问哈希表
+*可挂载一个只读的磁盘快照，哈希表只保存快照之后的增量，查询先查增量再查快照
+**************************************************************/
+
+#ifndef USER_TABLE_H
+#define USER_TABLE_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include "../lock/locker.h"
+#include "bloom_filter.h"
+#include "user_snapshot.h"
+
+using namespace std;
+
+class user_table
+{
+public:
+    //单例模式
+    static user_table *GetInstance();
+
+    //查找用户，找到时把密码写入passwd
+    bool find(const char *name, string &passwd) const;
+    //用户是否存在
+    bool contains(const char *name) const;
+    //登录校验，用户名存在且密码一致时返回true
+    bool check(const char *name, const char *passwd) const;
+    //插入新用户，用户已存在时返回false
+    bool insert(const char *name, const char *passwd);
+    //插入或覆盖用户的密码
+    void set(const char *name, const char *passwd);
+
+    //后台加载是否已完成；未完成时表中没有的用户仍需回查数据库
+    bool loaded() const { return m_loaded.load(std::memory_order_acquire); }
+    void set_loaded(bool loaded) { m_loaded.store(loaded, std::memory_order_release); }
+
+    //启动时挂载快照文件，成功后哈希表只作为增量使用
+    bool load_snapshot(const char *path);
+    //把快照与增量合并写成新的快照文件，自上次保存后没有变化时直接返回
+    bool save_snapshot(const char *path);
+    size_t snapshot_size() const;   //快照中的用户数
+
+    size_t size() const;            //增量中的用户数
+    size_t memory_usage() const;    //槽位数组与内存池占用的字节数
+
+private:
+    user_table();
+    ~user_table();
+    user_table(const user_table &);
+    user_table &operator=(const user_table &);
+
+    //内存池中的一条记录：哈希值、长度，随后依次是用户名和密码（不含结尾的\0）
+    struct entry
+    {
+        uint64_t hash;
+        uint16_t name_len;
+        uint16_t passwd_len;
+        char data[1];
+
+        const char *passwd() const { return data + name_len; }
+    };
+
+    //槽位数组，容量为2的幂，线性探测
+    struct table
+    {
+        size_t capacity;
+        std::atomic<const entry *> *slots;
+    };
+
+    //只追加的内存池，块一旦分配就不再移动，记录指针在表的生命周期内一直有效
+    struct arena
+    {
+        vector<char *> blocks;
+        size_t used;            //当前块已使用的字节数
+        size_t block_size;      //当前块的大小
+        size_t total;           //已分配的总字节数
+    };
+
+    //分片，按缓存行对齐避免相邻分片的锁互相干扰
+    struct alignas(64) shard
+    {
+        locker lock;                    //写锁
+        std::atomic<table *> tab;       //当前槽位数组
+        vector<table *> retired;        //扩容后被替换的旧数组，读者可能仍在使用
+        size_t count;                   //记录数
+        arena pool;
+    };
+
+    static const int SHARD_BITS = 6;
+    static const int SHARD_COUNT = 1 << SHARD_BITS;
+    static const size_t INIT_CAPACITY = 64;
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    static uint64_t hash(const char *s, size_t len);
+    static table *new_table(size_t capacity);
+    static void free_table(table *t);
+    //在表t中查找，返回记录所在的槽位下标，不存在时返回应插入的空槽位下标
+    static size_t probe(const table *t, uint64_t h, const char *name, size_t len, const entry **found);
+    const entry *lookup(const char *name, size_t len, uint64_t h) const;
+    //在快照中查找，未挂载快照时返回false
+    bool lookup_snapshot(const char *name, size_t len, uint64_t h, const char **passwd, size_t *passwd_len) const;
+    //以下函数需持有分片写锁
+    const entry *make_entry(shard &s, uint64_t h, const char *name, size_t name_len, const char *passwd, size_t passwd_len);
+    void grow(shard &s);
+
+    shard *m_shards;
+    bloom_filter m_bloom;           //增量中的全部用户名，只增不减
+    std::atomic<user_snapshot *> m_snapshot;
+    std::atomic<unsigned long long> m_version;  //每次写入加1
+    unsigned long long m_saved_version;         //上次保存快照时的版本
+    locker m_save_lock;             //串行化快照保存
+    std::atomic<bool> m_loaded;
+};
+
+#endif
@@ -0,0 +1,143 @@
+//分片用户表的单元测试：增删查、跨分片扩容、边界长度，以及并发写入时读者看到的数据始终完整
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include "user_table.h"
+#include "../test/check.h"
+
+using namespace std;
+
+static const int THREADS = 4;
+static const int PER_THREAD = 20000;
+
+static string name_of(int t, int i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "u%d_%d", t, i);
+    return buf;
+}
+
+static string passwd_of(const string &name)
+{
+    return "pw-" + name;
+}
+
+static void test_basic(user_table *users)
+{
+    string pw;
+    CHECK(!users->contains("alice"));
+    CHECK(!users->find("alice", pw));
+    CHECK(users->insert("alice", "secret"));
+    CHECK(!users->insert("alice", "other"));        //已存在时不覆盖
+    CHECK(users->find("alice", pw) && pw == "secret");
+    CHECK(users->contains("alice"));
+    CHECK(users->check("alice", "secret"));
+    CHECK(!users->check("alice", "secre"));
+    CHECK(!users->check("alice", "secret2"));
+    CHECK(!users->check("bob", "secret"));
+
+    users->set("alice", "changed");
+    CHECK(users->check("alice", "changed"));
+    users->set("bob", "new");                       //不存在时插入
+    CHECK(users->check("bob", "new"));
+    CHECK(users->size() == 2);
+
+    //空密码和较长的用户名、密码
+    string long_name(1000, 'n'), long_pw(4000, 'p');
+    CHECK(users->insert("empty", ""));
+    CHECK(users->find("empty", pw) && pw.empty());
+    CHECK(users->insert(long_name.c_str(), long_pw.c_str()));
+    CHECK(users->find(long_name.c_str(), pw) && pw == long_pw);
+    //前缀相同的用户名互不混淆
+    CHECK(!users->contains(long_name.substr(0, 999).c_str()));
+    CHECK(users->size() == 4);
+}
+
+struct writer_arg
+{
+    user_table *users;
+    int id;
+};
+
+static std::atomic<bool> writers_done(false);
+static std::atomic<long> reader_errors(0);
+
+static void *writer(void *arg)
+{
+    writer_arg *w = (writer_arg *)arg;
+    for (int i = 0; i < PER_THREAD; ++i)
+    {
+        string name = name_of(w->id, i);
+        if (!w->users->insert(name.c_str(), passwd_of(name).c_str()))
+            reader_errors++;
+    }
+    return NULL;
+}
+
+//写入进行时反复读：读到的用户密码必须完整正确，已确认写入的用户不会消失
+static void *reader(void *arg)
+{
+    user_table *users = (user_table *)arg;
+    string pw;
+    while (!writers_done.load())
+    {
+        for (int t = 0; t < THREADS; ++t)
+        {
+            for (int i = 0; i < PER_THREAD; i += 97)
+            {
+                string name = name_of(t, i);
+                if (users->find(name.c_str(), pw) && pw != passwd_of(name))
+                    reader_errors++;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void test_concurrent(user_table *users)
+{
+    size_t before = users->size();
+    pthread_t writers[THREADS], readers[2];
+    writer_arg args[THREADS];
+    for (int i = 0; i < 2; ++i)
+        pthread_create(&readers[i], NULL, reader, users);
+    for (int t = 0; t < THREADS; ++t)
+    {
+        args[t].users = users;
+        args[t].id = t;
+        pthread_create(&writers[t], NULL, writer, &args[t]);
+    }
+    for (int t = 0; t < THREADS; ++t)
+        pthread_join(writers[t], NULL);
+    writers_done = true;
+    for (int i = 0; i < 2; ++i)
+        pthread_join(readers[i], NULL);
+
+    CHECK(reader_errors.load() == 0);
+    CHECK(users->size() == before + THREADS * PER_THREAD);
+    int missing = 0;
+    string pw;
+    for (int t = 0; t < THREADS; ++t)
+    {
+        for (int i = 0; i < PER_THREAD; ++i)
+        {
+            string name = name_of(t, i);
+            if (!users->find(name.c_str(), pw) || pw != passwd_of(name))
+                ++missing;
+        }
+    }
+    CHECK(missing == 0);
+    CHECK(!users->contains(name_of(THREADS, 0).c_str()));
+    CHECK(users->memory_usage() > 0);
+}
+
+int main()
+{
+    user_table *users = user_table::GetInstance();
+    test_basic(users);
+    test_concurrent(users);
+    return check_report("user_table_test");
+}
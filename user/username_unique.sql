@@ -0,0 +1,4 @@
+-- 在每个分片的主库上执行一次，并发注册同一用户名时由唯一键保证只有一条成功
+-- 缺少该索引时服务器启动时报错，注册在本进程内按用户名串行化，多个实例之间仍可能插入重复的用户名
+-- 已有重复用户名时本语句失败，须先清理重复的行
+ALTER TABLE user ADD UNIQUE KEY username (username);
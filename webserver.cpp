@@ -1,4 +1,5 @@
 #include "webserver.h"
+#include "config.h"
 
 WebServer::WebServer()
 {
@@ -15,6 +16,8 @@ WebServer::WebServer()
 
     //定时器
     users_timer = new client_data[MAX_FD];          //创建客户数据数组
+
+    m_snapshot_stop = true;
 }
 
 WebServer::~WebServer()
@@ -23,25 +26,69 @@ WebServer::~WebServer()
     close(m_listenfd);
     close(m_pipefd[1]);
     close(m_pipefd[0]);
+    http_conn::stop_load();
+
+    //停止定期保存，退出前保存一次最新的用户表
+    m_snapshot_lock.lock();
+    bool snapshot_running = !m_snapshot_stop;
+    m_snapshot_stop = true;
+    m_snapshot_cond.broadcast();
+    m_snapshot_lock.unlock();
+    if (snapshot_running)
+    {
+        pthread_join(m_snapshot_tid, NULL);
+        if (user_table::GetInstance()->loaded())
+            user_table::GetInstance()->save_snapshot(USER_SNAPSHOT);
+    }
+    //先停止工作线程，再释放它们引用的连接对象
+    delete m_pool;
+    delete m_db_pool;
+    delete m_hash_pool;
+    sql_shard_map::GetInstance()->destroy();
     delete[] users;
     delete[] users_timer;
-    delete m_pool;
 }
 
-void WebServer::init(int port, string user, string passWord, string databaseName, int log_write, 
-                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model)
+void WebServer::init(const Config &config, string user, string passWord, string databaseName)
 {
-    m_port = port;
+    m_port = config.PORT;
     m_user = user;
     m_passWord = passWord;
     m_databaseName = databaseName;
-    m_sql_num = sql_num;
-    m_thread_num = thread_num;
-    m_log_write = log_write;
-    m_OPT_LINGER = opt_linger;
-    m_TRIGMode = trigmode;
-    m_close_log = close_log;
-    m_actormodel = actor_model;
+    m_sql_primary = config.sql_primary;
+    m_sql_replicas = config.sql_replicas;
+    m_sql_max_lag = config.sql_max_lag;
+    m_sql_num = config.sql_num;
+    m_sql_min = config.sql_min;
+    m_async_sql = config.async_sql;
+    m_batch_size = config.batch_size;
+    m_batch_window = config.batch_window;
+    m_snapshot_interval = config.snapshot_interval;
+    m_session_ttl = config.session_ttl;
+    m_upload_max_mb = config.upload_max_mb;
+    m_upload_max_files = config.upload_max_files;
+    m_thread_num = config.thread_num;
+    m_max_thread_num = config.max_thread_num;
+    m_db_thread_num = config.db_thread_num;
+    m_db_max_requests = config.db_max_requests;
+    m_hash_thread_num = config.hash_thread_num;
+    m_hash_max_requests = config.hash_max_requests;
+    m_log_write = config.LOGWrite;
+    m_log_level = config.log_level;
+    m_log_max_files = config.log_max_files;
+    m_log_max_size = config.log_max_size;
+    m_log_ring_size = config.log_ring_size;
+    m_access_format = config.access_format;
+    m_access_sample = config.access_sample;
+    m_access_slow = config.access_slow;
+    m_metrics_port = config.metrics_port;
+    m_metrics_path = config.metrics_path;
+    m_metrics_addr = config.metrics_addr;
+    m_trace_slow = config.trace_slow;
+    m_OPT_LINGER = config.OPT_LINGER;
+    m_TRIGMode = config.TRIGMode;
+    m_close_log = config.close_log;
+    m_actormodel = config.actor_model;
 }
 
 void WebServer::trig_mode()
@@ -78,27 +125,286 @@ void WebServer::log_write()
     if (0 == m_close_log)
     {
         //初始化日志
-        if (1 == m_log_write)       //异步
-            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 800);
+        Log::set_level(m_log_level);
+        if (2 == m_log_write)       //二进制日志，用logdecode还原
+            binlog::GetInstance()->init("./ServerLog", m_log_max_files, (long long)m_log_max_size << 20);
+        else if (3 == m_log_write)  //内存映射环形文件，用ringdump读取
+            Log::get_instance()->init_ring("./ServerLog.ring", m_close_log, 2000, (size_t)m_log_ring_size << 20);
+        else if (1 == m_log_write)  //异步，最多64块64KB的满缓冲区等待写入
+            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 64, m_log_max_files, (long long)m_log_max_size << 20);
         else
-            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0);
+            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0, m_log_max_files, (long long)m_log_max_size << 20);
+    }
+    //访问日志与调试日志分开，不受close_log影响
+    if (m_access_format)
+        access_log::GetInstance()->init("./AccessLog", m_access_format, m_access_sample, m_access_slow, m_close_log);
+    //慢请求的分段耗时，Chrome trace-event格式
+    if (m_trace_slow >= 0 && !req_tracer::GetInstance()->init("./RequestTrace.json", m_trace_slow, m_close_log))
+    {
+        LOG_ERROR("%s", "open request trace file failed");
     }
 }
 
 void WebServer::sql_pool()
 {
-    //初始化数据库连接池
+    //-H每个地址是一个分片的主库，-R中用分号分隔各分片的副本列表
+    vector<pair<string, int> > primary;
+    vector<string> replica_specs;
+    size_t begin = 0;
+    while (begin <= m_sql_replicas.size() && !m_sql_replicas.empty())
+    {
+        size_t end = m_sql_replicas.find(';', begin);
+        if (end == string::npos)
+            end = m_sql_replicas.size();
+        replica_specs.push_back(m_sql_replicas.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    if (!hash_ring::parse_endpoints(m_sql_primary, primary) || primary.empty() ||
+        replica_specs.size() > primary.size())
+    {
+        LOG_ERROR("bad database address: primary %s, replicas %s", m_sql_primary.c_str(), m_sql_replicas.c_str());
+        exit(1);
+    }
+
+    vector<sql_cluster *> clusters;
+    vector<string> ids;
+    for (size_t i = 0; i < primary.size(); ++i)
+    {
+        vector<pair<string, int> > replicas;
+        if (i < replica_specs.size() && !hash_ring::parse_endpoints(replica_specs[i], replicas))
+        {
+            LOG_ERROR("bad replica address: %s", replica_specs[i].c_str());
+            exit(1);
+        }
+
+        //初始化数据库连接池，第一个分片使用单例
+        connection_pool *pool = (i == 0) ? connection_pool::GetInstance() : new connection_pool;
+        pool->init(primary[i].first, m_user, m_passWord, m_databaseName, primary[i].second, m_sql_num, m_close_log, m_sql_min);
+
+        //只读副本，每个副本一个连接池
+        vector<connection_pool *> replica_pools;
+        for (size_t j = 0; j < replicas.size(); ++j)
+        {
+            connection_pool *replica = new connection_pool;
+            replica->init(replicas[j].first, m_user, m_passWord, m_databaseName, replicas[j].second, m_sql_num, m_close_log, m_sql_min);
+            replica_pools.push_back(replica);
+        }
+        sql_cluster *cluster = (i == 0) ? sql_cluster::GetInstance() : new sql_cluster;
+        cluster->init(pool, replica_pools, m_sql_max_lag, m_close_log);
+        clusters.push_back(cluster);
+
+        ids.push_back(hash_ring::endpoint_id(primary[i].first, primary[i].second));
+    }
+    sql_shard_map::GetInstance()->init(clusters, ids);
     m_connPool = connection_pool::GetInstance();
-    m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
 
-    //初始化数据库读取表，初始化全局变量user
-    users->initmysql_result(m_connPool);    //第一个客户初始化数据库读取表
+    //启动时检查各分片主库的user表，每个分片只取一次连接
+    //哈希写不进较窄的passwd列，任一分片不满足时不启用哈希，而不是让注册全部失败
+    //username上没有唯一索引时，并发注册同一用户名可能都插入成功；任一分片缺少时注册都在本进程内按用户名串行化
+    bool unique_name = true;
+    for (size_t i = 0; i < clusters.size(); ++i)
+    {
+        MYSQL *mysql = NULL;
+        connectionRAII mysqlcon(&mysql, clusters[i]->writer());
+        int width = mysql ? sql_stmt::passwd_width(mysql) : -1;
+        if (m_hash_thread_num > 0 && width < 0)
+        {
+            LOG_WARN("shard %s: cannot read the passwd column width, assuming hashes fit", ids[i].c_str());
+        }
+        else if (m_hash_thread_num > 0 && width < password_hasher::MIN_COLUMN_WIDTH)
+        {
+            LOG_ERROR("shard %s: passwd column holds %d chars, hashing needs %d; run user/passwd_hash.sql, hashing disabled",
+                      ids[i].c_str(), width, password_hasher::MIN_COLUMN_WIDTH);
+            m_hash_thread_num = 0;
+        }
+
+        int unique = mysql ? sql_stmt::username_unique(mysql) : -1;
+        if (unique < 0)
+        {
+            LOG_WARN("shard %s: cannot read the indexes of user, serializing registrations per name", ids[i].c_str());
+        }
+        else if (unique == 0)
+        {
+            LOG_ERROR("shard %s: username has no unique key; run user/username_unique.sql, serializing registrations per name",
+                      ids[i].c_str());
+        }
+        if (unique != 1)
+            unique_name = false;
+    }
+    sql_stmt::set_unique_name(unique_name);
+
+    //优先挂载上次保存的快照，之后的注册记入内存增量，快照中没有的用户回查数据库
+    //没有可用快照时后台流式加载数据库用户表，不阻塞启动
+    user_table *table = user_table::GetInstance();
+    if (table->load_snapshot(USER_SNAPSHOT))
+    {
+        table->set_loaded(true);
+        LOG_INFO("user snapshot loaded: %zu users", table->snapshot_size());
+    }
+    else
+        users->initmysql_result();
+
+    m_snapshot_stop = false;
+    if (pthread_create(&m_snapshot_tid, NULL, snapshot_worker, this) != 0)
+        m_snapshot_stop = true;
+
+    //异步数据库层和注册组提交只连接一个实例，分库时不启用，登录/注册走数据库执行器
+    if (primary.size() > 1)
+    {
+        if (1 == m_async_sql)
+        {
+            LOG_WARN("%s", "async sql is disabled with multiple shards");
+        }
+        if (m_batch_size > 1)
+        {
+            LOG_INFO("%s", "register batching is disabled with multiple shards");
+        }
+        m_async_sql = 0;
+        m_batch_size = 1;
+    }
+
+    //异步数据库层，单独建立与连接池同样数量的非阻塞连接，不可用时登录/注册仍走数据库执行器
+    if (1 == m_async_sql)
+        sql_async::GetInstance()->init(primary[0].first, m_user, m_passWord, m_databaseName, primary[0].second, m_sql_num, m_close_log);
+
+    //注册组提交，批处理线程从连接池取连接
+    register_batcher::GetInstance()->init(m_connPool, m_batch_size, m_batch_window, m_close_log);
+}
+
+void *WebServer::snapshot_worker(void *arg)
+{
+    WebServer *server = (WebServer *)arg;
+    int m_close_log = server->m_close_log;      //供LOG_*宏使用
+    server->m_snapshot_lock.lock();
+    while (!server->m_snapshot_stop)
+    {
+        if (server->m_snapshot_interval <= 0)
+        {
+            server->m_snapshot_cond.wait(server->m_snapshot_lock.get());
+            continue;
+        }
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += server->m_snapshot_interval;
+        server->m_snapshot_cond.timewait(server->m_snapshot_lock.get(), t);
+        if (server->m_snapshot_stop)
+            break;
+        server->m_snapshot_lock.unlock();
+        //用户表未加载完整时不保存，避免下次启动挂载不完整的快照
+        user_table *table = user_table::GetInstance();
+        if (table->loaded() && !table->save_snapshot(USER_SNAPSHOT))
+            LOG_ERROR("save user snapshot %s failed", USER_SNAPSHOT);
+        server->m_snapshot_lock.lock();
+    }
+    server->m_snapshot_lock.unlock();
+    return NULL;
 }
 
 void WebServer::thread_pool()
 {
     //线程池
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    m_pool = new threadpool<http_conn>(m_actormodel, m_thread_num, m_max_thread_num);
+
+    //数据库执行器，与处理静态请求的线程池隔离
+    m_db_pool = new bulkhead<http_conn>(&http_conn::process_db, m_db_thread_num, m_db_max_requests);
+    http_conn::m_db_pool = m_db_pool;
+
+    //密码哈希执行器，哈希每次耗时数毫秒，与静态请求和数据库执行器隔离
+    m_hash_pool = NULL;
+    if (m_hash_thread_num > 0)
+        m_hash_pool = new bulkhead<http_conn>(&http_conn::process_hash, m_hash_thread_num, m_hash_max_requests);
+    http_conn::m_hash_pool = m_hash_pool;
+    password_hasher::GetInstance()->init(m_hash_thread_num);
+
+    //会话存储，到期的会话在定时器tick时清理
+    session_store::GetInstance()->init(m_session_ttl);
+
+    //上传目录的配额，所有连接共用
+    upload_quota::GetInstance()->init(http_conn::UPLOAD_DIR, (long long)m_upload_max_mb << 20, m_upload_max_files);
+}
+
+//抓取指标时读取各模块瞬时值的回调
+static double open_connections(void *, int)
+{
+    return http_conn::m_user_count.load();
+}
+
+static double timer_count(void *arg, int)
+{
+    return ((Utils *)arg)->m_timer_lst.size();
+}
+
+static double threadpool_gauge(void *arg, int key)
+{
+    threadpool<http_conn> *pool = (threadpool<http_conn> *)arg;
+    if (key == 0)
+        return pool->thread_count();
+    if (key == 1)
+        return pool->queue_size();
+    return pool->stats().rejected.load();
+}
+
+static double bulkhead_gauge(void *arg, int key)
+{
+    bulkhead<http_conn> *pool = (bulkhead<http_conn> *)arg;
+    if (key == 1)
+        return pool->queue_size();
+    return pool->stats().rejected.load();
+}
+
+static double sql_gauge(void *arg, int key)
+{
+    pool_usage u = ((connection_pool *)arg)->GetStats();
+    return key == 0 ? u.free : u.in_use;
+}
+
+void WebServer::start_metrics()
+{
+    if (m_metrics_port <= 0)
+        return;
+    metrics *m = metrics::GetInstance();
+    m->add_gauge("webserver_open_connections", "Open client connections.", "gauge", "", open_connections, NULL, 0);
+    m->add_gauge("webserver_timers", "Connection timers in the timer list.", "gauge", "", timer_count, &utils, 0);
+    m->add_gauge("webserver_pool_threads", "Worker threads in the static request pool.", "gauge",
+                 "pool=\"static\"", threadpool_gauge, m_pool, 0);
+    m->add_gauge("webserver_pool_queue_length", "Requests waiting in an executor queue.", "gauge",
+                 "pool=\"static\"", threadpool_gauge, m_pool, 1);
+    m->add_gauge("webserver_pool_queue_length", "", "", "pool=\"db\"", bulkhead_gauge, m_db_pool, 1);
+    if (m_hash_pool)
+        m->add_gauge("webserver_pool_queue_length", "", "", "pool=\"hash\"", bulkhead_gauge, m_hash_pool, 1);
+    m->add_gauge("webserver_pool_rejected_total", "Requests rejected because an executor queue was full.", "counter",
+                 "pool=\"static\"", threadpool_gauge, m_pool, 2);
+    m->add_gauge("webserver_pool_rejected_total", "", "", "pool=\"db\"", bulkhead_gauge, m_db_pool, 2);
+    if (m_hash_pool)
+        m->add_gauge("webserver_pool_rejected_total", "", "", "pool=\"hash\"", bulkhead_gauge, m_hash_pool, 2);
+
+    //每个分片的主库和各副本连接池
+    sql_shard_map *shards = sql_shard_map::GetInstance();
+    for (int s = 0; s < shards->count(); ++s)
+    {
+        sql_cluster *cluster = shards->shard(s);
+        for (int i = -1; i < cluster->replica_count(); ++i)
+        {
+            connection_pool *pool = i < 0 ? cluster->writer() : cluster->replica(i);
+            for (int key = 0; key < 2; ++key)
+            {
+                char labels[256];
+                snprintf(labels, sizeof(labels), "shard=\"%s\",role=\"%s\",index=\"%d\",state=\"%s\"",
+                         shards->id(s).c_str(), i < 0 ? "primary" : "replica", i < 0 ? 0 : i, key == 0 ? "free" : "in_use");
+                m->add_gauge("webserver_sql_connections", "Database connections by pool and state.", "gauge",
+                             labels, sql_gauge, pool, key);
+            }
+        }
+    }
+
+    if (!m->start(m_metrics_addr.c_str(), m_metrics_port, m_metrics_path.c_str(), m_close_log))
+    {
+        LOG_ERROR("metrics: listen on %s:%d failed", m_metrics_addr.c_str(), m_metrics_port);
+    }
+    else
+    {
+        LOG_INFO("metrics: serving %s on %s:%d", m_metrics_path.c_str(), m_metrics_addr.c_str(), m_metrics_port);
+    }
 }
 
 void WebServer::eventListen()
@@ -162,6 +468,8 @@ void WebServer::eventListen()
     utils.addsig(SIGPIPE, SIG_IGN);                     //设置信号的处理函数，忽略该信号
     utils.addsig(SIGALRM, utils.sig_handler, false);    //设置信号的处理函数，将该信号发送给管道的另一端
     utils.addsig(SIGTERM, utils.sig_handler, false);    //设置信号的处理函数，将该信号发送给管道的另一端
+    utils.addsig(SIGUSR1, utils.sig_handler, false);    //运行中调整日志级别
+    utils.addsig(SIGUSR2, utils.sig_handler, false);
 
     alarm(TIMESLOT);
 
@@ -288,6 +596,13 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
                 stop_server = true;         //设置停止服务标志
                 break;
             }
+            case SIGUSR1:                   //降低日志级别，记录更详细的日志
+            case SIGUSR2:                   //提高日志级别，减少日志
+            {
+                Log::set_level(Log::level() + (signals[i] == SIGUSR1 ? -1 : 1));
+                LOG_WARN("log level changed to %d", Log::level());
+                break;
+            }
             }
         }
     }
@@ -452,6 +767,49 @@ void WebServer::eventLoop()
 
             LOG_INFO("%s", "timer tick");
 
+            session_store *sessions = session_store::GetInstance();
+            if (sessions->enabled())
+            {
+                int expired = sessions->expire();
+                LOG_INFO("sessions: %zu active, %d expired", sessions->size(), expired);
+            }
+
+            //两类请求各自的排队情况
+            const pool_stats &ps = m_pool->stats();
+            const pool_stats &ds = m_db_pool->stats();
+            LOG_INFO("static pool: threads %d, queued %d, rejected %lld, wait avg %lldus max %lldus",
+                     m_pool->thread_count(), m_pool->queue_size(), ps.rejected.load(), ps.wait_avg_us(), ps.wait_max_us.load());
+            LOG_INFO("db pool: queued %d, rejected %lld, wait avg %lldus max %lldus",
+                     m_db_pool->queue_size(), ds.rejected.load(), ds.wait_avg_us(), ds.wait_max_us.load());
+            if (m_hash_pool)
+            {
+                const pool_stats &hs = m_hash_pool->stats();
+                password_hasher *hasher = password_hasher::GetInstance();
+                LOG_INFO("hash pool: queued %d, rejected %lld, wait avg %lldus max %lldus, hash avg %lldus max %lldus, count %lld",
+                         m_hash_pool->queue_size(), hs.rejected.load(), hs.wait_avg_us(), hs.wait_max_us.load(),
+                         hasher->latency_avg_us(), hasher->latency_max_us(), hasher->count());
+            }
+            sql_shard_map *shards = sql_shard_map::GetInstance();
+            for (int s = 0; s < shards->count(); ++s)
+            {
+                sql_cluster *cluster = shards->shard(s);
+                pool_usage cs = cluster->writer()->GetStats();
+                LOG_INFO("sql pool %s: total %d, free %d, in use %d, waits %lld, wait avg %lldus max %lldus, timeouts %lld, connect failures %lld, reconnects %lld",
+                         shards->id(s).c_str(), cs.total, cs.free, cs.in_use, cs.waits, cs.waits ? cs.wait_total_us / cs.waits : 0, cs.wait_max_us,
+                         cs.timeouts, cs.connect_failures, cs.reconnects);
+                for (int i = 0; i < cluster->replica_count(); ++i)
+                {
+                    pool_usage rs = cluster->replica(i)->GetStats();
+                    LOG_INFO("replica %d: %s, lag %dms, total %d, in use %d, timeouts %lld",
+                             i, cluster->replica_healthy(i) ? "up" : "down", cluster->replica_lag_ms(i), rs.total, rs.in_use, rs.timeouts);
+                }
+                if (cluster->replica_count())
+                    LOG_INFO("primary reads: %lld", cluster->primary_reads());
+            }
+            register_batcher *batcher = register_batcher::GetInstance();
+            if (batcher->enabled())
+                LOG_INFO("register batch: batches %lld, rows %lld", batcher->batches(), batcher->rows());
+
             timeout = false;
         }
     }
@@ -18,21 +18,23 @@
 const int MAX_FD = 65536;           //最大文件描述符
 const int MAX_EVENT_NUMBER = 10000; //最大事件数
 const int TIMESLOT = 5;             //最小超时单位
+const char USER_SNAPSHOT[] = "./UserSnapshot";  //用户表快照文件
+
+class Config;
 
 class WebServer
 {
 public:
     WebServer();
     ~WebServer();
-    //初始化
-    void init(int port , string user, string passWord, string databaseName,
-              int log_write , int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+    //初始化，命令行解析出的各项参数取自config，数据库的登录名、密码和库名单独传入
+    void init(const Config &config, string user, string passWord, string databaseName);
 
     void thread_pool();     //设置listenfd触发模式和connfd触发模式
-    void sql_pool();        //初始化数据库连接池
+    void sql_pool();        //初始化数据库连接池，挂载用户表快照或后台加载用户表
     void log_write();       //初始化日志
     void trig_mode();       //初始化线程池
+    void start_metrics();   //登记各模块的瞬时指标并启动指标端口
 
     void eventListen();     //监听端口，创建epollfd，设置信号处理函数
     void eventLoop();       //eventLoop循环，调用epoll_wait
@@ -45,12 +47,24 @@ public:
     bool dealwithsignal(bool& timeout, bool& stop_server);              //处理信号
     void dealwithread(int sockfd);                                      //处理读
     void dealwithwrite(int sockfd);                                     //处理写
+    static void *snapshot_worker(void *arg);                            //定期保存用户表快照
 
 public:
     //基础
     int m_port;                         //端口号
     char *m_root;                       //root文件夹路径
-    int m_log_write;                    //异步日志或者同步日志
+    int m_log_write;                    //0同步日志，1异步日志，2二进制日志，3环形文件
+    int m_log_level;                    //初始日志级别
+    int m_log_max_files;                //日志归档保留个数
+    int m_log_max_size;                 //日志归档保留总大小(MB)
+    int m_log_ring_size;                //环形日志文件大小(MB)
+    int m_access_format;                //访问日志格式，0关闭
+    int m_access_sample;                //访问日志采样间隔
+    int m_access_slow;                  //慢请求阈值(毫秒)
+    int m_metrics_port;                 //指标端口，0表示不启用
+    string m_metrics_path;              //指标路径
+    string m_metrics_addr;              //指标端口绑定的地址
+    int m_trace_slow;                   //分段计时的慢请求阈值(毫秒)，小于0表示不启用
     int m_close_log;                    //是否关闭日志
     int m_actormodel;                   //actor模型    
 
@@ -63,11 +77,40 @@ public:
     string m_user;                      //登陆数据库用户名
     string m_passWord;                  //登陆数据库密码
     string m_databaseName;              //使用数据库名
-    int m_sql_num;                      //连接池数量
+    string m_sql_primary;               //主库地址host:port
+    string m_sql_replicas;              //只读副本地址，逗号分隔
+    int m_sql_max_lag;                  //副本可接受的复制延迟(毫秒)
+    int m_sql_num;                      //连接池数量上限
+    int m_sql_min;                      //连接池常驻连接数
+    int m_async_sql;                    //是否启用异步数据库层
+    int m_batch_size;                   //注册组提交每批最大条数
+    int m_batch_window;                 //注册组提交的收集窗口(毫秒)
+
+    //用户表快照相关
+    int m_snapshot_interval;            //快照保存间隔(秒)
+    pthread_t m_snapshot_tid;           //定期保存快照的线程
+    bool m_snapshot_stop;
+    locker m_snapshot_lock;
+    cond m_snapshot_cond;
+
+    int m_session_ttl;                  //会话有效期(秒)
+    int m_upload_max_mb;                //上传目录的总大小上限(MB)
+    int m_upload_max_files;             //上传目录的文件个数上限
 
     //线程池相关
     threadpool<http_conn> *m_pool;      //http连接线程池
-    int m_thread_num;
+    int m_thread_num;                   //常驻线程数
+    int m_max_thread_num;               //线程数上限
+
+    //数据库执行器相关
+    bulkhead<http_conn> *m_db_pool;     //登录/注册请求的执行器
+    int m_db_thread_num;                //数据库执行器线程数
+    int m_db_max_requests;              //数据库执行器排队上限
+
+    //密码哈希执行器相关
+    bulkhead<http_conn> *m_hash_pool;   //计算和校验密码哈希的执行器
+    int m_hash_thread_num;              //哈希执行器线程数
+    int m_hash_max_requests;            //哈希执行器排队上限
 
     //epoll_event相关
     epoll_event events[MAX_EVENT_NUMBER];